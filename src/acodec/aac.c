@@ -20,6 +20,7 @@ static const fmed_mod fmed_aac_mod = {
 
 extern const fmed_filter aac_adts_input;
 extern const fmed_filter aac_adts_output;
+extern int aac_adts_in_config(ffpars_ctx *ctx);
 
 //DECODE
 static void* aac_open(fmed_filt *d);
@@ -82,6 +83,8 @@ static int aac_conf(const char *name, ffpars_ctx *ctx)
 {
 	if (!ffsz_cmp(name, "encode"))
 		return aac_out_config(ctx);
+	else if (!ffsz_cmp(name, "in"))
+		return aac_adts_in_config(ctx);
 	return -1;
 }
 
@@ -282,7 +282,7 @@ static int flac_enc_encode(void *ctx, fmed_filt *d)
 		return FMED_RMORE;
 
 	case FFFLAC_RDATA:
-		fmed_setval("flac_in_frsamples", f->fl.frsamps);
+		fmed_setval_id(FMED_TRKV_FLAC_IN_FRSAMPLES, f->fl.frsamps);
 		break;
 
 	case FFFLAC_RDONE:
@@ -33,6 +33,7 @@ static const fmed_mod fmed_mpeg_mod = {
 extern const fmed_filter fmed_mpeg_input;
 extern const fmed_filter fmed_mpeg_output;
 extern int mpeg_out_config(ffpars_ctx *ctx);
+extern int mpeg_in_config(ffpars_ctx *ctx);
 extern const fmed_filter fmed_mpeg_copy;
 
 //DECODE
@@ -90,6 +91,8 @@ static const void* mpeg_iface(const char *name)
 
 static int mpeg_mod_conf(const char *name, ffpars_ctx *ctx)
 {
+	if (!ffsz_cmp(name, "in"))
+		return mpeg_in_config(ctx);
 	if (!ffsz_cmp(name, "encode"))
 		return mpeg_enc_config(ctx);
 	if (!ffsz_cmp(name, "out"))
@@ -392,9 +392,9 @@ static int opus_out_encode(void *ctx, fmed_filt *d)
 
 	o->npkt++;
 	if (o->npkt == 1 || o->npkt == 2)
-		fmed_setval("ogg_flush", 1);
+		fmed_setval_id(FMED_TRKV_OGG_FLUSH, 1);
 
-	fmed_setval("ogg_granpos", ffopus_enc_pos(&o->opus));
+	fmed_setval_id(FMED_TRKV_OGG_GRANPOS, ffopus_enc_pos(&o->opus));
 
 	dbglog(core, d->trk, NULL, "encoded %L samples into %L bytes"
 		, (d->datalen - o->opus.pcmlen) / ffpcm_size1(&o->fmt), o->opus.data.len);
@@ -373,9 +373,9 @@ static int vorbis_out_encode(void *ctx, fmed_filt *d)
 
 	v->npkt++;
 	if (v->npkt == 1 || v->npkt == 3)
-		fmed_setval("ogg_flush", 1);
+		fmed_setval_id(FMED_TRKV_OGG_FLUSH, 1);
 
-	fmed_setval("ogg_granpos", ffvorbis_enc_pos(&v->vorbis));
+	fmed_setval_id(FMED_TRKV_OGG_GRANPOS, ffvorbis_enc_pos(&v->vorbis));
 
 	dbglog(core, d->trk, NULL, "encoded %L samples into %L bytes"
 		, (d->datalen - v->vorbis.pcmlen) / ffpcm_size1(&v->fmt), v->vorbis.data.len);
@@ -92,7 +92,7 @@ static void wav_destroy(void)
 
 static void* wav_open(fmed_filt *d)
 {
-	fmed_wav *w = ffmem_tcalloc1(fmed_wav);
+	fmed_wav *w = fmed_trk_allocT(d, fmed_wav);
 	if (w == NULL) {
 		errlog(core, d->trk, "wav", "%s", ffmem_alloc_S);
 		return NULL;
@@ -105,7 +105,6 @@ static void wav_close(void *ctx)
 {
 	fmed_wav *w = ctx;
 	ffwav_close(&w->wav);
-	ffmem_free(w);
 }
 
 static void wav_meta(fmed_wav *w, fmed_filt *d)
@@ -302,7 +301,7 @@ data:
 
 static void* raw_open(fmed_filt *d)
 {
-	raw *r = ffmem_tcalloc1(raw);
+	raw *r = fmed_trk_allocT(d, raw);
 	if (r == NULL) {
 		errlog(core, d->trk, "raw", "%s", ffmem_alloc_S);
 		return NULL;
@@ -320,8 +319,6 @@ static void* raw_open(fmed_filt *d)
 
 static void raw_close(void *ctx)
 {
-	raw *r = ctx;
-	ffmem_free(r);
 }
 
 static int raw_read(void *ctx, fmed_filt *d)
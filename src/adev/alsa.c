@@ -18,6 +18,7 @@ typedef struct alsa_mod {
 	uint devidx;
 	uint out_valid :1;
 	uint init_ok :1;
+	uint handoff :1; // the previous track has left the device playing its last data
 } alsa_mod;
 
 static alsa_mod *mod;
@@ -34,6 +35,7 @@ struct alsa_out {
 		void *param;
 	} task;
 	uint stop :1;
+	uint handoff :1; // the next track will continue writing to the device
 };
 
 enum { I_TRYOPEN, I_OPEN, I_DATA };
@@ -290,11 +292,15 @@ static void alsa_close(void *ctx)
 	if (mod->usedby == a) {
 		void *trk = a->task.param;
 
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
+		if (FMED_NULL != mod->track->getval_id(trk, FMED_TRKV_STOPPED)) {
 			ffalsa_close(&mod->out);
 			ffmem_tzero(&mod->out);
 			mod->out_valid = 0;
 
+		} else if (a->handoff) {
+			ffalsa_async(&mod->out, 0);
+			mod->handoff = 1;
+
 		} else {
 			if (0 != (r = ffalsa_stop(&mod->out)))
 				errlog(core, trk,  "alsa", "ffalsa_stop(): (%d) %s", r, ffalsa_errstr(r));
@@ -336,13 +342,35 @@ static int alsa_create(alsa_out *a, fmed_filt *d)
 
 	if (mod->out_valid) {
 
-		if (mod->usedby != NULL) {
+		if (mod->usedby != NULL && mod->usedby != a) {
 			alsa_out *a = mod->usedby;
 			mod->usedby = NULL;
 			a->stop = 1;
 			alsa_onplay(a);
 		}
 
+		if (mod->handoff) {
+			if (!ffmemcmp(&fmt, &mod->fmt, sizeof(ffpcmex))
+				&& mod->devidx == a->devidx
+				&& ffalsa_filled(&mod->out) != 0) {
+				// gapless: continue after the previous track's data
+				mod->handoff = 0;
+				reused = 1;
+				goto fin;
+			}
+
+			r = ffalsa_stoplazy(&mod->out);
+			if (r == 0) {
+				// wait until the previous track's data is played, then reopen the device
+				mod->out.udata = a;
+				mod->usedby = a;
+				ffalsa_async(&mod->out, 1);
+				return FMED_RASYNC;
+			}
+			mod->handoff = 0;
+			mod->usedby = NULL;
+		}
+
 		if (!ffmemcmp(&fmt, &mod->fmt, sizeof(ffpcmex))
 			&& mod->devidx == a->devidx) {
 
@@ -494,6 +522,12 @@ static int alsa_write(void *ctx, fmed_filt *d)
 
 	if ((d->flags & FMED_FLAST) && d->datalen == 0) {
 
+		if (d->snd_output_gapless) {
+			// the next track continues writing to the device: don't wait until it's drained
+			a->handoff = 1;
+			return FMED_RDONE;
+		}
+
 		r = ffalsa_stoplazy(&mod->out);
 		if (r == 1)
 			return FMED_RDONE;
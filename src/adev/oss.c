@@ -236,7 +236,7 @@ static void oss_close(void *ctx)
 	if (mod->usedby == o) {
 		void *trk = o->trk;
 
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
+		if (FMED_NULL != mod->track->getval_id(trk, FMED_TRKV_STOPPED)) {
 			ffoss_close(&mod->out);
 			ffmem_tzero(&mod->out);
 			mod->out_valid = 0;
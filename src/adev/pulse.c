@@ -18,6 +18,7 @@ typedef struct pulse_mod {
 	uint devidx;
 	uint out_valid :1;
 	uint init_ok :1;
+	uint handoff :1; // the previous track has left the device playing its last data
 } pulse_mod;
 
 static pulse_mod *mod;
@@ -31,6 +32,7 @@ struct pulse_out {
 
 	void *trk;
 	uint stop :1;
+	uint handoff :1; // the next track will continue writing to the device
 };
 
 enum { I_OPEN, I_DATA };
@@ -243,11 +245,15 @@ static void pulse_close(void *ctx)
 	if (mod->usedby == a) {
 		void *trk = a->trk;
 
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
+		if (FMED_NULL != mod->track->getval_id(trk, FMED_TRKV_STOPPED)) {
 			ffpulse_close(&mod->out);
 			ffmem_tzero(&mod->out);
 			mod->out_valid = 0;
 
+		} else if (a->handoff) {
+			ffpulse_async(&mod->out, 0);
+			mod->handoff = 1;
+
 		} else {
 			if (0 != (r = ffpulse_stop(&mod->out)))
 				errlog(core, trk,  "pulse", "ffpulse_stop(): (%d) %s", r, ffpulse_errstr(r));
@@ -287,17 +293,39 @@ static int pulse_create(pulse_out *a, fmed_filt *d)
 
 	if (mod->out_valid) {
 
-		if (mod->usedby != NULL) {
+		if (mod->usedby != NULL && mod->usedby != a) {
 			pulse_out *a = mod->usedby;
 			mod->usedby = NULL;
 			a->stop = 1;
 			pulse_onplay(a);
 		}
 
-		if (fmt.channels == mod->fmt.channels
+		uint same = (fmt.channels == mod->fmt.channels
 			&& fmt.format == mod->fmt.format
 			&& fmt.sample_rate == mod->fmt.sample_rate
-			&& mod->devidx == a->devidx) {
+			&& mod->devidx == a->devidx);
+
+		if (mod->handoff) {
+			if (same && ffpulse_filled(&mod->out) != 0) {
+				// gapless: continue after the previous track's data
+				mod->handoff = 0;
+				reused = 1;
+				goto fin;
+			}
+
+			r = ffpulse_drain(&mod->out);
+			if (r == 0) {
+				// wait until the previous track's data is played, then reopen the device
+				mod->out.udata = a;
+				mod->usedby = a;
+				ffpulse_async(&mod->out, 1);
+				return FMED_RASYNC;
+			}
+			mod->handoff = 0;
+			mod->usedby = NULL;
+		}
+
+		if (same) {
 
 			ffpulse_stop(&mod->out);
 			ffpulse_clear(&mod->out);
@@ -412,6 +440,12 @@ static int pulse_write(void *ctx, fmed_filt *d)
 
 	if (d->flags & FMED_FLAST) {
 
+		if (d->snd_output_gapless) {
+			// the next track continues writing to the device: don't wait until it's drained
+			a->handoff = 1;
+			return FMED_RDONE;
+		}
+
 		r = ffpulse_drain(&mod->out);
 		if (r == 1)
 			return FMED_RDONE;
@@ -442,7 +442,7 @@ static void wasapi_close(void *ctx)
 	wasapi_out *w = ctx;
 	if (mod->usedby == w) {
 		void *trk = w->trk;
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
+		if (FMED_NULL != mod->track->getval_id(trk, FMED_TRKV_STOPPED)) {
 			wasapi_closedev();
 		} else {
 			ffwas_stop(&mod->out);
@@ -28,11 +28,13 @@ const fmed_filter fmed_sndmod_autoconv = {
 
 enum {
 	CONV_OUTBUF_MSEC = 500,
+	CONV_BLOCK_SAMPLES = 4 * 1024, // apply gain and convert by blocks of this size
 };
 
 typedef struct sndmod_conv {
 	uint state;
 	uint out_samp_size;
+	uint gain :1; // apply track gain
 	ffpcmex inpcm
 		, outpcm;
 	ffstr3 buf;
@@ -67,6 +69,7 @@ static ssize_t sndmod_conv_cmd(void *ctx, uint cmd, ...)
 		const struct fmed_aconv *conf = va_arg(va, void*);
 		c->inpcm = conf->in;
 		c->outpcm = conf->out;
+		c->gain = conf->gain;
 		c->state = 1;
 		r = 0;
 		break;
@@ -160,6 +163,46 @@ static int sndmod_conv_prepare(sndmod_conv *c, fmed_filt *d)
 	return FMED_ROK;
 }
 
+/** Apply gain to input data and convert it.
+Data is processed by small blocks, so a block is still in CPU cache when it's converted. */
+static int conv_gain(sndmod_conv *c, fmed_filt *d, uint samples, double db)
+{
+	double gain = ffpcm_db2gain(db);
+	uint in_ch = c->inpcm.channels, out_ch = c->outpcm.channels & FFPCM_CHMASK;
+	uint in_fsize = ffpcm_size(c->inpcm.format, 1), out_fsize = ffpcm_size(c->outpcm.format, 1);
+	void *in[8], *out[FFPCM_CHMASK + 1];
+	const void *inp;
+	void *outp;
+	uint n;
+
+	for (uint i = 0;  i != samples;  i += n) {
+		n = ffmin(samples - i, CONV_BLOCK_SAMPLES);
+
+		if (!c->inpcm.ileaved) {
+			for (uint ich = 0;  ich != in_ch;  ich++) {
+				in[ich] = (char*)d->datani[ich] + c->off + i * in_fsize;
+			}
+			inp = in;
+		} else {
+			inp = (char*)d->data + (c->off + i * in_fsize) * in_ch;
+		}
+
+		if (!c->outpcm.ileaved) {
+			for (uint ich = 0;  ich != out_ch;  ich++) {
+				out[ich] = ((char**)c->buf.ptr)[ich] + i * out_fsize;
+			}
+			outp = out;
+		} else {
+			outp = c->buf.ptr + i * c->out_samp_size;
+		}
+
+		ffpcm_gain(&c->inpcm, gain, inp, (void*)inp, n);
+		if (0 != ffpcm_convert(&c->outpcm, outp, &c->inpcm, inp, n))
+			return -1;
+	}
+	return 0;
+}
+
 static int sndmod_conv_process(void *ctx, fmed_filt *d)
 {
 	sndmod_conv *c = ctx;
@@ -206,7 +249,12 @@ static int sndmod_conv_process(void *ctx, fmed_filt *d)
 		data = (char*)d->data + c->off * c->inpcm.channels;
 	}
 
-	if (0 != ffpcm_convert(&c->outpcm, c->buf.ptr, &c->inpcm, data, samples)) {
+	int db = d->audio.gain;
+	if (c->gain && db != FMED_NULL && db != 0) {
+		if (0 != conv_gain(c, d, samples, (double)db / 100))
+			return FMED_RERR;
+
+	} else if (0 != ffpcm_convert(&c->outpcm, c->buf.ptr, &c->inpcm, data, samples)) {
 		return FMED_RERR;
 	}
 
@@ -233,6 +281,24 @@ struct autoconv {
 	ffpcmex inpcm, outpcm;
 };
 
+/** Apply track gain in-place and pass data through.
+Used when #soundmod.gain isn't in chain (fmed_trk.conv_gain) and the gain can't be applied by converter. */
+static int autoconv_gain(struct autoconv *c, fmed_filt *d)
+{
+	int db = d->audio.gain;
+	if (db != FMED_NULL && db != 0) {
+		double gain = ffpcm_db2gain((double)db / 100);
+		ffpcm_gain(&c->inpcm, gain, d->data, (void*)d->data, d->datalen / ffpcm_size1(&c->inpcm));
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_ROK;
+}
+
 static void* autoconv_open(fmed_filt *d)
 {
 	if (d->stream_copy) {
@@ -274,6 +340,8 @@ static int autoconv_process(void *ctx, fmed_filt *d)
 		return FMED_RDATA;
 	case 1:
 		break;
+	case 2:
+		return autoconv_gain(c, d);
 	}
 
 	const ffpcmex *in = &d->audio.fmt;
@@ -288,6 +356,10 @@ static int autoconv_process(void *ctx, fmed_filt *d)
 		&& in->channels == out->channels
 		&& in->sample_rate == out->sample_rate
 		&& in->ileaved == out->ileaved) {
+		if (d->conv_gain) {
+			c->state = 2;
+			return autoconv_gain(c, d);
+		}
 		d->out = d->data,  d->outlen = d->datalen;
 		return FMED_RDONE; //no conversion is needed
 	}
@@ -308,8 +380,17 @@ static int autoconv_process(void *ctx, fmed_filt *d)
 		&& (c->outpcm.channels & ~FFPCM_CHMASK) != 0)
 		conf.out.channels = c->outpcm.channels;
 
+	// gain can't be applied by #soundmod.conv if it passes the data to soxr
+	if (d->conv_gain && in->sample_rate == out->sample_rate)
+		conf.gain = 1;
+
 	conv->cmd(fi, 0, &conf);
 
+	if (d->conv_gain && !conf.gain) {
+		c->state = 2;
+		return autoconv_gain(c, d);
+	}
+
 	d->out = d->data,  d->outlen = d->datalen;
 	return FMED_RDONE;
 }
@@ -131,7 +131,7 @@ static int danorm_f_process(void *ctx, fmed_filt *d)
 
 	case 0:
 		if (d->audio.fmt.format != FFPCM_FLOAT64 || d->audio.fmt.ileaved) {
-			struct fmed_aconv conv;
+			struct fmed_aconv conv = {};
 			conv.in = d->audio.fmt;
 			conv.out = d->audio.fmt;
 			conv.out.format = FFPCM_FLOAT64;
@@ -69,6 +69,7 @@ typedef struct fmed_cmd {
 	byte out_copy;
 	byte preserve_date;
 	byte parallel;
+	byte parallel_segments;
 
 	ffstr dummy;
 
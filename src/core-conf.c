@@ -31,6 +31,12 @@ static const ffpars_enumlist im_enum = { im_enumstr, FFCNT(im_enumstr), FFPARS_D
 
 static const ffpars_arg conf_args[] = {
 	{ "workers",	FFPARS_TINT8, FFPARS_DSTOFF(fmed_config, workers) },
+	{ "work_stealing",	FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, work_stealing) },
+	{ "filter_stats",	FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, filter_stats) },
+	{ "conv_pipeline",	FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, conv_pipeline) },
+	{ "stdio_splice",	FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, stdio_splice) },
+	{ "log_async",	FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, log_async) },
+	{ "worker_events",	FFPARS_TINT | FFPARS_FNOTZERO, FFPARS_DSTOFF(fmed_config, worker_events) },
 	{ "mod",	FFPARS_TSTR | FFPARS_FNOTEMPTY | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FMULTI, FFPARS_DST(&conf_mod) },
 	{ "mod_conf",	FFPARS_TOBJ | FFPARS_FOBJ1 | FFPARS_FNOTEMPTY | FFPARS_FMULTI, FFPARS_DST(&conf_modconf) },
 	{ "output",	FFPARS_TSTR | FFPARS_FNOTEMPTY | FFPARS_FMULTI, FFPARS_DST(&conf_output) },
@@ -11,6 +11,12 @@ typedef struct fmed_config {
 	byte instance_mode;
 	byte prevent_sleep;
 	byte workers;
+	byte work_stealing;
+	byte log_async;
+	byte filter_stats;
+	byte conv_pipeline;
+	byte stdio_splice;
+	uint worker_events;
 	ffpcm inp_pcm;
 	const fmed_modinfo *output;
 	const fmed_modinfo *input;
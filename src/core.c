@@ -44,6 +44,10 @@ typedef struct fmedia {
 
 	const fmed_queue *qu;
 	const fmed_log *log;
+	ffthd logthd;
+	uint log_stop;
+	ffatomic log_dropped; // number of messages lost because worker's ring buffer was full
+	size_t log_dropped_reported;
 
 #ifdef FF_WIN
 	ffwoh *woh;
@@ -63,7 +67,75 @@ struct worker {
 	uint period;
 
 	ffatomic njobs;
+	struct logring *logr;
+	char stime[32]; // log time cached for the current loop iteration
 	uint init :1;
+	uint inloop :1;
+	uint stime_valid :1;
+};
+
+#ifdef _MSC_VER
+#define FMED_THDLOCAL  __declspec(thread)
+#else
+#define FMED_THDLOCAL  __thread
+#endif
+
+/** Worker object associated with the current thread. */
+static FMED_THDLOCAL struct worker *work_self;
+
+enum {
+	LOGREC_MSG = 1024 - 128,
+	LOGREC_ARGS = 12,
+	LOGFMT_SPEC_MAX = 16,
+	LOGRING_RECS = 256, // power of 2
+	LOG_FLUSH_INT = 20, //msec
+};
+
+enum LOGARG {
+	LOGARG_INT, // %d, %u
+	LOGARG_INT64, // %D, %U
+	LOGARG_SIZE, // %L
+	LOGARG_PTR, // %p
+	LOGARG_DBL, // %F
+	LOGARG_SZ, // %s
+	LOGARG_STR, // %S
+	LOGARG_STRN, // %*s
+};
+
+/** Log message argument copied by a worker. */
+struct logarg {
+	uint type; //enum LOGARG
+	union {
+		int i;
+		int64 i64;
+		size_t sz;
+		void *p;
+		double d;
+		struct {
+			uint off, len; // string data in logrec.msg
+		} s;
+	};
+};
+
+/** Log message waiting to be formatted and written by log thread. */
+struct logrec {
+	uint flags;
+	uint64 tid;
+	char stime[16];
+	char module[32];
+	char ctx[16];
+	uint ctxlen;
+	uint nargs; // (uint)-1: 'msg' contains the message formatted by the worker
+	uint msglen; // length of the formatted message or of the format string
+	struct logarg args[LOGREC_ARGS];
+	char msg[LOGREC_MSG]; // format string, then the data of string arguments
+};
+
+/** Lock-free single-producer (worker) single-consumer (log thread) ring buffer. */
+struct logring {
+	size_t head; // written by worker
+	size_t tail; // written by log thread
+	struct logrec recs[LOGRING_RECS];
 };
 
 typedef struct core_modinfo {
@@ -79,7 +151,8 @@ typedef struct core_modinfo {
 static fmedia *fmed;
 
 enum {
-	FMED_KQ_EVS = 8,
+	FMED_KQ_EVS = 64, // default number of events per one kqueue call
+	FMED_KQ_EVS_MAX = 1024,
 	TMR_INT = 250,
 };
 
@@ -114,11 +187,15 @@ static void mod_freeiface(core_mod *m);
 
 static int wrk_init(struct worker *w, uint thread);
 static void wrk_destroy(struct worker *w);
-static uint work_assign(uint flags);
+static uint work_assign(uint flags, uint except);
 static void work_release(uint wid, uint flags);
 static uint work_avail();
 static int FFTHDCALL work_loop(void *param);
 
+static int log_async_init(void);
+static void log_async_stop(void);
+static int FFTHDCALL log_loop(void *param);
+
 static const void* core_iface(const char *name);
 static int core_sig2(uint signo);
 static void core_destroy(void);
@@ -202,6 +279,11 @@ static void core_posted(void *udata)
 static int conf_init(fmed_config *conf)
 {
 	conf->codepage = FFU_WIN1252;
+	conf->work_stealing = 1;
+	conf->worker_events = FMED_KQ_EVS;
+	conf->filter_stats = 1;
+	conf->conv_pipeline = 0;
+	conf->stdio_splice = 1;
 	return 0;
 }
 
@@ -221,6 +303,7 @@ fmed_core* core_init(char **argv, char **env)
 	if (fmed == NULL)
 		return NULL;
 	fmed->log = &log_dummy;
+	fmed->logthd = FFTHD_INV;
 	if (0 != ffenv_init(&fmed->env, env))
 		goto err;
 
@@ -281,6 +364,8 @@ void core_free(void)
 			wrk_destroy(w);
 	}
 	tracks_destroy();
+	log_async_stop();
+	work_self = NULL;
 	ffarr_free(&fmed->workers);
 
 	FFLIST_WALKSAFE(&fmed->mods, mod, sib, next) {
@@ -751,6 +836,9 @@ static int core_open(void)
 	if (NULL == ffarr_alloczT(&fmed->workers, n, struct worker))
 		return 1;
 	fmed->workers.len = n;
+	if (fmed->conf.log_async
+		&& 0 != log_async_init())
+		return 1;
 	struct worker *w = (void*)fmed->workers.ptr;
 	if (0 != wrk_init(w, 0))
 		return 1;
@@ -778,6 +866,12 @@ static int wrk_init(struct worker *w, uint thread)
 	w->evposted.oneshot = 0;
 	w->evposted.handler = &core_posted;
 
+	if (fmed->logthd != FFTHD_INV
+		&& NULL == (w->logr = ffmem_new(struct logring))) {
+		syserrlog("%s", ffmem_alloc_S);
+		return 1;
+	}
+
 	if (thread) {
 		w->thd = ffthd_create(&work_loop, w, 0);
 		if (w->thd == FFTHD_INV) {
@@ -788,6 +882,7 @@ static int wrk_init(struct worker *w, uint thread)
 		// w->id is set inside a new thread
 	} else {
 		w->id = ffthd_curid();
+		work_self = w;
 	}
 
 	w->init = 1;
@@ -812,8 +907,9 @@ static void wrk_destroy(struct worker *w)
 
 /** Find the worker with the least number of active jobs.
 Initialize data and create a thread if necessary.
+except: (FMED_WORKER_FOTHER) worker ID to skip
 Return worker ID. */
-static uint work_assign(uint flags)
+static uint work_assign(uint flags, uint except)
 {
 	struct worker *w, *ww = (void*)fmed->workers.ptr;
 	uint id = 0, j = -1;
@@ -825,6 +921,8 @@ static uint work_assign(uint flags)
 	}
 
 	FFARR_WALKT(&fmed->workers, w, struct worker) {
+		if ((flags & FMED_WORKER_FOTHER) && (uint)(w - ww) == except)
+			continue;
 		uint nj = ffatom_get(&w->njobs);
 		if (nj < j) {
 			id = w - ww;
@@ -883,26 +981,74 @@ ffbool core_job_shouldyield(uint id, size_t *ctx)
 	return (*ctx != w->taskmgr.tasks.len);
 }
 
+/** Move a parallel job away from an overloaded worker.
+Only the workers which are already running are considered,
+ because a new thread may be created on main thread only (see work_assign()). */
+uint core_job_migrate(uint id, uint except, fftask **tasks, uint ntasks, fffd *kq)
+{
+	struct worker *w = ffarr_itemT(&fmed->workers, id, struct worker);
+	FF_ASSERT(w->id == ffthd_curid());
+	if (!fmed->conf.work_stealing
+		|| ffatom_get(&w->njobs) <= 1)
+		return id;
+	for (uint i = 0;  i != ntasks;  i++) {
+		if (fftask_active(&w->taskmgr, tasks[i]))
+			return id;
+	}
+
+	struct worker *it, *ww = (void*)fmed->workers.ptr;
+	FFARR_WALKT(&fmed->workers, it, struct worker) {
+		if (it == w || !it->init || (uint)(it - ww) == except)
+			continue;
+		// claim the idle worker: another overloaded worker may try to do the same
+		if (ffatom_get(&it->njobs) != 0
+			|| !ffatom_cmpset(&it->njobs, 0, 1))
+			continue;
+		ssize_t n = ffatom_decret(&w->njobs);
+		FMED_ASSERT(n >= 0);
+		*kq = it->kq;
+		dbglog0("job moved from worker #%u to #%u", id, (uint)(it - ww));
+		return it - ww;
+	}
+	return id;
+}
+
+ffbool core_job_iscurrent(uint id)
+{
+	struct worker *w = ffarr_itemT(&fmed->workers, id, struct worker);
+	return (w->id == ffthd_curid());
+}
+
 ffbool core_ismainthr(void)
 {
 	struct worker *w = ffarr_itemT(&fmed->workers, 0, struct worker);
 	return (w->id == ffthd_curid());
 }
 
-/** Worker's event loop. */
+/** Worker's event loop.
+Kernel events are received and processed in batches:
+ all ready events are handled first, then the tasks they've posted are run once per batch.
+There's no io_uring backend: the loop waits on the worker's kqueue (epoll on Linux),
+ because file AIO (fffileread), timers (fftimer_queue), cross-thread task posting (ffkqu_post)
+ and the audio device modules all register their fds with this kqueue through FFOS.
+Switching the wait to io_uring would require an io_uring variant of each of these FFOS objects. */
 static int FFTHDCALL work_loop(void *param)
 {
 	struct worker *w = param;
 	w->id = ffthd_curid();
-	ffkqu_entry *ents = ffmem_callocT(FMED_KQ_EVS, ffkqu_entry);
+	work_self = w;
+	uint nevs = ffmin(fmed->conf.worker_events, FMED_KQ_EVS_MAX);
+	ffkqu_entry *ents = ffmem_callocT(nevs, ffkqu_entry);
 	if (ents == NULL)
 		return -1;
 
-	dbglog(core, NULL, "core", "entering kqueue loop", 0);
+	dbglog(core, NULL, "core", "entering kqueue loop  events:%u", nevs);
+	w->inloop = 1;
 
 	while (!FF_READONCE(fmed->stopped)) {
 
-		uint nevents = ffkqu_wait(w->kq, ents, FMED_KQ_EVS, &fmed->kqutime);
+		uint nevents = ffkqu_wait(w->kq, ents, nevs, &fmed->kqutime);
+		w->stime_valid = 0;
 
 		if ((int)nevents < 0) {
 			if (fferr_last() != EINTR) {
@@ -915,11 +1061,12 @@ static int FFTHDCALL work_loop(void *param)
 		for (uint i = 0;  i != nevents;  i++) {
 			ffkqu_entry *ev = &ents[i];
 			ffkev_call(ev);
-
-			fftask_run(&w->taskmgr);
 		}
+
+		fftask_run(&w->taskmgr);
 	}
 
+	w->inloop = 0;
 	ffmem_free(ents);
 	return 0;
 }
@@ -1052,7 +1199,8 @@ static ssize_t core_cmd(uint signo, ...)
 	case FMED_WORKER_ASSIGN: {
 		fffd *pkq = va_arg(va, fffd*);
 		uint flags = va_arg(va, uint);
-		r = work_assign(flags);
+		uint except = (flags & FMED_WORKER_FOTHER) ? va_arg(va, uint) : 0;
+		r = work_assign(flags, except);
 		struct worker *w = ffarr_itemT(&fmed->workers, r, struct worker);
 		*pkq = w->kq;
 		break;
@@ -1186,6 +1334,12 @@ static int64 core_getval(const char *name)
 		return fmed->conf.codepage;
 	else if (!ffsz_cmp(name, "instance_mode"))
 		return fmed->conf.instance_mode;
+	else if (ffsz_eq(name, "filter_stats"))
+		return fmed->conf.filter_stats;
+	else if (ffsz_eq(name, "conv_pipeline"))
+		return (fmed->conf.conv_pipeline && fmed->workers.len > 1);
+	else if (ffsz_eq(name, "stdio_splice"))
+		return fmed->conf.stdio_splice;
 	return FMED_NULL;
 }
 
@@ -1201,12 +1355,325 @@ static void core_log(uint flags, void *trk, const char *module, const char *fmt,
 	va_end(va);
 }
 
-static void core_logv(uint flags, void *trk, const char *module, const char *fmt, va_list va)
+/** Get the current local time as a string. */
+static size_t log_stime(char *buf, size_t cap)
 {
-	char stime[32];
 	ffdtm dt;
 	fftime t;
-	size_t r;
+	fftime_now(&t);
+	fftime_split(&dt, &t, FFTIME_TZLOCAL);
+	size_t r = fftime_tostr(&dt, buf, cap - 1, FFTIME_HMS_MSEC);
+	buf[r] = '\0';
+	return r;
+}
+
+/** Pass data to logger.
+ld.va is initialized from the function's arguments. */
+static void log_write(uint flags, fmed_logdata *ld, const char *fmt, ...)
+{
+	ld->fmt = fmt;
+	va_start(ld->va, fmt);
+	fmed->log->log(flags, ld);
+	va_end(ld->va);
+}
+
+/** Get the type of the argument for the format specifier at fmt[0] == '%'.
+Only the specifiers that log thread can reproduce from a copied argument are supported:
+ %[0][width][.prec][x|X]{d|u|D|U|L|p|F}, %s, %S, %*s.
+*n: length of the specifier
+Return enum LOGARG;  -1 if not supported. */
+static int logfmt_spec(const char *fmt, size_t end, size_t *n)
+{
+	size_t i = 1;
+	int t;
+
+	if (i + 1 < end && fmt[i] == '*' && fmt[i + 1] == 's') {
+		*n = 3;
+		return LOGARG_STRN;
+	}
+
+	while (i != end && ((fmt[i] >= '0' && fmt[i] <= '9') || fmt[i] == '.' || fmt[i] == 'x' || fmt[i] == 'X'))
+		i++;
+	if (i == end || i + 1 >= LOGFMT_SPEC_MAX)
+		return -1;
+
+	switch (fmt[i]) {
+	case 'd': case 'u':
+		t = LOGARG_INT; break;
+	case 'D': case 'U':
+		t = LOGARG_INT64; break;
+	case 'L':
+		t = LOGARG_SIZE; break;
+	case 'p':
+		t = LOGARG_PTR; break;
+	case 'F':
+		t = LOGARG_DBL; break;
+	case 's':
+		t = LOGARG_SZ; break;
+	case 'S':
+		t = LOGARG_STR; break;
+	default:
+		return -1;
+	}
+	if ((t == LOGARG_SZ || t == LOGARG_STR) && i != 1)
+		return -1;
+	*n = i + 1;
+	return t;
+}
+
+/** Copy the format string and the arguments into the record.
+String arguments are copied (truncated if there's no space left), because they may not live until the message is written.
+Return 0 if the message can be formatted by log thread. */
+static int log_args_copy(struct logrec *r, const char *fmt, va_list va)
+{
+	size_t fmtlen = ffsz_len(fmt), off, n;
+	const char *s;
+	uint na = 0;
+
+	if (fmtlen > sizeof(r->msg))
+		return -1;
+	ffmemcpy(r->msg, fmt, fmtlen);
+	off = fmtlen;
+
+	for (size_t i = 0;  i != fmtlen;  i++) {
+		if (fmt[i] != '%')
+			continue;
+
+		int t = logfmt_spec(fmt + i, fmtlen - i, &n);
+		if (t < 0 || na == LOGREC_ARGS)
+			return -1;
+		i += n - 1;
+
+		struct logarg *a = &r->args[na++];
+		a->type = t;
+		switch (t) {
+		case LOGARG_INT:
+			a->i = va_arg(va, int); continue;
+		case LOGARG_INT64:
+			a->i64 = va_arg(va, int64); continue;
+		case LOGARG_SIZE:
+			a->sz = va_arg(va, size_t); continue;
+		case LOGARG_PTR:
+			a->p = va_arg(va, void*); continue;
+		case LOGARG_DBL:
+			a->d = va_arg(va, double); continue;
+
+		case LOGARG_SZ:
+			s = va_arg(va, char*);
+			if (s == NULL)
+				s = "(null)";
+			n = ffsz_len(s);
+			break;
+		case LOGARG_STR: {
+			const ffstr *str = va_arg(va, ffstr*);
+			s = str->ptr,  n = str->len;
+			break;
+		}
+		case LOGARG_STRN:
+			n = va_arg(va, size_t);
+			s = va_arg(va, char*);
+			break;
+		}
+
+		n = ffmin(n, sizeof(r->msg) - off);
+		ffmemcpy(r->msg + off, s, n);
+		a->s.off = off;
+		a->s.len = n;
+		off += n;
+	}
+
+	r->nargs = na;
+	r->msglen = fmtlen;
+	return 0;
+}
+
+/** Format the message from the copied format string and arguments. */
+static size_t log_args_fmt(const struct logrec *r, char *buf, size_t cap)
+{
+	const char *fmt = r->msg;
+	char spec[LOGFMT_SPEC_MAX];
+	size_t i, n, off = 0, lit = 0;
+	uint ia = 0;
+
+	for (i = 0;  i != r->msglen;  i++) {
+		if (fmt[i] != '%')
+			continue;
+
+		n = ffmin(i - lit, cap - off);
+		ffmemcpy(buf + off, fmt + lit, n);
+		off += n;
+
+		logfmt_spec(fmt + i, r->msglen - i, &n);
+		const struct logarg *a = &r->args[ia++];
+		char *d = buf + off, *end = buf + cap;
+		switch (a->type) {
+		case LOGARG_SZ:
+		case LOGARG_STR:
+		case LOGARG_STRN:
+			off += ffs_fmt(d, end, "%*s", (size_t)a->s.len, r->msg + a->s.off);
+			break;
+
+		default:
+			ffsz_copy(spec, sizeof(spec), fmt + i, n);
+			switch (a->type) {
+			case LOGARG_INT:
+				off += ffs_fmt(d, end, spec, a->i); break;
+			case LOGARG_INT64:
+				off += ffs_fmt(d, end, spec, a->i64); break;
+			case LOGARG_SIZE:
+				off += ffs_fmt(d, end, spec, a->sz); break;
+			case LOGARG_PTR:
+				off += ffs_fmt(d, end, spec, a->p); break;
+			case LOGARG_DBL:
+				off += ffs_fmt(d, end, spec, a->d); break;
+			}
+		}
+
+		i += n - 1;
+		lit = i + 1;
+	}
+
+	n = ffmin(r->msglen - lit, cap - off);
+	ffmemcpy(buf + off, fmt + lit, n);
+	off += n;
+	return off;
+}
+
+/** Put log message into worker's ring buffer.
+The message is formatted by log thread, unless its format string can't be handled by log_args_copy().
+The message is dropped if the buffer is full. */
+static void log_put(struct worker *w, uint flags, const fmed_logdata *ld, const char *fmt, va_list va)
+{
+	struct logring *lr = w->logr;
+	size_t h = lr->head;
+	if (h - FF_READONCE(lr->tail) == LOGRING_RECS) {
+		ffatom_inc(&fmed->log_dropped);
+		return;
+	}
+
+	struct logrec *r = &lr->recs[h & (LOGRING_RECS - 1)];
+	r->flags = flags;
+	r->tid = ld->tid;
+	ffsz_copy(r->stime, sizeof(r->stime), ld->stime, ffsz_len(ld->stime));
+	r->module[0] = '\0';
+	if (ld->module != NULL)
+		ffsz_copy(r->module, sizeof(r->module), ld->module, ffsz_len(ld->module));
+	r->ctxlen = 0;
+	if (ld->ctx != NULL)
+		r->ctxlen = ffs_fmt(r->ctx, r->ctx + sizeof(r->ctx), "%S", ld->ctx);
+
+	va_list args;
+	va_copy(args, va);
+	int rc = log_args_copy(r, fmt, args);
+	va_end(args);
+
+	if (rc != 0) {
+		va_copy(args, va);
+		r->msglen = ffs_fmtv(r->msg, r->msg + sizeof(r->msg), fmt, args);
+		va_end(args);
+		r->nargs = (uint)-1;
+	}
+
+	ffatom_fence_rel(); // record data must be visible before the new head position
+	FF_WRITEONCE(lr->head, h + 1);
+}
+
+/** Write all queued messages from worker's ring buffer. */
+static void log_flush(struct logring *lr)
+{
+	size_t t = lr->tail, h = FF_READONCE(lr->head);
+	ffatom_fence_acq();
+
+	char buf[LOGREC_MSG];
+
+	for (;  t != h;  t++) {
+		const struct logrec *r = &lr->recs[t & (LOGRING_RECS - 1)];
+		fmed_logdata ld = {};
+		ffstr ctx;
+		const char *msg = r->msg;
+		size_t msglen = r->msglen;
+		ld.tid = r->tid;
+		ld.stime = r->stime;
+		ld.level = loglevs[(r->flags & _FMED_LOG_LEVMASK) - 1];
+		ld.module = r->module;
+		if (r->ctxlen != 0) {
+			ffstr_set(&ctx, r->ctx, r->ctxlen);
+			ld.ctx = &ctx;
+		}
+		if (r->nargs != (uint)-1) {
+			msglen = log_args_fmt(r, buf, sizeof(buf));
+			msg = buf;
+		}
+		log_write(r->flags, &ld, "%*s", msglen, msg);
+	}
+
+	ffatom_fence_rel(); // finish reading records before they can be overwritten
+	FF_WRITEONCE(lr->tail, t);
+}
+
+static void log_flush_all(void)
+{
+	struct worker *w;
+	FFARR_WALKT(&fmed->workers, w, struct worker) {
+		struct logring *lr = FF_READONCE(w->logr);
+		if (lr != NULL)
+			log_flush(lr);
+	}
+
+	size_t n = ffatom_get(&fmed->log_dropped);
+	if (n != fmed->log_dropped_reported) {
+		fmed_logdata ld = {};
+		char stime[32];
+		log_stime(stime, sizeof(stime));
+		ld.stime = stime;
+		ld.level = loglevs[FMED_LOG_WARN - 1];
+		ld.module = "core";
+		log_write(FMED_LOG_WARN, &ld, "log: dropped %L messages", n - fmed->log_dropped_reported);
+		fmed->log_dropped_reported = n;
+	}
+}
+
+/** Log thread: write messages queued by workers. */
+static int FFTHDCALL log_loop(void *param)
+{
+	while (!FF_READONCE(fmed->log_stop)) {
+		log_flush_all();
+		ffthd_sleep(LOG_FLUSH_INT);
+	}
+	log_flush_all();
+	return 0;
+}
+
+/** Start log thread: info and debug messages from workers will be written asynchronously. */
+static int log_async_init(void)
+{
+	fmed->logthd = ffthd_create(&log_loop, NULL, 0);
+	if (fmed->logthd == FFTHD_INV) {
+		syserrlog("%s", ffthd_create_S);
+		return 1;
+	}
+	return 0;
+}
+
+/** Write the remaining messages and stop log thread.
+Worker threads must be stopped at this point. */
+static void log_async_stop(void)
+{
+	if (fmed->logthd == FFTHD_INV)
+		return;
+	FF_WRITEONCE(fmed->log_stop, 1);
+	ffthd_join(fmed->logthd, -1, NULL);
+	fmed->logthd = FFTHD_INV;
+
+	struct worker *w;
+	FFARR_WALKT(&fmed->workers, w, struct worker) {
+		ffmem_free0(w->logr);
+	}
+}
+
+static void core_logv(uint flags, void *trk, const char *module, const char *fmt, va_list va)
+{
+	char stime[32];
 	fmed_logdata ld = {};
 	uint lev = flags & _FMED_LOG_LEVMASK;
 	int e;
@@ -1217,13 +1684,21 @@ static void core_logv(uint flags, void *trk, const char *module, const char *fmt
 	if (flags & FMED_LOG_SYS)
 		e = fferr_last();
 
-	fftime_now(&t);
-	fftime_split(&dt, &t, FFTIME_TZLOCAL);
-	r = fftime_tostr(&dt, stime, sizeof(stime), FFTIME_HMS_MSEC);
-	stime[r] = '\0';
-	ld.stime = stime;
 	ld.tid = ffthd_curid();
 
+	// get time only once per worker's loop iteration
+	struct worker *w = work_self;
+	if (w != NULL && w->inloop) {
+		if (!w->stime_valid) {
+			log_stime(w->stime, sizeof(w->stime));
+			w->stime_valid = 1;
+		}
+		ld.stime = w->stime;
+	} else {
+		log_stime(stime, sizeof(stime));
+		ld.stime = stime;
+	}
+
 	FF_ASSERT(lev != 0);
 	ld.level = loglevs[lev - 1];
 
@@ -1236,6 +1711,14 @@ static void core_logv(uint flags, void *trk, const char *module, const char *fmt
 			ld.module = module;
 	}
 
+	/* Info and debug messages from workers are written by log thread.
+	Messages which require track object or system error code are written synchronously. */
+	if (w != NULL && w->logr != NULL
+		&& lev > FMED_LOG_USER && !(flags & FMED_LOG_SYS)) {
+		log_put(w, flags, &ld, fmt, va);
+		return;
+	}
+
 	if (flags & FMED_LOG_SYS)
 		fferr_set(e);
 
@@ -1257,6 +1740,10 @@ static const void* core_iface(const char *name)
 		return (void*)1;
 	else if (!ffsz_cmp(name, "track"))
 		return &_fmed_track;
+	else if (ffsz_eq(name, "pipe-out"))
+		return &trk_pipe_out;
+	else if (ffsz_eq(name, "pipe-in"))
+		return &trk_pipe_in;
 	return NULL;
 }
 
@@ -6,10 +6,20 @@ Copyright (c) 2015 Simon Zolin */
 
 extern fmed_core *core;
 extern const fmed_track _fmed_track;
+extern const fmed_filter trk_pipe_out, trk_pipe_in;
 
 
 extern void core_job_enter(uint id, size_t *ctx);
 
 extern ffbool core_job_shouldyield(uint id, size_t *ctx);
 
+/** Find a less loaded worker to which a job can be moved.
+except: worker ID to skip;  -1: none
+tasks: the job's tasks;  the job isn't moved while any of them is queued in the current worker
+Return new worker ID (its kqueue is set in 'kq');  or 'id' if the job should stay. */
+extern uint core_job_migrate(uint id, uint except, fftask **tasks, uint ntasks, fffd *kq);
+
+/** Return TRUE if the current thread belongs to the worker. */
+extern ffbool core_job_iscurrent(uint id);
+
 extern ffbool core_ismainthr(void);
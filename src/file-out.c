@@ -5,8 +5,14 @@ Copyright (c) 2019 Simon Zolin */
 
 #include <FF/time.h>
 #include <FF/path.h>
+#include <FF/list.h>
 #include <FFOS/file.h>
 #include <FFOS/dir.h>
+#include <FFOS/thread.h>
+#include <FFOS/asyncio.h>
+#ifdef FF_LINUX
+#include <fcntl.h>
+#endif
 
 
 extern const fmed_core *core;
@@ -17,6 +23,7 @@ extern const fmed_core *core;
 #define dbglog(trk, ...)  fmed_dbglog(core, trk, "file", __VA_ARGS__)
 #define errlog(trk, ...)  fmed_errlog(core, trk, "file", __VA_ARGS__)
 #define syserrlog(trk, ...)  fmed_syserrlog(core, trk, "file", __VA_ARGS__)
+#define syswarnlog(trk, ...)  fmed_syswarnlog(core, trk, "file", __VA_ARGS__)
 
 
 //OUTPUT
@@ -33,6 +40,10 @@ struct file_out_conf_t {
 
 	size_t bsize;
 	size_t prealloc;
+	uint nbufs;
+	uint nthreads;
+	size_t flush_interval;
+	byte directio;
 	uint file_del :1;
 	uint prealloc_grow :1;
 };
@@ -41,41 +52,333 @@ static struct file_out_conf_t out_conf;
 static const ffpars_arg file_out_conf_args[] = {
 	{ "buffer_size",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_out_conf_t, bsize) }
 	, { "preallocate",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_out_conf_t, prealloc) }
+	, { "buffers",  FFPARS_TINT | FFPARS_F8BIT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_out_conf_t, nbufs) }
+	, { "io_threads",  FFPARS_TINT | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_out_conf_t, nthreads) }
+	, { "direct_io",  FFPARS_TBOOL8,  FFPARS_DSTOFF(struct file_out_conf_t, directio) }
+	, { "flush_interval",  FFPARS_TSIZE,  FFPARS_DSTOFF(struct file_out_conf_t, flush_interval) }
 };
 
+/*
+Data is collected into one of several rotating buffers.
+A full buffer is passed to an I/O thread which writes it at its own offset (and preallocates the file space),
+ while the track keeps filling the next buffer.
+The track waits (FMED_RASYNC) only when all buffers are in flight;
+ the I/O thread wakes it up via FMED_TRACK_WAKE after a buffer is written.
+All buffers of a file are processed by the same I/O thread in the order they were submitted.
+If the track is closed while there are buffers in flight, the I/O thread closes the file after the last write.
+If I/O threads can't be used, the data is written synchronously.
+
+Linux, for long recordings ('direct_io'):
+ the full buffers are written with O_DIRECT (by a second descriptor) bypassing the page cache;
+ the unaligned writes (the last block, the header) go through the normal descriptor.
+ The space is reserved by fixed-size extents with fallocate() without changing the file size.
+'flush_interval': after every N bytes the new data is submitted for writeback,
+ then the previous range is waited for and dropped from the page cache,
+ so the kernel doesn't accumulate dirty pages and doesn't flush them all at once.
+ This is done only by I/O threads: waiting for writeback must not block a worker.
+After seeking, the partially filled buffer is written at an unaligned offset;
+ the next buffer is filled only up to the aligned offset so that direct I/O resumes after it.
+*/
+
+enum {
+	FO_ALIGN = 4096, // alignment of buffers, file offsets and sizes for direct I/O
+};
+
+struct fo_buf {
+	fflist_item sib; // fo_thread.q
+	struct fmed_fileout *f;
+	void *mem;
+	ffarr data; // aligned by FO_ALIGN
+	uint64 off;
+	uint64 prealloc; // extend the file to this size before writing
+	uint busy :1;
+};
+
+struct fo_thread {
+	ffthd thd;
+	fffd kq;
+	ffkevpost kqpost;
+	ffkevent evposted;
+	fflock lk;
+	fflist q; //struct fo_buf
+	uint stop;
+};
+
+static struct {
+	fflock lk;
+	struct fo_thread *ths;
+	uint n;
+	uint next; // round-robin index
+	uint init :1;
+} fo_pool;
 
 typedef struct fmed_fileout {
 	fmed_trk *d;
 	ffstr fname;
 	fffd fd;
-	ffarr buf;
+	fffd fd_direct; // the same file opened with O_DIRECT
+	struct fo_buf *bufs;
+	uint nbufs;
+	uint ibuf; // the buffer being filled
+	struct fo_thread *th;
 	uint64 fsize
 		, preallocated;
 	uint64 prealloc_by;
 	fftime modtime;
 	uint ok :1;
+	uint del :1;
+
+	fflock lk; // protects the fields below and fo_buf.busy
+	uint nbusy; // buffers in flight
+	uint err :1;
+	uint want_wake :1;
+	uint closing :1;
+
+	// used by I/O thread:
+	uint64 wb_start; // offset of data not yet submitted for writeback
+	uint64 wb_prev; // offset of the range being written back
 
 	struct {
 		uint nmwrite;
 		uint nfwrite;
 		uint nprealloc;
+		uint ndirect;
+		uint nflush;
 	} stat;
 } fmed_fileout;
 
-static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed_filt *d);
+static void fileout_submit(fmed_fileout *f, struct fo_buf *b, uint64 off);
 static char* fileout_getname(fmed_fileout *f, fmed_filt *d);
+static void fileout_free(fmed_fileout *f);
 
 
 int fileout_config(ffpars_ctx *ctx)
 {
 	out_conf.bsize = 64 * 1024;
 	out_conf.prealloc = 1 * 1024 * 1024;
+	out_conf.nbufs = 2;
+	out_conf.nthreads = 1;
 	out_conf.prealloc_grow = 1;
 	out_conf.file_del = 1;
+	fflk_init(&fo_pool.lk);
 	ffpars_setargs(ctx, &out_conf, file_out_conf_args, FFCNT(file_out_conf_args));
 	return 0;
 }
 
+
+static void fo_posted(void *udata)
+{
+}
+
+static int fo_buf_alloc(struct fo_buf *b, size_t cap)
+{
+	void *p;
+	if (NULL == (p = ffmem_alloc(cap + FO_ALIGN)))
+		return -1;
+	ffmem_free(b->mem);
+	b->mem = p;
+	b->data.ptr = (char*)ff_align_ceil((size_t)p, FO_ALIGN);
+	b->data.cap = cap;
+	b->data.len = 0;
+	return 0;
+}
+
+/** Reserve file space up to 'size'. */
+static void fo_prealloc(fmed_fileout *f, uint64 size)
+{
+#ifdef FF_LINUX
+	if (f->fd_direct != FF_BADFD
+		&& 0 == fallocate(f->fd, FALLOC_FL_KEEP_SIZE, 0, size))
+		return;
+#endif
+	fffile_trunc(f->fd, size);
+}
+
+/** Write back the data periodically and remove it from page cache. */
+static void fo_writeback(fmed_fileout *f, uint64 end)
+{
+#ifdef FF_LINUX
+	if (end < f->wb_start + out_conf.flush_interval)
+		return;
+
+	sync_file_range(f->fd, f->wb_start, end - f->wb_start, SYNC_FILE_RANGE_WRITE);
+	if (f->wb_prev != f->wb_start) {
+		sync_file_range(f->fd, f->wb_prev, f->wb_start - f->wb_prev
+			, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(f->fd, f->wb_prev, f->wb_start - f->wb_prev, POSIX_FADV_DONTNEED);
+	}
+	f->wb_prev = f->wb_start;
+	f->wb_start = end;
+	f->stat.nflush++;
+#endif
+}
+
+/** Number of bytes the buffer can take.
+With direct I/O after an unaligned write, the buffer is shortened so that it ends at the aligned file offset. */
+static size_t fo_buf_room(fmed_fileout *f, struct fo_buf *b)
+{
+	size_t cap = b->data.cap;
+	if (f->fd_direct != FF_BADFD)
+		cap -= f->fsize % FO_ALIGN;
+	return (b->data.len < cap) ? cap - b->data.len : 0;
+}
+
+/** Write a buffer.  Thread: I/O or worker. */
+static void fo_write(struct fo_buf *b)
+{
+	fmed_fileout *f = b->f;
+	uint err = 0;
+
+	if (b->prealloc != 0)
+		fo_prealloc(f, b->prealloc);
+
+	fffd fd = f->fd;
+	if (f->fd_direct != FF_BADFD
+		&& (b->off % FO_ALIGN) == 0
+		&& (b->data.len % FO_ALIGN) == 0) {
+		fd = f->fd_direct;
+		f->stat.ndirect++;
+	}
+
+	if (b->data.len != (size_t)fffile_pwrite(fd, b->data.ptr, b->data.len, b->off)) {
+		syserrlog(NULL, "%s: %s", fffile_write_S, f->fname.ptr);
+		err = 1;
+	} else {
+		dbglog(NULL, "%s: written %L bytes at offset %U", f->fname.ptr, b->data.len, b->off);
+		if (out_conf.flush_interval != 0 && f->th != NULL)
+			fo_writeback(f, b->off + b->data.len);
+	}
+	b->data.len = 0;
+
+	fflk_lock(&f->lk);
+	b->busy = 0;
+	f->nbusy--;
+	f->err |= err;
+	if (f->want_wake && !f->closing) {
+		f->want_wake = 0;
+		f->d->track->cmd(f->d->trk, FMED_TRACK_WAKE);
+	}
+	uint fin = (f->closing && f->nbusy == 0);
+	fflk_unlock(&f->lk);
+
+	if (fin)
+		fileout_free(f);
+}
+
+/** I/O thread: write the queued buffers. */
+static int FFTHDCALL fo_loop(void *param)
+{
+	struct fo_thread *th = param;
+	ffkqu_entry ev;
+	ffkqu_time tm;
+	ffkqu_settm(&tm, (uint)-1);
+
+	for (;;) {
+		fflk_lock(&th->lk);
+		struct fo_buf *b = NULL;
+		if (!fflist_empty(&th->q)) {
+			b = FF_GETPTR(struct fo_buf, sib, th->q.first);
+			fflist_rm(&th->q, &b->sib);
+		}
+		uint stop = th->stop;
+		fflk_unlock(&th->lk);
+
+		if (b != NULL) {
+			fo_write(b);
+			continue;
+		}
+		if (stop)
+			break;
+
+		int n = ffkqu_wait(th->kq, &ev, 1, &tm);
+		if (n > 0)
+			ffkev_call(&ev);
+		else if (n < 0 && fferr_last() != EINTR) {
+			syserrlog(NULL, "%s", ffkqu_wait_S);
+			break;
+		}
+	}
+	return 0;
+}
+
+static void fo_post(struct fo_thread *th, struct fo_buf *b)
+{
+	fflk_lock(&th->lk);
+	uint wake = fflist_empty(&th->q);
+	fflist_ins(&th->q, &b->sib);
+	fflk_unlock(&th->lk);
+	if (wake)
+		ffkqu_post(&th->kqpost, &th->evposted);
+}
+
+static int fo_thread_init(struct fo_thread *th)
+{
+	fflk_init(&th->lk);
+	fflist_init(&th->q);
+	if (FF_BADFD == (th->kq = ffkqu_create())) {
+		syserrlog(NULL, "%s", ffkqu_create_S);
+		return -1;
+	}
+	ffkqu_post_attach(&th->kqpost, th->kq);
+	ffkev_init(&th->evposted);
+	th->evposted.oneshot = 0;
+	th->evposted.handler = &fo_posted;
+
+	if (FFTHD_INV == (th->thd = ffthd_create(&fo_loop, th, 0))) {
+		syserrlog(NULL, "%s", ffthd_create_S);
+		ffkqu_post_detach(&th->kqpost, th->kq);
+		ffkqu_close(th->kq);
+		return -1;
+	}
+	return 0;
+}
+
+/** Get I/O thread for a new file; start threads on first use.
+Return NULL if the data must be written synchronously. */
+static struct fo_thread* fo_thread_get(void)
+{
+	struct fo_thread *th = NULL;
+	fflk_lock(&fo_pool.lk);
+
+	if (!fo_pool.init) {
+		fo_pool.init = 1;
+		if (out_conf.nthreads == 0
+			|| NULL == (fo_pool.ths = ffmem_callocT(out_conf.nthreads, struct fo_thread)))
+			goto end;
+		for (uint i = 0;  i != out_conf.nthreads;  i++) {
+			if (0 != fo_thread_init(&fo_pool.ths[i]))
+				break;
+			fo_pool.n++;
+		}
+		dbglog(NULL, "started %u I/O threads", fo_pool.n);
+	}
+
+	if (fo_pool.n != 0)
+		th = &fo_pool.ths[fo_pool.next++ % fo_pool.n];
+
+end:
+	fflk_unlock(&fo_pool.lk);
+	return th;
+}
+
+/** Stop I/O threads after they've written all queued data. */
+void fileout_destroy(void)
+{
+	for (uint i = 0;  i != fo_pool.n;  i++) {
+		struct fo_thread *th = &fo_pool.ths[i];
+		fflk_lock(&th->lk);
+		th->stop = 1;
+		fflk_unlock(&th->lk);
+		ffkqu_post(&th->kqpost, &th->evposted);
+		ffthd_join(th->thd, -1, NULL);
+		ffkqu_post_detach(&th->kqpost, th->kq);
+		ffkqu_close(th->kq);
+	}
+	ffmem_free0(fo_pool.ths);
+	fo_pool.n = 0;
+	fo_pool.init = 0;
+}
+
 enum VARS {
 	VAR_COUNTER,
 	VAR_DATE,
@@ -253,6 +556,9 @@ static void* fileout_open(fmed_filt *d)
 	if (f == NULL)
 		return NULL;
 	f->fd = FF_BADFD;
+	f->fd_direct = FF_BADFD;
+	f->d = d;
+	fflk_init(&f->lk);
 
 	if (NULL == (filename = fileout_getname(f, d)))
 		goto done;
@@ -277,25 +583,42 @@ static void* fileout_open(fmed_filt *d)
 		}
 	}
 
+#ifdef FF_LINUX
+	if (out_conf.directio) {
+		f->fd_direct = fffile_open(filename, O_WRONLY | O_DIRECT);
+		if (f->fd_direct == FF_BADFD)
+			syswarnlog(d->trk, "%s: %s: direct I/O isn't used", fffile_open_S, filename);
+	}
+#endif
+
 	size_t bfsz = out_conf.bsize;
 	int64 n;
 	if (FMED_NULL != (n = fmed_popval("out_bufsize")))
-		bfsz = n; //Note: a large value can slow down the thread because we write to a file synchronously
-	if (NULL == ffarr_alloc(&f->buf, bfsz)) {
+		bfsz = n;
+	if (f->fd_direct != FF_BADFD)
+		bfsz = ff_align_ceil(bfsz, FO_ALIGN);
+	f->nbufs = out_conf.nbufs;
+	if (NULL == (f->bufs = ffmem_callocT(f->nbufs, struct fo_buf))) {
 		syserrlog(d->trk, "%s", ffmem_alloc_S);
 		goto done;
 	}
+	for (uint i = 0;  i != f->nbufs;  i++) {
+		f->bufs[i].f = f;
+		if (0 != fo_buf_alloc(&f->bufs[i], bfsz)) {
+			syserrlog(d->trk, "%s", ffmem_alloc_S);
+			goto done;
+		}
+	}
+	f->th = fo_thread_get();
 
 	if ((int64)d->output.size != FMED_NULL) {
-		if (0 == fffile_trunc(f->fd, d->output.size)) {
-			f->preallocated = d->output.size;
-			f->stat.nprealloc++;
-		}
+		fo_prealloc(f, d->output.size);
+		f->preallocated = d->output.size;
+		f->stat.nprealloc++;
 	}
 
 	f->modtime = d->mtime;
 	f->prealloc_by = out_conf.prealloc;
-	f->d = d;
 	return f;
 
 done:
@@ -307,11 +630,32 @@ static void fileout_close(void *ctx)
 {
 	fmed_fileout *f = ctx;
 
+	if (f->fd != FF_BADFD)
+		f->del = ((!f->ok && out_conf.file_del) || f->d->out_file_del);
+
+	fflk_lock(&f->lk);
+	f->closing = 1;
+	uint busy = f->nbusy;
+	fflk_unlock(&f->lk);
+
+	if (busy != 0) {
+		dbglog(NULL, "%s: waiting for %u writes to complete", f->fname.ptr, busy);
+		return; // I/O thread will close the file
+	}
+	fileout_free(f);
+}
+
+/** Close the file and free the object.  Thread: worker or I/O. */
+static void fileout_free(fmed_fileout *f)
+{
+	if (f->fd_direct != FF_BADFD)
+		fffile_close(f->fd_direct);
+
 	if (f->fd != FF_BADFD) {
 
 		fffile_trunc(f->fd, f->fsize);
 
-		if ((!f->ok && out_conf.file_del) || f->d->out_file_del) {
+		if (f->del) {
 
 			if (0 != fffile_close(f->fd))
 				syserrlog(NULL, "%s", fffile_close_S);
@@ -332,102 +676,126 @@ static void fileout_close(void *ctx)
 		}
 	}
 
+	dbglog(NULL, "mem write#:%u  file write#:%u  prealloc#:%u  direct#:%u  flush#:%u"
+		, f->stat.nmwrite, f->stat.nfwrite, f->stat.nprealloc, f->stat.ndirect, f->stat.nflush);
 	ffstr_free(&f->fname);
-	ffarr_free(&f->buf);
-	dbglog(NULL, "mem write#:%u  file write#:%u  prealloc#:%u"
-		, f->stat.nmwrite, f->stat.nfwrite, f->stat.nprealloc);
+	if (f->bufs != NULL) {
+		for (uint i = 0;  i != f->nbufs;  i++) {
+			ffmem_free(f->bufs[i].mem);
+		}
+		ffmem_free(f->bufs);
+	}
 	ffmem_free(f);
 }
 
-static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed_filt *d)
+/** Pass a filled buffer to I/O thread.  Preallocate the file space by large chunks. */
+static void fileout_submit(fmed_fileout *f, struct fo_buf *b, uint64 off)
 {
-	size_t r;
-	if (f->prealloc_by != 0 && f->fsize + len > f->preallocated) {
-		uint64 n = ff_align_ceil(f->fsize + len, f->prealloc_by);
-		if (0 == fffile_trunc(f->fd, n)) {
-
-			if (out_conf.prealloc_grow)
-				f->prealloc_by += f->prealloc_by;
+	b->off = off;
+	b->prealloc = 0;
+	if (f->prealloc_by != 0 && off + b->data.len > f->preallocated) {
+		uint64 n = ff_align_ceil(off + b->data.len, f->prealloc_by);
+		b->prealloc = n;
 
-			f->preallocated = n;
-			f->stat.nprealloc++;
-		}
-	}
+		if (out_conf.prealloc_grow && f->fd_direct == FF_BADFD)
+			f->prealloc_by += f->prealloc_by;
 
-	r = fffile_write(f->fd, data, len);
-	if (r != len) {
-		syserrlog(d->trk, "%s: %s", fffile_write_S, f->fname.ptr);
-		return -1;
+		f->preallocated = n;
+		f->stat.nprealloc++;
 	}
 	f->stat.nfwrite++;
 
-	dbglog(d->trk, "written %L bytes at offset %U (%L pending)", r, f->fsize, d->datalen);
-	f->fsize += r;
+	fflk_lock(&f->lk);
+	b->busy = 1;
+	f->nbusy++;
+	fflk_unlock(&f->lk);
+
+	if (f->th != NULL)
+		fo_post(f->th, b);
+	else
+		fo_write(b);
+}
+
+/** Check whether the buffer (or all buffers if NULL) is written.
+Return 0 if ready;  FMED_RASYNC if the track will be woken up later;  FMED_RERR on write error. */
+static int fileout_wait(fmed_fileout *f, const struct fo_buf *b)
+{
+	int r = 0;
+	fflk_lock(&f->lk);
+	if (f->err)
+		r = FMED_RERR;
+	else if ((b != NULL) ? b->busy : (f->nbusy != 0)) {
+		f->want_wake = 1;
+		r = FMED_RASYNC;
+	}
+	fflk_unlock(&f->lk);
 	return r;
 }
 
 static int fileout_write(void *ctx, fmed_filt *d)
 {
 	fmed_fileout *f = ctx;
-	ssize_t r;
-	ffstr dst;
+	struct fo_buf *b;
+	int r;
 	int64 seek;
 
 	if ((int64)d->output.seek != FMED_NULL) {
-		seek = d->output.seek;
-		d->output.seek = FMED_NULL;
-
-		if (f->buf.len != 0) {
-			if (-1 == fileout_writedata(f, f->buf.ptr, f->buf.len, d))
-				return FMED_RERR;
-			f->buf.len = 0;
+		b = &f->bufs[f->ibuf];
+		if (b->data.len != 0) {
+			fileout_submit(f, b, f->fsize);
+			f->fsize += b->data.len;
+			f->ibuf = (f->ibuf + 1) % f->nbufs;
+			b = &f->bufs[f->ibuf];
 		}
+		if (0 != (r = fileout_wait(f, b)))
+			return r;
 
+		seek = d->output.seek;
+		d->output.seek = FMED_NULL;
 		dbglog(d->trk, "seeking to %xU...", seek);
 
-		if (0 > fffile_seek(f->fd, seek, SEEK_SET)) {
-			syserrlog(d->trk, "%s: %s", fffile_seek_S, f->fname.ptr);
-			return FMED_RERR;
-		}
-
-		if (d->datalen != (size_t)fffile_write(f->fd, d->data, d->datalen)) {
-			syserrlog(d->trk, "%s: %s", fffile_write_S, f->fname.ptr);
-			return FMED_RERR;
-		}
-		f->stat.nfwrite++;
-
-		dbglog(d->trk, "written %L bytes at offset %U", d->datalen, seek);
-
-		if (f->fsize < d->datalen)
-			f->fsize = d->datalen;
-
-		if (0 > fffile_seek(f->fd, f->fsize, SEEK_SET)) {
-			syserrlog(d->trk, "%s: %s", fffile_seek_S, f->fname.ptr);
+		if (d->datalen > b->data.cap
+			&& 0 != fo_buf_alloc(b, ff_align_ceil(d->datalen, FO_ALIGN))) {
+			syserrlog(d->trk, "%s", ffmem_alloc_S);
 			return FMED_RERR;
 		}
+		ffarr_append(&b->data, d->data, d->datalen);
+		fileout_submit(f, b, seek);
+		f->ibuf = (f->ibuf + 1) % f->nbufs;
 
+		if (f->fsize < seek + d->datalen)
+			f->fsize = seek + d->datalen;
 		d->datalen = 0;
 	}
 
 	for (;;) {
+		b = &f->bufs[f->ibuf];
+		if (0 != (r = fileout_wait(f, b)))
+			return r; // all buffers are in flight
+
+		if (b->data.len == 0 && f->fd_direct != FF_BADFD && (f->fsize % FO_ALIGN) != 0)
+			dbglog(d->trk, "offset %xU is unaligned: realigning for direct I/O", f->fsize);
 
-		r = ffbuf_add(&f->buf, d->data, d->datalen, &dst);
-		d->data += r;
-		d->datalen -= r;
-		if (dst.len == 0) {
+		size_t n = ffmin(d->datalen, fo_buf_room(f, b));
+		ffarr_append(&b->data, d->data, n);
+		d->data += n;
+		d->datalen -= n;
+
+		if (fo_buf_room(f, b) != 0) {
 			f->stat.nmwrite++;
-			if (!(d->flags & FMED_FLAST) || f->buf.len == 0)
+			if (!(d->flags & FMED_FLAST) || b->data.len == 0)
 				break;
-			ffstr_set(&dst, f->buf.ptr, f->buf.len);
 		}
 
-		if (-1 == fileout_writedata(f, dst.ptr, dst.len, d))
-			return FMED_RERR;
-		if (d->datalen == 0)
-			break;
+		uint64 off = f->fsize;
+		f->fsize += b->data.len;
+		fileout_submit(f, b, off);
+		f->ibuf = (f->ibuf + 1) % f->nbufs;
 	}
 
 	if (d->flags & FMED_FLAST) {
+		if (0 != (r = fileout_wait(f, NULL)))
+			return r;
 		f->ok = 1;
 		return FMED_RDONE;
 	}
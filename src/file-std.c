@@ -30,6 +30,14 @@ const fmed_filter file_stdout = {
 	&file_stdout_open, &file_stdout_write, &file_stdout_close
 };
 
+//SPLICE
+static void* file_splice_open(fmed_filt *d);
+static int file_splice_process(void *ctx, fmed_filt *d);
+static void file_splice_close(void *ctx);
+const fmed_filter file_splice = {
+	&file_splice_open, &file_splice_process, &file_splice_close
+};
+
 
 typedef struct stdin_ctx {
 	fffd fd;
@@ -225,3 +233,112 @@ static int file_stdout_write(void *ctx, fmed_filt *d)
 
 	return FMED_ROK;
 }
+
+
+/*
+stdin -> stdout passthrough (see trk_splice_want()).
+Linux: if stdin or stdout is a pipe, the data is moved by splice() without copying it to user space.
+Otherwise it's copied through a user buffer.
+The filter yields after every SPLICE_YIELD bytes so the other tracks on the worker aren't blocked.
+*/
+
+enum {
+	SPLICE_CHUNK = 1 * 1024 * 1024,
+	SPLICE_YIELD = 16 * 1024 * 1024,
+};
+
+typedef struct splice_ctx {
+	ffarr buf;
+	uint64 total;
+	uint nsplice;
+	uint ncopy;
+	uint no_splice :1;
+} splice_ctx;
+
+static void* file_splice_open(fmed_filt *d)
+{
+	splice_ctx *c = ffmem_new(splice_ctx);
+	if (c == NULL)
+		return NULL;
+#ifndef FF_LINUX
+	c->no_splice = 1;
+#endif
+	return c;
+}
+
+static void file_splice_close(void *ctx)
+{
+	splice_ctx *c = ctx;
+	dbglog(NULL, "passed %U bytes from stdin to stdout.  splice#:%u  copy#:%u"
+		, c->total, c->nsplice, c->ncopy);
+	ffarr_free(&c->buf);
+	ffmem_free(c);
+}
+
+/** Read from stdin and write to stdout through user buffer. */
+static ssize_t splice_copy(splice_ctx *c, fmed_filt *d)
+{
+	if (c->buf.cap == 0
+		&& NULL == ffarr_alloc(&c->buf, out_conf.bufsize)) {
+		syserrlog(d->trk, "%s", ffmem_alloc_S);
+		return -1;
+	}
+
+	ssize_t r = ffstd_fread(ffstdin, c->buf.ptr, c->buf.cap);
+	if (r < 0) {
+		syserrlog(d->trk, "%s", fffile_read_S);
+		return -1;
+	}
+
+	for (ssize_t off = 0;  off != r;  ) {
+		ssize_t n = fffile_write(ffstdout, c->buf.ptr + off, r - off);
+		if (n <= 0) {
+			syserrlog(d->trk, "%s", fffile_write_S);
+			return -1;
+		}
+		off += n;
+	}
+	c->ncopy++;
+	return r;
+}
+
+static int file_splice_process(void *ctx, fmed_filt *d)
+{
+	splice_ctx *c = ctx;
+	ssize_t r;
+
+	if (d->flags & FMED_FSTOP) {
+		d->outlen = 0;
+		return FMED_RDONE;
+	}
+
+	for (uint64 n = 0;  n < SPLICE_YIELD;  n += r) {
+
+#ifdef FF_LINUX
+		if (!c->no_splice) {
+			r = splice(ffstdin, NULL, ffstdout, NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (r < 0 && fferr_last() == EINVAL && c->total == 0) {
+				dbglog(d->trk, "splice() isn't supported for these descriptors, copying data", 0);
+				c->no_splice = 1;
+				r = 0;
+				continue;
+			} else if (r < 0) {
+				syserrlog(d->trk, "%s", "splice()");
+				return FMED_RERR;
+			}
+			c->nsplice++;
+		} else
+#endif
+		if (0 > (r = splice_copy(c, d)))
+			return FMED_RERR;
+
+		if (r == 0) {
+			d->outlen = 0;
+			return FMED_RDONE;
+		}
+		c->total += r;
+	}
+
+	d->track->cmd(d->trk, FMED_TRACK_WAKE);
+	return FMED_RASYNC;
+}
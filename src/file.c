@@ -4,7 +4,10 @@ Copyright (c) 2015 Simon Zolin */
 #include <fmedia.h>
 
 #include <FF/sys/fileread.h>
+#include <FF/sys/filemap.h>
 #include <FF/array.h>
+#include <FF/list.h>
+#include <FF/path.h>
 #include <FF/time.h>
 
 
@@ -21,10 +24,52 @@ struct file_in_conf_t {
 	size_t bsize;
 	size_t align;
 	byte directio;
+	size_t mmap_min_size;
+	ffarr mmap_ext; //struct file_ext[]
+	size_t cache_size;
+	size_t readahead_max;
+};
+
+struct file_ext {
+	char ext[8];
+};
+
+/** File identity. */
+struct bc_fid {
+	uint64 dev, ino;
+	fftime mtime;
+};
+
+struct bc_blk {
+	struct bc_blk *next; // hash chain
+	fflist_item lru; // bcache.lru
+	struct bc_fid fid;
+	uint64 off;
+	uint hash;
+	uint refs;
+	size_t len;
+	char *data;
+};
+
+struct bc_file {
+	struct bc_fid fid;
+	uint nreaders;
+};
+
+/** Process-wide cache of file blocks. */
+struct bcache {
+	fflock lk;
+	struct bc_blk **tab;
+	uint cap, n;
+	fflist lru; //struct bc_blk[], the least recently used first
+	size_t size; // total size of cached data
+	ffarr files; //struct bc_file[], files opened by #file.in
+	uint nhit, nput, nevict;
 };
 
 typedef struct filemod {
 	struct file_in_conf_t in_conf;
+	struct bcache bc;
 } filemod;
 
 static filemod *mod;
@@ -33,6 +78,21 @@ const fmed_core *core;
 typedef struct fmed_file {
 	fffileread *fr;
 	const char *fn;
+	void *map; //mmap mode: the whole file
+	ffstr *input_map; //fmed_filt.input_map
+	struct bc_fid fid;
+	struct bc_blk *blk; //cached block which data is passed to the next filter
+	uint ncached;
+
+	struct {
+		uint64 seq_start; // read position after the last seek
+		uint nshort; // number of the last seeks after which less than ra_min() bytes were read
+		uint64 end; // the kernel was asked to read the data up to this offset
+		uint64 win; // readahead window;  0: random access
+		uint64 win_max; // the largest window used
+		uint nhint;
+		uint nswitch; // number of changes between random and sequential access
+	} ra;
 
 	uint64 fsize;
 	int64 seek; //user's read position
@@ -42,7 +102,8 @@ typedef struct fmed_file {
 	void *trk;
 
 	unsigned done :1
-		, want_read :1;
+		, want_read :1
+		, bc :1; //use block cache
 } fmed_file;
 
 enum {
@@ -69,11 +130,16 @@ static const fmed_filter fmed_file_input = {
 	&file_open, &file_getdata, &file_close
 };
 
+static int file_in_conf_mmapext(ffparser_schem *p, void *obj, const ffstr *val);
 static const ffpars_arg file_in_conf_args[] = {
 	{ "buffer_size",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_in_conf_t, bsize) }
 	, { "buffers",  FFPARS_TINT | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_in_conf_t, nbufs) }
 	, { "align",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_in_conf_t, align) }
 	, { "direct_io",  FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_in_conf_t, directio) }
+	, { "mmap_ext",  FFPARS_TSTR | FFPARS_FNOTEMPTY | FFPARS_FLIST,  FFPARS_DST(&file_in_conf_mmapext) }
+	, { "mmap_min_size",  FFPARS_TSIZE,  FFPARS_DSTOFF(struct file_in_conf_t, mmap_min_size) }
+	, { "cache_size",  FFPARS_TSIZE,  FFPARS_DSTOFF(struct file_in_conf_t, cache_size) }
+	, { "readahead_max",  FFPARS_TSIZE,  FFPARS_DSTOFF(struct file_in_conf_t, readahead_max) }
 };
 
 
@@ -87,14 +153,18 @@ const fmed_mod* fmed_getmod_file(const fmed_core *_core)
 	core = _core;
 	if (NULL == (mod = ffmem_tcalloc1(filemod)))
 		return NULL;
+	fflk_init(&mod->bc.lk);
+	fflist_init(&mod->bc.lru);
 	return &fmed_file_mod;
 }
 
 extern const fmed_filter fmed_file_output;
 extern int fileout_config(ffpars_ctx *ctx);
+extern void fileout_destroy(void);
 extern int stdout_config(ffpars_ctx *ctx);
 extern const fmed_filter file_stdin;
 extern const fmed_filter file_stdout;
+extern const fmed_filter file_splice;
 
 static const void* file_iface(const char *name)
 {
@@ -106,6 +176,8 @@ static const void* file_iface(const char *name)
 		return &file_stdin;
 	else if (!ffsz_cmp(name, "stdout"))
 		return &file_stdout;
+	else if (ffsz_eq(name, "splice"))
+		return &file_splice;
 	return NULL;
 }
 
@@ -129,9 +201,14 @@ static int file_sig(uint signo)
 	return 0;
 }
 
+static void bc_free(struct bcache *c);
+
 static void file_destroy(void)
 {
+	fileout_destroy();
 	ffaio_fctxclose();
+	bc_free(&mod->bc);
+	ffarr_free(&mod->in_conf.mmap_ext);
 	ffmem_free0(mod);
 }
 
@@ -142,10 +219,233 @@ static int file_in_conf(ffpars_ctx *ctx)
 	mod->in_conf.bsize = 64 * 1024;
 	mod->in_conf.nbufs = 3;
 	mod->in_conf.directio = 1;
+	mod->in_conf.cache_size = 8 * 1024 * 1024;
+	mod->in_conf.readahead_max = 4 * 1024 * 1024;
 	ffpars_setargs(ctx, &mod->in_conf, file_in_conf_args, FFCNT(file_in_conf_args));
 	return 0;
 }
 
+static int file_in_conf_mmapext(ffparser_schem *p, void *obj, const ffstr *val)
+{
+	struct file_in_conf_t *conf = obj;
+	struct file_ext *it;
+	if (val->len >= sizeof(it->ext))
+		return FFPARS_EBADVAL;
+	if (NULL == (it = ffarr_pushgrowT(&conf->mmap_ext, 8, struct file_ext)))
+		return FFPARS_ESYS;
+	ffsz_fcopy(it->ext, val->ptr, val->len);
+	return 0;
+}
+
+
+// BLOCK CACHE
+/*
+Blocks read from a file that is opened by several #file.in instances at once
+ (e.g. the tracks of a .cue image processed in parallel) are copied into the process-wide cache,
+ so the other readers get them from memory rather than from disk.
+A block is identified by the file (device, inode, modification time) and its offset aligned to 'buffer_size'.
+A reader holds a reference to the block while its data is used by the next filter.
+Unreferenced blocks are evicted in LRU order when the total size exceeds 'cache_size'.
+*/
+
+static uint bc_hash(const struct bc_fid *id, uint64 off)
+{
+	uint64 x = id->ino ^ (id->dev << 32) ^ (off * 0x9e3779b97f4a7c15ULL);
+	return (uint)(x ^ (x >> 32));
+}
+
+static void bc_fid_init(struct bc_fid *id, const fffileinfo *fi)
+{
+	ffmem_tzero(id);
+#ifdef FF_UNIX
+	id->dev = fi->st_dev;
+	id->ino = fi->st_ino;
+#else
+	id->dev = fi->dwVolumeSerialNumber;
+	id->ino = ((uint64)fi->nFileIndexHigh << 32) | fi->nFileIndexLow;
+#endif
+	id->mtime = fffile_infomtime(fi);
+}
+
+static struct bc_file* bc_file_find(struct bcache *c, const struct bc_fid *id)
+{
+	struct bc_file *it;
+	FFARR_WALKT(&c->files, it, struct bc_file) {
+		if (!ffmemcmp(&it->fid, id, sizeof(*id)))
+			return it;
+	}
+	return NULL;
+}
+
+/** A reader has opened the file. */
+static int bc_open(struct bcache *c, const struct bc_fid *id)
+{
+	int r = 0;
+	struct bc_file *f;
+	fflk_lock(&c->lk);
+	if (NULL == (f = bc_file_find(c, id))) {
+		if (NULL == (f = ffarr_pushgrowT(&c->files, 4, struct bc_file))) {
+			r = -1;
+			goto end;
+		}
+		f->fid = *id;
+		f->nreaders = 0;
+	}
+	f->nreaders++;
+end:
+	fflk_unlock(&c->lk);
+	return r;
+}
+
+static void bc_close(struct bcache *c, const struct bc_fid *id)
+{
+	struct bc_file *f;
+	fflk_lock(&c->lk);
+	if (NULL != (f = bc_file_find(c, id))
+		&& --f->nreaders == 0) {
+		*f = *ffarr_itemT(&c->files, c->files.len - 1, struct bc_file);
+		c->files.len--;
+	}
+	fflk_unlock(&c->lk);
+}
+
+static struct bc_blk** bc_findp(struct bcache *c, const struct bc_fid *id, uint64 off, uint hash)
+{
+	struct bc_blk **pb;
+	for (pb = &c->tab[hash & (c->cap - 1)];  *pb != NULL;  pb = &(*pb)->next) {
+		if ((*pb)->hash == hash
+			&& (*pb)->off == off
+			&& !ffmemcmp(&(*pb)->fid, id, sizeof(*id)))
+			break;
+	}
+	return pb;
+}
+
+static void bc_blk_free(struct bc_blk *b)
+{
+	ffmem_free(b->data);
+	ffmem_free(b);
+}
+
+/** Evict unreferenced blocks while the cache is over budget. */
+static void bc_evict(struct bcache *c, size_t max)
+{
+	fflist_item *it, *next;
+	for (it = c->lru.first;  it != fflist_sentl(&c->lru) && c->size > max;  it = next) {
+		next = it->next;
+		struct bc_blk *b = FF_GETPTR(struct bc_blk, lru, it);
+		if (b->refs != 0)
+			continue;
+		struct bc_blk **pb = bc_findp(c, &b->fid, b->off, b->hash);
+		*pb = b->next;
+		fflist_rm(&c->lru, &b->lru);
+		c->size -= b->len;
+		c->n--;
+		c->nevict++;
+		bc_blk_free(b);
+	}
+}
+
+/** Get a referenced block. */
+static struct bc_blk* bc_get(struct bcache *c, const struct bc_fid *id, uint64 off)
+{
+	struct bc_blk *b = NULL;
+	uint hash = bc_hash(id, off);
+	fflk_lock(&c->lk);
+	if (c->n != 0
+		&& NULL != (b = *bc_findp(c, id, off, hash))) {
+		b->refs++;
+		fflist_rm(&c->lru, &b->lru);
+		fflist_ins(&c->lru, &b->lru);
+		c->nhit++;
+	}
+	fflk_unlock(&c->lk);
+	return b;
+}
+
+static void bc_unref(struct bcache *c, struct bc_blk *b)
+{
+	fflk_lock(&c->lk);
+	FF_ASSERT(b->refs != 0);
+	b->refs--;
+	fflk_unlock(&c->lk);
+}
+
+/** Copy a block into cache if the file is being read by another reader too. */
+static void bc_put(struct bcache *c, const struct bc_fid *id, uint64 off, const char *data, size_t len)
+{
+	struct bc_blk *b = NULL;
+	size_t max = mod->in_conf.cache_size;
+	uint hash = bc_hash(id, off);
+
+	fflk_lock(&c->lk);
+	const struct bc_file *f = bc_file_find(c, id);
+	if (f == NULL || f->nreaders < 2
+		|| (c->n != 0 && NULL != *bc_findp(c, id, off, hash)))
+		goto end;
+	fflk_unlock(&c->lk);
+
+	if (NULL == (b = ffmem_new(struct bc_blk))
+		|| NULL == (b->data = ffmem_alloc(len))) {
+		ffmem_free(b);
+		return;
+	}
+	ffmemcpy(b->data, data, len);
+	b->fid = *id;
+	b->off = off;
+	b->hash = hash;
+	b->len = len;
+
+	fflk_lock(&c->lk);
+
+	if (c->n == c->cap) {
+		// rehash
+		struct bc_blk **tab, *it, *next;
+		uint cap = (c->cap != 0) ? c->cap * 2 : 64;
+		if (NULL == (tab = ffmem_callocT(cap, struct bc_blk*)))
+			goto end;
+		for (uint i = 0;  i != c->cap;  i++) {
+			for (it = c->tab[i];  it != NULL;  it = next) {
+				next = it->next;
+				it->next = tab[it->hash & (cap - 1)];
+				tab[it->hash & (cap - 1)] = it;
+			}
+		}
+		ffmem_free(c->tab);
+		c->tab = tab;
+		c->cap = cap;
+	}
+
+	struct bc_blk **pb = bc_findp(c, id, off, hash);
+	if (*pb != NULL)
+		goto end; // another reader has just added it
+	b->next = NULL;
+	*pb = b;
+	fflist_ins(&c->lru, &b->lru);
+	c->n++;
+	c->nput++;
+	c->size += len;
+	b = NULL;
+	bc_evict(c, max);
+
+end:
+	fflk_unlock(&c->lk);
+	if (b != NULL)
+		bc_blk_free(b);
+}
+
+static void bc_free(struct bcache *c)
+{
+	if (c->nput != 0)
+		dbglog(NULL, "block cache: put#:%u  hit#:%u  evict#:%u"
+			, c->nput, c->nhit, c->nevict);
+	bc_evict(c, 0);
+	ffmem_free0(c->tab);
+	c->cap = c->n = 0;
+	ffarr_free(&c->files);
+}
+
+
 static void file_log(void *p, uint level, const ffstr *msg)
 {
 	fmed_file *f = p;
@@ -168,6 +468,199 @@ static void file_onread(void *p)
 	f->handler(f->trk);
 }
 
+/*
+mmap mode: the file is mapped into memory as a whole.
+Data is passed to the next filter by pointers into the mapped region, without copying;
+ fmed_filt.input_map allows a parser to access any part of the file directly.
+The kernel is hinted to read ahead sequentially;  after a seek the data at the new position is requested in advance.
+*/
+
+/** Return TRUE if the file should be mapped into memory. */
+static int file_map_want(const char *fn)
+{
+	struct file_in_conf_t *conf = &mod->in_conf;
+	ffstr ext;
+	fffileinfo fi;
+
+	if (conf->mmap_ext.len != 0) {
+		ffpath_split3(fn, ffsz_len(fn), NULL, NULL, &ext);
+		const struct file_ext *it;
+		FFARR_WALKT(&conf->mmap_ext, it, struct file_ext) {
+			if (ffstr_ieqz(&ext, it->ext))
+				return 1;
+		}
+	}
+
+	return (conf->mmap_min_size != 0
+		&& 0 == fffile_infofn(fn, &fi)
+		&& fffile_infosize(&fi) >= conf->mmap_min_size);
+}
+
+
+// READAHEAD
+/*
+Reading is considered random after RA_RANDOM_SEEKS seeks in a row, each followed by a short read
+ (less than the data of all buffers), until the data of all buffers is read sequentially again:
+ fffileread doesn't read the next buffers in advance, and the kernel is told not to read ahead.
+So a couple of probes at open (e.g. ID3v1 tag at the end of file) or a user's seek don't disable readahead:
+ after such seek the window restarts from the new position.
+While reading sequentially, the kernel is asked to read the window ahead of the current position;
+ the window starts at 'buffer_size * buffers' and doubles each time the position reaches its middle,
+ up to 'readahead_max'.
+A file opened for meta info only starts in random mode, because just its header is needed.
+The hints go to madvise() in mmap mode and to posix_fadvise() otherwise.
+Direct I/O bypasses the page cache, so the kernel hints have no effect:
+ the data is read ahead only by fffileread into its own buffers (FFFILEREAD_FREADAHEAD).
+*/
+
+enum {
+	RA_RANDOM_SEEKS = 3,
+};
+
+enum RA_ADV {
+	RA_SEQUENTIAL,
+	RA_RANDOM,
+	RA_WILLNEED,
+};
+
+static void ra_advise(fmed_file *f, uint64 off, uint64 len, uint adv)
+{
+	uint64 end = ffmin(off + len, f->fsize);
+	if (off >= end)
+		return;
+
+	if (f->map != NULL) {
+#ifdef FF_UNIX
+		static const int madv[] = { MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+		uint64 start = ff_align_floor(off, 4096);
+		madvise((char*)f->map + start, end - start, madv[adv]);
+#endif
+		return;
+	}
+
+#if defined FF_LINUX || defined FF_BSD
+	if (f->fr == NULL || mod->in_conf.directio)
+		return;
+	static const int fadv[] = { POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED };
+	posix_fadvise(fffileread_fd(f->fr), off, end - off, fadv[adv]);
+#endif
+}
+
+static uint64 ra_min(void)
+{
+	return (uint64)mod->in_conf.bsize * ffmax(mod->in_conf.nbufs, 1);
+}
+
+/** Seek to a new position.
+Switch to random access mode if the previous seeks were followed by short reads too. */
+static void ra_onseek(fmed_file *f, uint64 off)
+{
+	if (f->seek - f->ra.seq_start < ra_min())
+		f->ra.nshort++;
+	else
+		f->ra.nshort = 0;
+	f->ra.seq_start = off;
+
+	if (f->ra.win == 0)
+		return;
+
+	if (f->ra.nshort < RA_RANDOM_SEEKS) {
+		// restart the window from the new position
+		f->ra.win = ra_min();
+		f->ra.end = 0;
+		return;
+	}
+
+	f->ra.win = 0;
+	f->ra.end = 0;
+	f->ra.nswitch++;
+	ra_advise(f, 0, f->fsize, RA_RANDOM);
+}
+
+/** Data at the current position is being read:
+ switch to sequential mode or extend the readahead window. */
+static void ra_onread(fmed_file *f)
+{
+	if (f->ra.win == 0) {
+		if (f->seek - f->ra.seq_start < ra_min())
+			return;
+		f->ra.win = ra_min();
+		f->ra.nshort = 0;
+		f->ra.nswitch++;
+		ra_advise(f, 0, f->fsize, RA_SEQUENTIAL);
+
+	} else if (f->ra.end != 0) {
+		if (f->seek + f->ra.win / 2 < f->ra.end)
+			return;
+		f->ra.win = ffmin(f->ra.win * 2, ffmax(mod->in_conf.readahead_max, ra_min()));
+	}
+
+	if (mod->in_conf.readahead_max == 0)
+		return;
+	f->ra.end = f->seek + f->ra.win;
+	f->ra.win_max = ffmax(f->ra.win_max, f->ra.win);
+	f->ra.nhint++;
+	ra_advise(f, f->seek, f->ra.win, RA_WILLNEED);
+}
+
+/** Map the file into memory.
+Return 0 on success;  1 if the file should be read normally;  -1 on error. */
+static int file_map(fmed_file *f, fmed_filt *d)
+{
+	fffileinfo fi;
+	fffd fd, hmap;
+
+	fd = fffile_open(f->fn, FFO_RDONLY | FFO_NOATIME | FFO_NODOSNAME);
+	if (fd == FF_BADFD) {
+		d->e_no_source = (fferr_last() == ENOENT);
+		syserrlog(d->trk, "%s: %s", fffile_open_S, f->fn);
+		return -1;
+	}
+
+	if (0 != fffile_info(fd, &fi)) {
+		syserrlog(d->trk, "%s: %s", fffile_info_S, f->fn);
+		fffile_close(fd);
+		return -1;
+	}
+	if (fffile_isdir(fffile_infoattr(&fi))) {
+		errlog(d->trk, "%s: is a directory", f->fn);
+		fffile_close(fd);
+		return -1;
+	}
+	f->fsize = fffile_infosize(&fi);
+	if (f->fsize == 0 || f->fsize != (size_t)f->fsize) {
+		fffile_close(fd);
+		return 1;
+	}
+
+	if (FF_BADFD != (hmap = ffmap_create(fd, f->fsize, FFMAP_PAGEREAD))) {
+		f->map = ffmap_open(hmap, 0, f->fsize, PROT_READ, MAP_SHARED);
+		ffmap_close(hmap);
+	}
+	fffile_close(fd);
+	if (f->map == NULL) {
+		dbglog(d->trk, "%s: can't map file, reading normally", f->fn);
+		return 1;
+	}
+
+	dbglog(d->trk, "mapped %s (%U kbytes)", f->fn, f->fsize / 1024);
+
+	d->input.size = f->fsize;
+	if (d->out_preserve_date)
+		d->mtime = fffile_infomtime(&fi);
+	ffstr_set(&d->input_map, f->map, f->fsize);
+	f->input_map = &d->input_map;
+	return 0;
+}
+
+static void file_ra_init(fmed_file *f, fmed_filt *d)
+{
+	if (d->input_info)
+		return; // random mode
+	f->ra.win = ra_min();
+	ra_advise(f, 0, f->fsize, RA_SEQUENTIAL);
+}
+
 static void* file_open(fmed_filt *d)
 {
 	fmed_file *f;
@@ -179,6 +672,17 @@ static void* file_open(fmed_filt *d)
 	f->fn = d->track->getvalstr(d->trk, "input");
 	f->trk = d->trk;
 
+	if (file_map_want(f->fn)) {
+		int r = file_map(f, d);
+		if (r < 0)
+			goto done;
+		else if (r == 0) {
+			file_ra_init(f, d);
+			f->handler = d->handler;
+			return f;
+		}
+	}
+
 	fffileread_conf conf = {};
 	conf.udata = f;
 	conf.log = &file_log;
@@ -199,8 +703,18 @@ static void* file_open(fmed_filt *d)
 		syserrlog(d->trk, "%s: %s", fffile_info_S, f->fn);
 		goto done;
 	}
+	if (fffile_isdir(fffile_infoattr(&fi))) {
+		// the track checks for a directory only if the file extension isn't known
+		errlog(d->trk, "%s: is a directory", f->fn);
+		goto done;
+	}
 	f->fsize = fffile_infosize(&fi);
 
+	if (mod->in_conf.cache_size != 0) {
+		bc_fid_init(&f->fid, &fi);
+		f->bc = (0 == bc_open(&mod->bc, &f->fid));
+	}
+
 	dbglog(d->trk, "opened %s (%U kbytes)", f->fn, f->fsize / 1024);
 
 	d->input.size = f->fsize;
@@ -209,6 +723,7 @@ static void* file_open(fmed_filt *d)
 		d->mtime = fffile_infomtime(&fi);
 	}
 
+	file_ra_init(f, d);
 	f->handler = d->handler;
 	return f;
 
@@ -221,24 +736,66 @@ static void file_close(void *ctx)
 {
 	fmed_file *f = ctx;
 
+	if (f->map != NULL || f->fr != NULL)
+		dbglog(f->trk, "readahead: hint#:%u  max:%Ukb  pattern-switch#:%u"
+			, f->ra.nhint, f->ra.win_max / 1024, f->ra.nswitch);
+
+	if (f->map != NULL) {
+		dbglog(f->trk, "seek#:%u", f->nseek);
+		ffstr_null(f->input_map);
+		ffmap_unmap(f->map, f->fsize);
+	}
+
+	if (f->blk != NULL)
+		bc_unref(&mod->bc, f->blk);
+	if (f->bc)
+		bc_close(&mod->bc, &f->fid);
+
 	if (f->fr != NULL) {
 		struct fffileread_stat stat;
 		fffileread_stat(f->fr, &stat);
-		dbglog(f->trk, "cache-hit#:%u  read#:%u  async#:%u  seek#:%u"
-			, stat.ncached, stat.nread, stat.nasync, f->nseek);
+		dbglog(f->trk, "cache-hit#:%u  read#:%u  async#:%u  seek#:%u  shared-cache-hit#:%u"
+			, stat.ncached, stat.nread, stat.nasync, f->nseek, f->ncached);
 		fffileread_unref(f->fr);
 	}
 
 	ffmem_free(f);
 }
 
+/** Pass the next block of the mapped region. */
+static int file_map_getdata(fmed_file *f, fmed_filt *d, uint seek_req)
+{
+	size_t bsize = mod->in_conf.bsize;
+
+	if (seek_req)
+		ra_advise(f, f->seek, bsize, RA_WILLNEED);
+
+	if (f->seek >= f->fsize) {
+		if (f->done || seek_req) {
+			d->outlen = 0;
+			return FMED_RDONE;
+		}
+		f->done = 1;
+		d->outlen = 0;
+		return FMED_ROK;
+	}
+
+	size_t n = ffmin(bsize, f->fsize - f->seek);
+	d->out = (char*)f->map + f->seek,  d->outlen = n;
+	ra_onread(f);
+	f->seek += n;
+	return FMED_ROK;
+}
+
 static int file_getdata(void *ctx, fmed_filt *d)
 {
 	fmed_file *f = ctx;
 	ffstr b = {};
 	ffbool seek_req = 0;
+	int r;
 
 	if ((int64)d->input.seek != FMED_NULL) {
+		ra_onseek(f, d->input.seek);
 		f->seek = d->input.seek;
 		d->input.seek = FMED_NULL;
 		dbglog(d->trk, "seeking to %xU", f->seek);
@@ -247,7 +804,33 @@ static int file_getdata(void *ctx, fmed_filt *d)
 		f->nseek++;
 	}
 
-	int r = fffileread_getdata(f->fr, &b, f->seek, FFFILEREAD_FREADAHEAD);
+	if (f->map != NULL)
+		return file_map_getdata(f, d, seek_req);
+
+	if (f->blk != NULL) {
+		bc_unref(&mod->bc, f->blk);
+		f->blk = NULL;
+	}
+
+	uint64 off = f->seek;
+	if (f->bc) {
+		// try to get data from the shared cache, otherwise read the whole block so it can be cached
+		off = ff_align_floor(f->seek, mod->in_conf.bsize);
+		struct bc_blk *blk;
+		if (NULL != (blk = bc_get(&mod->bc, &f->fid, off))) {
+			if (f->seek - off < blk->len) {
+				f->blk = blk;
+				f->ncached++;
+				ffstr_set(&b, blk->data, blk->len);
+				ffstr_shift(&b, f->seek - off);
+				goto data;
+			}
+			bc_unref(&mod->bc, blk);
+		}
+	}
+
+read:
+	r = fffileread_getdata(f->fr, &b, off, (f->ra.win != 0) ? FFFILEREAD_FREADAHEAD : 0);
 	switch ((enum FFFILEREAD_R)r) {
 
 	case FFFILEREAD_RASYNC:
@@ -269,10 +852,22 @@ static int file_getdata(void *ctx, fmed_filt *d)
 		break;
 
 	case FFFILEREAD_RREAD:
+		if (f->bc)
+			bc_put(&mod->bc, &f->fid, off, b.ptr, b.len);
+		if (off != f->seek) {
+			if (b.len <= f->seek - off) {
+				off = f->seek; // the block is incomplete
+				goto read;
+			}
+			ffstr_shift(&b, f->seek - off);
+		}
 		break;
 	}
 
+data:
 	d->out = b.ptr,  d->outlen = b.len;
+	if (b.len != 0)
+		ra_onread(f);
 	f->seek += b.len;
 	return FMED_ROK;
 }
@@ -94,8 +94,9 @@ enum FMED_SIG {
 	FMED_TASK_XDEL,
 
 	/** Assign command to worker.  Must be called on main thread.
-	uint assign(fffd *kq, uint flags)
+	uint assign(fffd *kq, uint flags[, uint except_wid])
 	flags: enum FMED_WORKER_F
+	except_wid: (FMED_WORKER_FOTHER) don't choose this worker unless it's the only one
 	Return worker ID. */
 	FMED_WORKER_ASSIGN,
 
@@ -118,6 +119,7 @@ enum FMED_SIG {
 
 enum FMED_WORKER_F {
 	FMED_WORKER_FPARALLEL = 1,
+	FMED_WORKER_FOTHER = 2, // choose a worker other than the specified one
 };
 
 enum FMED_FT {
@@ -310,6 +312,17 @@ enum FMED_TRACK_CMD {
 
 	/** Start a track in any worker. */
 	FMED_TRACK_XSTART,
+
+	/** Get the track's part in a conversion pipeline.
+	Return enum FMED_TRK_PIPE. */
+	FMED_TRACK_PIPE,
+};
+
+enum FMED_TRK_PIPE {
+	FMED_TRK_PIPE_NONE,
+	FMED_TRK_PIPE_IN, // input track: decoder
+	FMED_TRK_PIPE_OUT, // output track: encoder.  It has the same "queue_item" as the input track.
+	FMED_TRK_PIPE_FSTARTED = 4, // (FMED_TRK_PIPE_IN) the output track has been started
 };
 
 enum FMED_TRK_TYPE {
@@ -336,6 +349,30 @@ enum FMED_TRK_FVAL {
 	FMED_TRK_META = 0x20,
 };
 
+/** Well-known track values with a fixed ID.
+They are accessible by ID (getval_id(), setval_id()) without a name lookup,
+ and also by name via the string-based functions.
+Sorted by name. */
+enum FMED_TRKV {
+	FMED_TRKV_AUDIO_BITRATE, // "audio_bitrate"
+	FMED_TRKV_AUDIO_ENC_DELAY, // "audio_enc_delay"
+	FMED_TRKV_AUDIO_END_PADDING, // "audio_end_padding"
+	FMED_TRKV_AUDIO_FRAME_SAMPLES, // "audio_frame_samples"
+	FMED_TRKV_ERROR, // "error"
+	FMED_TRKV_FLAC_IN_FRSAMPLES, // "flac_in_frsamples"
+	FMED_TRKV_ICY_META_INT, // "icy_meta_int"
+	FMED_TRKV_LOW_LATENCY, // "low_latency"
+	FMED_TRKV_MIX_TRACKS, // "mix_tracks"
+	FMED_TRKV_MPEG_DELAY, // "mpeg_delay"
+	FMED_TRKV_NETIN_PTR, // "netin_ptr"
+	FMED_TRKV_OGG_FLUSH, // "ogg_flush"
+	FMED_TRKV_OGG_GRANPOS, // "ogg_granpos"
+	FMED_TRKV_OUT_BUFSIZE, // "out_bufsize"
+	FMED_TRKV_QUEUE_ITEM, // "queue_item"
+	FMED_TRKV_STOPPED, // "stopped"
+	_FMED_TRKV_END
+};
+
 #define FMED_TRK_ETMP  NULL // transient/system error
 #define FMED_TRK_EFMT  ((void*)-1) // format is unsupported
 
@@ -383,11 +420,30 @@ typedef struct fmed_track {
 	/**
 	@flags: enum FMED_QUE_META_F */
 	void (*meta_set)(void *trk, const ffstr *name, const ffstr *val, uint flags);
+
+	/** Get value by ID.
+	@id: enum FMED_TRKV
+	Return FMED_NULL if not set. */
+	int64 (*getval_id)(void *trk, uint id);
+
+	/** Set value by ID.
+	@id: enum FMED_TRKV */
+	void (*setval_id)(void *trk, uint id, int64 val);
+
+	/** Allocate zero-filled memory that lives as long as the track.
+	All memory is released at once when the track is destroyed - don't free it.
+	Filters may use it for their contexts and buffers of a known size.
+	Return NULL on error. */
+	void* (*alloc)(void *trk, size_t size);
 } fmed_track;
 
 #define fmed_getval(name)  (d)->track->getval((d)->trk, name)
 #define fmed_popval(name)  (d)->track->popval((d)->trk, name)
 #define fmed_setval(name, val)  (d)->track->setval((d)->trk, name, val)
+#define fmed_getval_id(id)  (d)->track->getval_id((d)->trk, id)
+#define fmed_setval_id(id, val)  (d)->track->setval_id((d)->trk, id, val)
+#define fmed_trk_alloc(d, size)  (d)->track->alloc((d)->trk, size)
+#define fmed_trk_allocT(d, T)  ((T*)(d)->track->alloc((d)->trk, sizeof(T)))
 #define fmed_trk_filt_prev(d, ptr)  (d)->track->cmd2((d)->trk, FMED_TRACK_FILT_GETPREV, ptr)
 
 typedef struct fmed_trk_meta {
@@ -497,6 +553,7 @@ struct fmed_trk {
 	fftime mtime;
 	ffarr2 include_files; //ffstr[]
 	ffarr2 exclude_files; //ffstr[]
+	ffstr input_map; //the whole input file mapped into memory (#file.in in mmap mode), or empty
 	union {
 	uint bits;
 	struct {
@@ -522,6 +579,8 @@ struct fmed_trk {
 		uint err :1;
 		uint show_tags :1;
 		uint print_time :1;
+		uint conv_gain :1; // gain is applied by audio converter rather than by a separate filter
+		uint snd_output_gapless :1; // the next track will continue writing to audio output: don't drain it
 	};
 	};
 
@@ -598,6 +657,7 @@ struct fmed_filter2 {
 
 struct fmed_aconv {
 	ffpcmex in, out;
+	uint gain :1; // apply track gain (audio.gain) to input data while converting
 };
 
 static FFINL int64 fmed_popval_def(fmed_filt *d, const char *name, int64 def)
@@ -712,6 +772,7 @@ enum FMED_QUE_EVT {
 	FMED_QUE_ONADD,
 	FMED_QUE_ONRM,
 	FMED_QUE_ONCLEAR,
+	FMED_QUE_ONUPDATE, // e: NULL;  meta of several entries was updated
 };
 
 /** @flags: enum FMED_QUE_EVT. */
@@ -733,6 +794,7 @@ enum FMED_QUE {
 
 	/** Save playlist to file.
 	int save(ssize_t plid, const char *filename)
+	flags: FMED_QUE_SNAP
 	Return -1:plid doesn't exist */
 	FMED_QUE_SAVE,
 
@@ -750,7 +812,11 @@ enum FMED_QUE {
 	FMED_QUE_RMDEAD,
 	FMED_QUE_METASET, // @param2: ffstr name_val_pair[2]
 	FMED_QUE_SETONCHANGE, // @param: fmed_que_onchange_t
-	FMED_QUE_EXPAND, // @param: fmed_que_entry*
+	/** Schedule expansion; FMED_QUE_ONUPDATE is sent when done.  Thread-safe.
+	@param: fmed_que_entry*
+	@param2: 0: directory or playlist;
+	 1: read meta and duration of a local file (once per entry), probably from the meta cache */
+	FMED_QUE_EXPAND,
 	FMED_QUE_HAVEUSERMETA, // @param: fmed_que_entry*
 
 	/** Create new list.
@@ -796,6 +862,7 @@ enum FMED_QUE {
 	void sort(int plist, const char *by, uint reverse)
 	plist: list index or -1g
 	by: meta name or "__dur" (duration) or "__url" or "__random"
+	 Several keys may be specified: "album,tracknumber".  The sort is stable.
 	reverse: reverse order (0/1) */
 	FMED_QUE_SORT,
 
@@ -844,6 +911,25 @@ enum FMED_QUE {
 	void expand2(fmed_que_entry *e, void (*ondone)(void*), void *udata) */
 	FMED_QUE_EXPAND2,
 
+	/** Load playlist from the snapshot written by FMED_QUE_SAVE with FMED_QUE_SNAP ("FILENAME.snap"),
+	 if the snapshot is not older than FILENAME.  The playlist must be empty.
+	int load_snap(int plist, const char *filename)
+	Return 0 on success;  -1: snapshot can't be used: the caller should add FILENAME as usual. */
+	FMED_QUE_LOAD_SNAP,
+
+	/** Set position of the entry the user is looking at:
+	 the scheduled expansion of the entries around it is done first.  Thread-safe.
+	void set_visible(size_t idx) */
+	FMED_QUE_SET_VISIBLE,
+
+	/** Find entries in the current playlist and put them into a new filtered list.
+	 The search is case-insensitive and uses the playlist's search index,
+	 which is created on the first call and then updated when entries or their meta change.
+	ssize_t search(const ffstr *text, uint flags)
+	flags: enum FMED_QUE_SEARCH_F
+	Return the number of entries found;  -1 on error. */
+	FMED_QUE_SEARCH,
+
 	_FMED_QUE_LAST
 };
 
@@ -857,6 +943,14 @@ enum FMED_QUE_CMDF {
 
 	/** FMED_QUE_NEW: Don't allow random play for this list. */
 	FMED_QUE_NORND = 0x100000,
+
+	/** FMED_QUE_SAVE: also write the snapshot "FILENAME.snap" (for the application's own playlists). */
+	FMED_QUE_SNAP = 0x200000,
+};
+
+enum FMED_QUE_SEARCH_F {
+	FMED_QUE_SEARCH_URL = 1,
+	FMED_QUE_SEARCH_META = 2,
 };
 
 enum FMED_QUE_META_F {
@@ -911,8 +1005,13 @@ Return fmed_que_entry*. */
 #define fmed_queue_save(qid, filename) \
 	cmdv(FMED_QUE_SAVE, (size_t)(qid), (void*)(filename))
 
+#define fmed_queue_save_snap(qid, filename) \
+	cmdv(FMED_QUE_SAVE | FMED_QUE_SNAP, (size_t)(qid), (void*)(filename))
+
 #define fmed_queue_add(flags, plid, ent)  cmdv(FMED_QUE_ADD2 | (flags), (int)(plid), ent)
 
+#define fmed_queue_load_snap(plid, filename)  cmdv(FMED_QUE_LOAD_SNAP, (int)(plid), (char*)(filename))
+
 
 // GLOBCMD
 
@@ -3,6 +3,7 @@ Copyright (c) 2017 Simon Zolin */
 
 #include <fmedia.h>
 
+#include <format/seekidx.h>
 #include <FF/aformat/aac-adts.h>
 
 
@@ -16,6 +17,14 @@ const fmed_filter aac_adts_input = {
 	&aac_adts_open, &aac_adts_process, &aac_adts_close
 };
 
+static struct aac_adts_in_conf_t {
+	byte seek_index;
+} aac_adts_in_conf;
+
+static const ffpars_arg aac_adts_in_conf_args[] = {
+	{ "seek_index",  FFPARS_TBOOL8,  FFPARS_DSTOFF(struct aac_adts_in_conf_t, seek_index) },
+};
+
 //OUTPUT
 static void* aac_adts_out_open(fmed_filt *d);
 static void aac_adts_out_close(void *ctx);
@@ -26,8 +35,20 @@ const fmed_filter aac_adts_output = { &aac_adts_out_open, &aac_adts_out_process,
 struct aac {
 	ffaac_adts adts;
 	int64 seek_pos;
+	int64 seek_req;
+	seekidx idx;
+	uint64 pos_base; // position and offset of the frame the parser was restarted at
+	uint64 off_base;
+	uint hdr :1;
 };
 
+int aac_adts_in_config(ffpars_ctx *ctx)
+{
+	aac_adts_in_conf.seek_index = 1;
+	ffpars_setargs(ctx, &aac_adts_in_conf, aac_adts_in_conf_args, FFCNT(aac_adts_in_conf_args));
+	return 0;
+}
+
 static void* aac_adts_open(fmed_filt *d)
 {
 	struct aac *a;
@@ -37,16 +58,43 @@ static void* aac_adts_open(fmed_filt *d)
 		a->adts.options = FFAAC_ADTS_OPT_WHOLEFRAME;
 	ffaac_adts_open(&a->adts);
 	a->seek_pos = -1;
+	a->seek_req = FMED_NULL;
 	return a;
 }
 
 static void aac_adts_close(void *ctx)
 {
 	struct aac *a = ctx;
+	seekidx_close(&a->idx, NULL);
 	ffaac_adts_close(&a->adts);
 	ffmem_free(a);
 }
 
+/** Jump to the indexed frame nearest to the seek position: restart the parser at its offset.
+Return 0 if the input is being seeked. */
+static int aac_adts_idxseek(struct aac *a, fmed_filt *d, uint64 seek_samps)
+{
+	uint64 pos = a->pos_base + ffaac_adts_pos(&a->adts);
+	uint64 rpos = pos + ffaac_adts_frsamples(&a->adts);
+	const struct seekidx_pt *pt;
+
+	if (NULL == (pt = seekidx_find(&a->idx, seek_samps)))
+		return -1;
+	if (seek_samps >= pos && pt->sample <= rpos)
+		return -1; // reading forward from here is as good
+
+	dbglog(core, d->trk, NULL, "seek index: sample %U at offset %xU", pt->sample, pt->off);
+	ffaac_adts_close(&a->adts);
+	ffmem_tzero(&a->adts);
+	if (d->stream_copy)
+		a->adts.options = FFAAC_ADTS_OPT_WHOLEFRAME;
+	ffaac_adts_open(&a->adts);
+	a->pos_base = pt->sample;
+	a->off_base = pt->off;
+	d->input.seek = pt->off;
+	return 0;
+}
+
 static int aac_adts_process(void *ctx, fmed_filt *d)
 {
 	struct aac *a = ctx;
@@ -66,10 +114,14 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 	}
 
 	if ((int64)d->audio.seek != FMED_NULL) {
-		a->seek_pos = d->audio.seek;
+		if (d->audio.seek != a->seek_req) {
+			a->seek_req = d->audio.seek;
+			a->seek_pos = d->audio.seek;
+		}
 		if (d->stream_copy)
 			d->audio.seek = FMED_NULL;
-	}
+	} else
+		a->seek_req = FMED_NULL;
 
 	for (;;) {
 		r = ffaac_adts_read(&a->adts);
@@ -77,6 +129,10 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 		switch ((enum FFAAC_ADTS_R)r) {
 
 		case FFAAC_ADTS_RHDR:
+			if (a->hdr)
+				continue; // the parser was restarted after seeking
+			a->hdr = 1;
+
 			d->audio.fmt.format = FFPCM_16;
 			d->audio.fmt.sample_rate = a->adts.info.sample_rate;
 			d->audio.fmt.channels = a->adts.info.channels;
@@ -85,6 +141,10 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 			d->datatype = "aac";
 			fmed_setval("audio_frame_samples", 1024);
 
+			if (aac_adts_in_conf.seek_index && !d->input_info
+				&& (int64)d->input.size != FMED_NULL)
+				seekidx_open(&a->idx, d, a->adts.info.sample_rate);
+
 			if (d->stream_copy) {
 				d->audio.convfmt = d->audio.fmt;
 			} else {
@@ -99,11 +159,19 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 		case FFAAC_ADTS_RDATA:
 		case FFAAC_ADTS_RFRAME:
 
+			seekidx_add(&a->idx, a->pos_base + ffaac_adts_pos(&a->adts)
+				, a->off_base + ffaac_adts_froffset(&a->adts));
+
 			if (a->seek_pos != -1) {
 				uint64 seek_samps = ffpcm_samples(a->seek_pos, a->adts.info.sample_rate);
-				uint64 rpos = ffaac_adts_pos(&a->adts) + ffaac_adts_frsamples(&a->adts);
-				if (rpos < seek_samps)
-					continue;
+				uint64 pos = a->pos_base + ffaac_adts_pos(&a->adts);
+				uint64 rpos = pos + ffaac_adts_frsamples(&a->adts);
+				if (rpos < seek_samps || seek_samps < pos) {
+					if (0 == aac_adts_idxseek(a, d, seek_samps))
+						return FMED_RMORE;
+					if (rpos < seek_samps)
+						continue;
+				}
 				a->seek_pos = -1;
 			}
 
@@ -118,12 +186,12 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 
 		case FFAAC_ADTS_RWARN:
 			warnlog(core, d->trk, "aac", "ffaac_adts_read(): %s.  Offset: %U"
-				, ffaac_adts_errstr(&a->adts), ffaac_adts_off(&a->adts));
+				, ffaac_adts_errstr(&a->adts), a->off_base + ffaac_adts_off(&a->adts));
 			continue;
 
 		case FFAAC_ADTS_RERR:
 			errlog(core, d->trk, "aac", "ffaac_adts_read(): %s.  Offset: %U"
-				, ffaac_adts_errstr(&a->adts), ffaac_adts_off(&a->adts));
+				, ffaac_adts_errstr(&a->adts), a->off_base + ffaac_adts_off(&a->adts));
 			return FMED_RERR;
 
 		default:
@@ -134,10 +202,10 @@ static int aac_adts_process(void *ctx, fmed_filt *d)
 
 data:
 	ffaac_adts_output(&a->adts, &blk);
-	d->audio.pos = ffaac_adts_pos(&a->adts);
+	d->audio.pos = a->pos_base + ffaac_adts_pos(&a->adts);
 	dbglog(core, d->trk, NULL, "passing frame #%u  samples:%u[%U]  size:%u  off:%xU"
 		, a->adts.frno, ffaac_adts_frsamples(&a->adts), d->audio.pos
-		, blk.len, ffaac_adts_froffset(&a->adts));
+		, blk.len, a->off_base + ffaac_adts_froffset(&a->adts));
 	d->out = blk.ptr,  d->outlen = blk.len;
 	return FMED_RDATA;
 }
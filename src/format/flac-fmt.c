@@ -68,7 +68,7 @@ static const ffpars_arg flac_out_conf_args[] = {
 
 static void* flac_in_create(fmed_filt *d)
 {
-	struct flac *f = ffmem_new(struct flac);
+	struct flac *f = fmed_trk_allocT(d, struct flac);
 	if (f == NULL)
 		return NULL;
 	ffflac_init(&f->fl);
@@ -88,7 +88,6 @@ static void flac_in_free(void *ctx)
 {
 	struct flac *f = ctx;
 	ffflac_close(&f->fl);
-	ffmem_free(f);
 }
 
 static void flac_meta(struct flac *f, fmed_filt *d)
@@ -393,7 +392,7 @@ static int flac_out_encode(void *ctx, fmed_filt *d)
 	}
 
 	for (;;) {
-	r = ffflac_write(&f->fl, fmed_getval("flac_in_frsamples"));
+	r = ffflac_write(&f->fl, fmed_getval_id(FMED_TRKV_FLAC_IN_FRSAMPLES));
 
 	switch (r) {
 	case FFFLAC_RMORE:
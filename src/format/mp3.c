@@ -3,6 +3,7 @@ Copyright (c) 2017 Simon Zolin */
 
 #include <fmedia.h>
 
+#include <format/seekidx.h>
 #include <FF/aformat/mp3.h>
 #include <FF/audio/pcm.h>
 #include <FF/mtags/mmtag.h>
@@ -20,15 +21,31 @@ const fmed_filter fmed_mpeg_input = {
 	&mpeg_open, &mpeg_process, &mpeg_close
 };
 
+static struct mpeg_in_conf_t {
+	byte seek_index;
+} mpeg_in_conf;
+
+static const ffpars_arg mpeg_in_conf_args[] = {
+	{ "seek_index",  FFPARS_TBOOL8,  FFPARS_DSTOFF(struct mpeg_in_conf_t, seek_index) },
+};
+
 typedef struct mpeg_in {
 	ffmpgfile mpg;
 	uint state;
+	seekidx idx;
+	uint64 pos_base; // position and offset of the frame the parser was restarted at
+	uint64 off_base;
+	uint64 seek_samps; // skip frames before this position after restarting at an index point;  -1: none
 	uint have_id32tag :1
 		, seeking :1
+		, restarted :1 // the parser was restarted: header and tags are already processed
+		, seek_after_hdr :1 // call ffmpg_rseek() when the restarted parser reads the header
+		, pos_exact :1 // frame positions are exact and may be added to the index
 		;
 } mpeg_in;
 
 static void mpeg_meta(mpeg_in *m, fmed_filt *d, uint type);
+static int mpeg_seek(mpeg_in *m, fmed_filt *d, uint64 samps);
 
 //OUTPUT
 static void* mpeg_out_open(fmed_filt *d);
@@ -68,6 +85,13 @@ typedef struct mpeg_copy {
 } mpeg_copy;
 
 
+int mpeg_in_config(ffpars_ctx *ctx)
+{
+	mpeg_in_conf.seek_index = 1;
+	ffpars_setargs(ctx, &mpeg_in_conf, mpeg_in_conf_args, FFCNT(mpeg_in_conf_args));
+	return 0;
+}
+
 static void* mpeg_open(fmed_filt *d)
 {
 	if (d->stream_copy && !d->track->cmd(d->trk, FMED_TRACK_META_HAVEUSER)) {
@@ -77,7 +101,7 @@ static void* mpeg_open(fmed_filt *d)
 		return FMED_FILT_SKIP;
 	}
 
-	mpeg_in *m = ffmem_new(mpeg_in);
+	mpeg_in *m = fmed_trk_allocT(d, mpeg_in);
 	if (m == NULL)
 		return NULL;
 	ffmpg_fopen(&m->mpg);
@@ -87,6 +111,8 @@ static void* mpeg_open(fmed_filt *d)
 		ffmpg_setsize(&m->mpg.rdr, d->input.size);
 		m->mpg.options = FFMPG_O_ID3V2 | FFMPG_O_APETAG | FFMPG_O_ID3V1;
 	}
+	m->seek_samps = (uint64)-1;
+	m->pos_exact = 1;
 
 	return m;
 }
@@ -94,8 +120,56 @@ static void* mpeg_open(fmed_filt *d)
 static void mpeg_close(void *ctx)
 {
 	mpeg_in *m = ctx;
+	seekidx_close(&m->idx, NULL);
 	ffmpg_fclose(&m->mpg);
-	ffmem_free(m);
+}
+
+/** Restart the parser at the frame at 'off' with position 'sample'. */
+static void mpeg_restart(mpeg_in *m, fmed_filt *d, uint64 sample, uint64 off)
+{
+	ffmpg_fclose(&m->mpg);
+	ffmem_tzero(&m->mpg);
+	ffmpg_fopen(&m->mpg);
+	m->mpg.codepage = core->getval("codepage");
+	ffmpg_setsize(&m->mpg.rdr, d->input.size - off);
+	m->mpg.options = FFMPG_O_APETAG | FFMPG_O_ID3V1;
+	if (off == 0)
+		m->mpg.options |= FFMPG_O_ID3V2;
+	m->pos_base = sample;
+	m->off_base = off;
+	m->restarted = 1;
+	m->pos_exact = 1;
+	d->input.seek = off;
+}
+
+/** Seek to 'samps':
+ jump to the nearest indexed frame before it, or let the parser find the position by itself.
+Return 1 if the parser was restarted and needs new input. */
+static int mpeg_seek(mpeg_in *m, fmed_filt *d, uint64 samps)
+{
+	const struct seekidx_pt *pt;
+	uint64 pos = m->pos_base + ffmpg_cursample(&m->mpg.rdr);
+
+	if (NULL != (pt = seekidx_find(&m->idx, samps))
+		&& samps - pt->sample <= (uint64)m->idx.interval * 8
+		&& !(samps >= pos && pt->sample <= pos)) {
+		dbglog(core, d->trk, NULL, "seek index: sample %U at offset %xU", pt->sample, pt->off);
+		mpeg_restart(m, d, pt->sample, pt->off);
+		m->seek_samps = samps;
+		return 1;
+	}
+
+	if (samps < m->pos_base) {
+		// the parser doesn't see the data before the frame it was restarted at
+		mpeg_restart(m, d, 0, 0);
+		m->seek_samps = samps;
+		m->seek_after_hdr = 1;
+		return 1;
+	}
+
+	ffmpg_rseek(&m->mpg.rdr, samps - m->pos_base);
+	m->pos_exact = 0; // the position after seeking may be estimated
+	return 0;
 }
 
 static void mpeg_meta(mpeg_in *m, fmed_filt *d, uint type)
@@ -151,9 +225,11 @@ again:
 	case I_DATA:
 		if ((int64)d->audio.seek != FMED_NULL && !m->seeking) {
 			m->seeking = 1;
-			ffmpg_rseek(&m->mpg.rdr, ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate));
+			uint64 samps = ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate);
 			if (d->stream_copy)
 				d->audio.seek = FMED_NULL;
+			if (mpeg_seek(m, d, samps))
+				return FMED_RMORE;
 		}
 		break;
 	}
@@ -163,6 +239,15 @@ again:
 
 		switch (r) {
 		case FFMPG_RFRAME:
+			if (m->pos_exact)
+				seekidx_add(&m->idx, m->pos_base + ffmpg_cursample(&m->mpg.rdr)
+					, m->off_base + m->mpg.rdr.off - m->mpg.frame.len);
+
+			if (m->seek_samps != (uint64)-1) {
+				if (m->pos_base + ffmpg_cursample(&m->mpg.rdr) + m->mpg.rdr.frsamps <= m->seek_samps)
+					continue;
+				m->seek_samps = (uint64)-1;
+			}
 			goto data;
 
 		case FFMPG_RMORE:
@@ -184,6 +269,16 @@ again:
 			continue;
 
 		case FFMPG_RHDR:
+			if (m->restarted) {
+				if (m->seek_after_hdr) {
+					m->seek_after_hdr = 0;
+					ffmpg_rseek(&m->mpg.rdr, m->seek_samps);
+					m->seek_samps = (uint64)-1;
+					m->pos_exact = 0;
+				}
+				continue;
+			}
+
 			dbglog(core, d->trk, NULL, "preset:%s  tool:%s  xing-frames:%u"
 				, ffmpg_isvbr(&m->mpg.rdr) ? "VBR" : "CBR", m->mpg.rdr.lame.id, m->mpg.rdr.xing.frames);
 			ffpcm_fmtcopy(&d->audio.fmt, &ffmpg_fmt(&m->mpg.rdr));
@@ -202,13 +297,18 @@ again:
 			m->state = I_DATA;
 			fmed_setval("mpeg_delay", m->mpg.rdr.delay);
 
+			if (mpeg_in_conf.seek_index && !d->input_info
+				&& (int64)d->input.size != FMED_NULL)
+				seekidx_open(&m->idx, d, ffmpg_fmt(&m->mpg.rdr).sample_rate);
+
 			if (!d->stream_copy
 				&& 0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, "mpeg.decode"))
 				return FMED_RERR;
 
 			if ((int64)d->audio.seek != FMED_NULL && !m->seeking) {
 				m->seeking = 1;
-				ffmpg_rseek(&m->mpg.rdr, ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate));
+				if (mpeg_seek(m, d, ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate)))
+					return FMED_RMORE;
 			}
 
 			goto again;
@@ -216,11 +316,12 @@ again:
 		case FFMPG_RID31:
 		case FFMPG_RID32:
 		case FFMPG_RAPETAG:
-			mpeg_meta(m, d, r);
+			if (!m->restarted)
+				mpeg_meta(m, d, r);
 			break;
 
 		case FFMPG_RSEEK:
-			d->input.seek = ffmpg_seekoff(&m->mpg);
+			d->input.seek = m->off_base + ffmpg_seekoff(&m->mpg);
 			return FMED_RMORE;
 
 		case FFMPG_RWARN:
@@ -249,10 +350,10 @@ data:
 		m->seeking = 0;
 	d->out = m->mpg.frame.ptr;
 	d->outlen = m->mpg.frame.len;
-	d->audio.pos = ffmpg_cursample(&m->mpg.rdr);
+	d->audio.pos = m->pos_base + ffmpg_cursample(&m->mpg.rdr);
 	dbglog(core, d->trk, NULL, "passing frame #%u  samples:%u[%U]  size:%u  br:%u  off:%xU"
 		, m->mpg.rdr.frno, (uint)m->mpg.rdr.frsamps, d->audio.pos, (uint)m->mpg.frame.len
-		, ffmpg_hdr_bitrate((void*)m->mpg.frame.ptr), m->mpg.rdr.off - m->mpg.frame.len);
+		, ffmpg_hdr_bitrate((void*)m->mpg.frame.ptr), m->off_base + m->mpg.rdr.off - m->mpg.frame.len);
 	return FMED_RDATA;
 }
 
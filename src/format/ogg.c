@@ -268,10 +268,10 @@ data:
 	if (o->stmcopy) {
 		uint64 set_gpos = (uint64)-1;
 		if (ffogg_page_last_pkt(&o->og)) {
-			fmed_setval("ogg_flush", 1);
+			fmed_setval_id(FMED_TRKV_OGG_FLUSH, 1);
 			set_gpos = ffogg_granulepos(&o->og);
 		}
-		fmed_setval("ogg_granpos", set_gpos);
+		fmed_setval_id(FMED_TRKV_OGG_GRANPOS, set_gpos);
 	}
 
 	r = FMED_RDATA;
@@ -361,8 +361,8 @@ static int ogg_out_encode(void *ctx, fmed_filt *d)
 
 	if (d->flags & FMED_FFWD) {
 		o->og.fin = !!(d->flags & FMED_FLAST);
-		o->og.flush = (1 == fmed_getval("ogg_flush"));
-		o->og.pkt_endpos = fmed_getval("ogg_granpos");
+		o->og.flush = (1 == fmed_getval_id(FMED_TRKV_OGG_FLUSH));
+		o->og.pkt_endpos = fmed_getval_id(FMED_TRKV_OGG_GRANPOS);
 		ffstr_set(&o->og.pkt, d->data, d->datalen);
 		d->datalen = 0;
 	}
@@ -377,7 +377,7 @@ static int ogg_out_encode(void *ctx, fmed_filt *d)
 		// break
 
 	case FFOGG_RDATA:
-		fmed_setval("ogg_flush", 0);
+		fmed_setval_id(FMED_TRKV_OGG_FLUSH, 0);
 		goto data;
 
 	case FFOGG_RMORE:
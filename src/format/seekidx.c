@@ -0,0 +1,277 @@
+/** Persistent seek index for formats without a native one.
+Copyright (c) 2019 Simon Zolin */
+
+#include <format/seekidx.h>
+#include <FF/array.h>
+#include <FFOS/file.h>
+#include <FFOS/dir.h>
+#include <FFOS/error.h>
+#include <FF/path.h>
+#include <FF/sys/dir.h>
+#include <stdlib.h>
+
+
+extern const fmed_core *core;
+
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "seekidx", __VA_ARGS__)
+#define syswarnlog(trk, ...)  fmed_syswarnlog(core, trk, "seekidx", __VA_ARGS__)
+
+enum {
+	SI_VER = 1,
+	SI_MAXSIZE = 16 * 1024 * 1024,
+	SI_MAXFILES = 1000, // max. number of index files;  the oldest are deleted
+};
+
+/* Index file:
+hdr
+seekidx_pt[n] (host byte order)
+*/
+struct seekidx_hdr {
+	char magic[4]; // "FSIX"
+	uint ver;
+	uint sample_rate;
+	uint n;
+	uint64 fsize;
+	uint64 mtime;
+};
+
+static uint64 si_hash(uint64 h, const void *data, size_t len)
+{
+	const byte *p = data;
+	for (size_t i = 0;  i != len;  i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static void si_load(seekidx *si, void *trk)
+{
+	ffarr buf = {0};
+	const struct seekidx_hdr *h;
+
+	if (0 != fffile_readall(&buf, si->fn, SI_MAXSIZE))
+		goto end;
+
+	h = (void*)buf.ptr;
+	if (buf.len < sizeof(*h)
+		|| ffs_cmp(h->magic, "FSIX", 4)
+		|| h->ver != SI_VER
+		|| h->sample_rate != si->sample_rate
+		|| h->fsize != si->fsize
+		|| h->mtime != si->mtime
+		|| h->n != (buf.len - sizeof(*h)) / sizeof(struct seekidx_pt)
+		|| (buf.len - sizeof(*h)) % sizeof(struct seekidx_pt) != 0) {
+		dbglog(trk, "%s: index is stale or corrupted", si->fn);
+		goto end;
+	}
+
+	if (h->n == 0
+		|| NULL == ffarr_allocT(&si->pts, h->n, struct seekidx_pt))
+		goto end;
+	ffmemcpy(si->pts.ptr, buf.ptr + sizeof(*h), h->n * sizeof(struct seekidx_pt));
+	si->pts.len = h->n;
+	dbglog(trk, "%s: loaded %u points", si->fn, h->n);
+
+end:
+	ffarr_free(&buf);
+}
+
+int seekidx_open(seekidx *si, fmed_filt *d, uint sample_rate)
+{
+	const char *in;
+	fffileinfo fi;
+	fftime mt;
+
+	ffmem_tzero(si);
+	if (FMED_PNULL == (in = d->track->getvalstr(d->trk, "input"))
+		|| 0 != fffile_infofn(in, &fi)
+		|| sample_rate == 0)
+		return -1;
+
+	si->fsize = fffile_infosize(&fi);
+	mt = fffile_infomtime(&fi);
+	si->mtime = fftime_sec(&mt);
+	si->sample_rate = sample_rate;
+	si->interval = sample_rate;
+
+	uint64 h = 0xcbf29ce484222325ULL;
+	h = si_hash(h, in, ffsz_len(in));
+	h = si_hash(h, &si->fsize, sizeof(si->fsize));
+	h = si_hash(h, &si->mtime, sizeof(si->mtime));
+	if (NULL == (si->fn = ffsz_alfmt("%sseekidx%c%016xU.idx", core->props->user_path, FFPATH_SLASH, h)))
+		return -1;
+
+	si_load(si, d->trk);
+	return 0;
+}
+
+static int si_save(seekidx *si)
+{
+	ffarr buf = {0};
+	struct seekidx_hdr h = {};
+	char *tmp = NULL;
+	int r = -1;
+
+	ffmemcpy(h.magic, "FSIX", 4);
+	h.ver = SI_VER;
+	h.sample_rate = si->sample_rate;
+	h.n = si->pts.len;
+	h.fsize = si->fsize;
+	h.mtime = si->mtime;
+	if (NULL == ffarr_append(&buf, &h, sizeof(h))
+		|| NULL == ffarr_append(&buf, si->pts.ptr, si->pts.len * sizeof(struct seekidx_pt)))
+		goto end;
+
+	// write to a temporary file so a concurrent reader never sees a partially written index
+	if (NULL == (tmp = ffsz_alfmt("%s.tmp", si->fn)))
+		goto end;
+	if (0 != fffile_writeall(tmp, buf.ptr, buf.len, 0)) {
+		if (!fferr_nofile(fferr_last())
+			|| (0 != ffdir_make_path(tmp, 0) && fferr_last() != EEXIST)
+			|| 0 != fffile_writeall(tmp, buf.ptr, buf.len, 0))
+			goto end;
+	}
+	if (0 != fffile_rename(tmp, si->fn)) {
+		fffile_rm(tmp);
+		goto end;
+	}
+	r = 0;
+
+end:
+	ffmem_safefree(tmp);
+	ffarr_free(&buf);
+	return r;
+}
+
+struct si_file {
+	char *name;
+	uint64 mtime;
+};
+
+static int si_file_cmp(const void *a, const void *b)
+{
+	const struct si_file *fa = a, *fb = b;
+	return (fa->mtime < fb->mtime) ? -1 : (fa->mtime > fb->mtime);
+}
+
+static int si_isidx(const char *name)
+{
+	size_t n = ffsz_len(name);
+	return (n > FFSLEN(".idx") && !ffmemcmp(name + n - FFSLEN(".idx"), ".idx", FFSLEN(".idx")));
+}
+
+/** Delete the least recently written index files if there are more than SI_MAXFILES,
+ so that 3/4 of the limit are left. */
+static void si_evict(const char *fn, void *trk)
+{
+	ffdirexp dr;
+	ffstr dir;
+	char *sdir = NULL;
+	const char *name;
+	ffarr files = {0}; // struct si_file[]
+	struct si_file *f;
+	fffileinfo fi;
+	uint n = 0, del = 0;
+
+	ffpath_split2(fn, ffsz_len(fn), &dir, NULL);
+	if (NULL == (sdir = ffsz_alcopystr(&dir))
+		|| 0 != ffdir_expopen(&dr, sdir, 0))
+		goto end;
+	while (NULL != (name = ffdir_expread(&dr))) {
+		if (si_isidx(ffdir_expname(&dr, name)))
+			n++;
+	}
+	ffdir_expclose(&dr);
+	if (n <= SI_MAXFILES)
+		goto end;
+
+	if (0 != ffdir_expopen(&dr, sdir, 0))
+		goto end;
+	while (NULL != (name = ffdir_expread(&dr))) {
+		if (!si_isidx(ffdir_expname(&dr, name))
+			|| 0 != fffile_infofn(name, &fi)
+			|| fffile_isdir(fffile_infoattr(&fi)))
+			continue;
+		if (NULL == (f = ffarr_pushgrowT(&files, 256, struct si_file)))
+			break;
+		fftime mt = fffile_infomtime(&fi);
+		f->mtime = fftime_sec(&mt);
+		if (NULL == (f->name = ffsz_alcopyz(name))) {
+			files.len--;
+			break;
+		}
+	}
+	ffdir_expclose(&dr);
+
+	qsort(files.ptr, files.len, sizeof(struct si_file), &si_file_cmp);
+	FFARR_WALKT(&files, f, struct si_file) {
+		if (files.len - del <= SI_MAXFILES * 3 / 4)
+			break;
+		if (0 == fffile_rm(f->name))
+			del++;
+	}
+	dbglog(trk, "%S: index files: %u, deleted: %u", &dir, n, del);
+
+end:
+	FFARR_WALKT(&files, f, struct si_file) {
+		ffmem_free(f->name);
+	}
+	ffarr_free(&files);
+	ffmem_safefree(sdir);
+}
+
+void seekidx_close(seekidx *si, void *trk)
+{
+	if (si->fn == NULL)
+		return;
+
+	if (si->modified) {
+		if (0 != si_save(si))
+			syswarnlog(trk, "%s: %s", fffile_write_S, si->fn);
+		else {
+			dbglog(trk, "%s: saved %L points", si->fn, si->pts.len);
+			si_evict(si->fn, trk);
+		}
+	}
+
+	ffarr_free(&si->pts);
+	ffmem_free0(si->fn);
+}
+
+void seekidx_add(seekidx *si, uint64 sample, uint64 off)
+{
+	if (si->fn == NULL)
+		return;
+
+	if (si->pts.len != 0) {
+		const struct seekidx_pt *last = ffarr_itemT(&si->pts, si->pts.len - 1, struct seekidx_pt);
+		if (sample < last->sample + si->interval || off <= last->off)
+			return;
+	}
+
+	struct seekidx_pt *pt;
+	if (NULL == (pt = ffarr_pushgrowT(&si->pts, 256, struct seekidx_pt)))
+		return;
+	pt->sample = sample;
+	pt->off = off;
+	si->modified = 1;
+}
+
+const struct seekidx_pt* seekidx_find(seekidx *si, uint64 sample)
+{
+	const struct seekidx_pt *pts = (void*)si->pts.ptr;
+	size_t lo = 0, hi = si->pts.len;
+
+	while (lo != hi) {
+		size_t i = lo + (hi - lo) / 2;
+		if (pts[i].sample <= sample)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+
+	if (lo == 0)
+		return NULL;
+	return &pts[lo - 1];
+}
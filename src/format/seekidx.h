@@ -0,0 +1,46 @@
+/** Persistent seek index for formats without a native one.
+Copyright (c) 2019 Simon Zolin */
+
+/*
+A reader records (sample -> byte offset) points while it reads a file sequentially
+ and uses them on the next opens to jump right to the frame before the seek position.
+The points are stored in "{user_path}/seekidx/{hash}.idx",
+ where the hash is made of the file name, its size and modification time.
+The file is rewritten on close only if new points were added:
+ the data is written to "{hash}.idx.tmp" which is then renamed, so a reader never sees a partial file.
+After saving, the least recently written files are deleted if there are too many of them.
+Used by .aac and .mp3 readers.
+*/
+
+#include <fmedia.h>
+
+
+struct seekidx_pt {
+	uint64 sample;
+	uint64 off;
+};
+
+typedef struct seekidx {
+	char *fn; // index file name;  NULL: index is disabled
+	ffarr pts; // struct seekidx_pt[]
+	uint64 fsize;
+	uint64 mtime;
+	uint sample_rate;
+	uint interval; // min. number of samples between points
+	uint modified :1;
+} seekidx;
+
+/** Open the index for the track's input file and load the points stored earlier.
+Return 0 if the index is usable. */
+extern int seekidx_open(seekidx *si, fmed_filt *d, uint sample_rate);
+
+/** Write the new points to disk and free the index. */
+extern void seekidx_close(seekidx *si, void *trk);
+
+/** Add the point for the frame starting at 'off'.
+Points are added only in ascending order, at least 'interval' samples apart. */
+extern void seekidx_add(seekidx *si, uint64 sample, uint64 off);
+
+/** Find the last point before or at 'sample'.
+Return NULL if there's none. */
+extern const struct seekidx_pt* seekidx_find(seekidx *si, uint64 sample);
@@ -205,6 +205,7 @@ static void list_dispinfo(struct ffui_view_disp *disp)
 	ent = (fmed_que_entry*)gg->qu->fmed_queue_item_locked(-1, disp->idx);
 	if (ent == NULL)
 		return;
+	gg->qu->cmdv(FMED_QUE_SET_VISIBLE, (size_t)disp->idx);
 
 	switch (sub) {
 	case H_IDX:
@@ -236,7 +237,8 @@ static void list_dispinfo(struct ffui_view_disp *disp)
 			ffs_fmt(buf, buf + sizeof(buf), "%u:%02u%Z", sec / 60, sec % 60);
 			val = &s;
 			ffstr_setz(val, buf);
-		}
+		} else if (val == NULL)
+			gg->qu->cmd2(FMED_QUE_EXPAND, ent, 1); // the row will be updated
 		break;
 	}
 
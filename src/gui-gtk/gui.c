@@ -665,7 +665,7 @@ static void lists_save(void)
 	for (uint i = 0; ; i++) {
 		buf.len = 0;
 		ffstr_catfmt(&buf, "%s" AUTOPLIST_FN "%Z", fn, n++);
-		int r = gg->qu->fmed_queue_save(i, buf.ptr);
+		int r = gg->qu->fmed_queue_save_snap(i, buf.ptr);
 		if (r != 0) {
 			fffile_rm(buf.ptr);
 			break;
@@ -691,13 +691,18 @@ static void lists_load(void)
 		buf.len--;
 		if (!fffile_exists(buf.ptr))
 			break;
+		int plid = -1;
 		if (i != 1) {
 			gg->qu->cmdv(FMED_QUE_NEW, 0);
 			wmain_tab_new();
-			list_add((ffstr*)&buf, i - 1);
-		} else {
-			list_add((ffstr*)&buf, -1);
+			plid = i - 1;
 		}
+		if (0 == gg->qu->fmed_queue_load_snap(plid, buf.ptr)) {
+			if (plid == -1)
+				wmain_list_update(0, gg->qu->cmdv(FMED_QUE_COUNT));
+			continue;
+		}
+		list_add((ffstr*)&buf, plid);
 	}
 
 end:
@@ -945,6 +950,10 @@ static void gui_que_onchange(fmed_que_entry *ent, uint flags)
 
 	case FMED_QUE_ONCLEAR:
 		break;
+
+	case FMED_QUE_ONUPDATE:
+		wmain_list_update(0, 0);
+		break;
 	}
 }
 
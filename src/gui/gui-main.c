@@ -202,6 +202,7 @@ static void list_setdata(void)
 	ent = (fmed_que_entry*)gg->qu->fmed_queue_item_locked(-1, it->iItem);
 	if (ent == NULL)
 		return;
+	gg->qu->cmdv(FMED_QUE_SET_VISIBLE, (size_t)it->iItem);
 
 	switch (it->iSubItem) {
 
@@ -237,7 +238,8 @@ static void list_setdata(void)
 			n = ffs_fmt(buf, buf + sizeof(buf), "%u:%02u", sec / 60, sec % 60);
 			ffstr_set(&s, buf, n);
 			val = &s;
-		}
+		} else if (val == NULL)
+			gg->qu->cmd2(FMED_QUE_EXPAND, ent, 1); // the row will be updated
 		break;
 
 	case H_INF:
@@ -1043,49 +1045,30 @@ static void gui_filt_show(void)
 
 void gui_filter(const ffstr *text, uint flags)
 {
-	fmed_que_entry *e = NULL;
-	ffstr *meta, name;
-	uint nfilt = 0, nall = 0, inc;
+	ssize_t nfilt = 0;
+	uint nall, qflags = 0;
 
 	if (!gg->list_filter && text->len < 2)
 		return; //too small filter text
 
-	gg->qu->cmdv(FMED_QUE_NEW_FILTERED);
+	nall = gg->qu->cmdv(FMED_QUE_COUNT);
 
 	ffui_redraw(&gg->wmain.vlist, 0);
 	ffui_view_clear(&gg->wmain.vlist);
 
-	for (;;) {
-
-		if (0 == gg->qu->cmd2(FMED_QUE_LIST_NOFILTER, &e, 0))
-			break;
-		inc = 0;
-
-		if (text->len == 0)
-			inc = 1;
-
-		else if ((flags & GUI_FILT_URL) && -1 != ffstr_ifind(&e->url, text->ptr, text->len))
-			inc = 1;
-
-		else if (flags & GUI_FILT_META) {
-
-			for (uint i = 0;  NULL != (meta = gg->qu->meta(e, i, &name, 0));  i++) {
-				if (meta == FMED_QUE_SKIP)
-					continue;
-				if (-1 != ffstr_ifind(meta, text->ptr, text->len)) {
-					inc = 1;
-					break;
-				}
-			}
-		}
-
-		if (inc) {
-			gg->qu->cmdv(FMED_QUE_ADD_FILTERED, e);
-			gui_media_added(e);
-			nfilt++;
-		}
+	if (text->len == 0) {
+		gg->qu->cmdv(FMED_QUE_DEL_FILTERED);
+		list_update(0, nall);
 
-		nall++;
+	} else {
+		if (flags & GUI_FILT_URL)
+			qflags |= FMED_QUE_SEARCH_URL;
+		if (flags & GUI_FILT_META)
+			qflags |= FMED_QUE_SEARCH_META;
+		nfilt = gg->qu->cmdv(FMED_QUE_SEARCH, text, qflags);
+		if (nfilt < 0)
+			nfilt = 0;
+		list_update(0, nfilt);
 	}
 
 	ffui_redraw(&gg->wmain.vlist, 1);
@@ -1093,10 +1076,9 @@ void gui_filter(const ffstr *text, uint flags)
 	gg->list_filter = (text->len != 0);
 	if (text->len != 0) {
 		char buf[128];
-		size_t n = ffs_fmt(buf, buf + sizeof(buf), "Filter: %u (%u)", nfilt, nall);
+		size_t n = ffs_fmt(buf, buf + sizeof(buf), "Filter: %L (%u)", (size_t)nfilt, nall);
 		gui_status(buf, n);
 	} else {
-		gg->qu->cmdv(FMED_QUE_DEL_FILTERED);
 		gui_status(NULL, 0);
 	}
 }
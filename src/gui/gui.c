@@ -567,6 +567,10 @@ static void gui_que_onchange(fmed_que_entry *e, uint flags)
 		ffui_view_clear(&gg->wmain.vlist);
 		ffui_view_redraw(&gg->wmain.vlist, 0, 0);
 		break;
+
+	case FMED_QUE_ONUPDATE:
+		ffui_redraw(&gg->wmain.vlist, 1);
+		break;
 	}
 }
 
@@ -838,7 +842,7 @@ static void gui_savelists(void)
 			break;
 		}
 
-		gg->qu->fmed_queue_save(i, buf.ptr);
+		gg->qu->fmed_queue_save_snap(i, buf.ptr);
 	}
 
 end:
@@ -861,6 +865,10 @@ static void gui_loadlists(void)
 			break;
 		if (i != 1)
 			gui_que_new();
+		if (0 == gg->qu->fmed_queue_load_snap(-1, buf.ptr)) {
+			list_update(0, gg->qu->cmdv(FMED_QUE_COUNT));
+			continue;
+		}
 		gui_media_add1(buf.ptr);
 	}
 
@@ -18,10 +18,26 @@ Copyright (c) 2015 Simon Zolin */
 
 #define FMED_CMDHELP_FILE_FMT  "help%s.txt"
 
+/** Segment-parallel conversion of a single input (--parallel-segments). */
+struct segs {
+	fftask tsk;
+	char *in;
+	char *out;
+	fmed_trk trkinfo;
+	fmed_trk *probe; // track that reads input's header
+	uint64 total; //samples
+	uint rate;
+	uint n;
+	char **parts; //char*[n]: output files for segments #1..n-1 (#0..n-1 for .flac)
+	uint raw :1; // output is .raw: parts are joined as is
+	uint flac :1; // output is .flac: all parts are written to temporary files, frames are renumbered
+};
+
 struct gctx {
 	ffsignal sigs_task;
 	fmed_cmd *cmd;
 	void *rec_trk;
+	struct segs *segs;
 	const fmed_track *track;
 	const fmed_queue *qu;
 	uint psexit; //process exit code
@@ -58,6 +74,9 @@ static void rec_lpback_new_track(fmed_cmd *cmd);
 
 // TRACK MONITOR
 static void mon_onsig(fmed_trk *trk, uint sig);
+static int segs_probe(fmed_cmd *fmed, const fmed_trk *trkinfo);
+static void segs_start(void *udata);
+static void segs_fin(struct segs *s);
 static const struct fmed_trk_mon mon_iface = { &mon_onsig };
 
 //LOG
@@ -142,6 +161,7 @@ static const ffpars_arg fmed_cmdline_args[] = {
 	{ "help",	FFPARS_SETVAL('h') | FFPARS_TBOOL | FFPARS_FALONE,  FFPARS_DST(&fmed_arg_usage) },
 	{ "cue-gaps",	FFPARS_TINT8,  OFF(cue_gaps) },
 	{ "parallel",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(parallel) },
+	{ "parallel-segments",	FFPARS_TINT8,  OFF(parallel_segments) },
 
 	//INSTALL
 	{ "install",	FFPARS_TBOOL | FFPARS_FALONE,  FFPARS_DST(&fmed_arg_install) },
@@ -647,11 +667,25 @@ static void mon_onsig(fmed_trk *trk, uint sig)
 
 		if (trk->err)
 			g->psexit = 1;
+
+		if (g->segs != NULL && trk == g->segs->probe) {
+			g->segs->probe = NULL;
+			if (!trk->err) {
+				g->segs->total = trk->audio.total;
+				g->segs->rate = trk->audio.fmt.sample_rate;
+			}
+			fftask_set(&g->segs->tsk, &segs_start, g->segs);
+			core->task(&g->segs->tsk, FMED_TASK_POST);
+		}
 		break;
 
 	case FMED_TRK_ONLAST:
 		if (g->cmd->gui)
 			break;
+		if (g->segs != NULL) {
+			segs_fin(g->segs);
+			g->segs = NULL;
+		}
 		if (g->rec_trk != NULL) {
 			if (g->cmd->until_plback_end)
 				g->track->cmd(g->rec_trk, FMED_TRACK_STOP);
@@ -825,6 +859,12 @@ static void open_input(void *udata)
 	track->copy_info(&trkinfo, NULL);
 	trk_prep(fmed, &trkinfo);
 
+	if (fmed->parallel_segments > 1
+		&& 0 == segs_probe(fmed, &trkinfo)) {
+		FFARR_FREE_ALL_PTR(&fmed->in_files, ffmem_free, char*);
+		return;
+	}
+
 	FFARR_WALKT(&fmed->in_files, pfn, char*) {
 
 #ifdef FF_WIN
@@ -905,6 +945,857 @@ end:
 	return;
 }
 
+enum {
+	SEGS_MINLEN = 1000, //msec
+	SEGS_BUF = 64 * 1024,
+};
+
+static void segs_free(struct segs *s)
+{
+	if (s->parts != NULL) {
+		for (uint i = 0;  i != s->n;  i++) {
+			ffmem_safefree(s->parts[i]);
+		}
+		ffmem_free(s->parts);
+	}
+	ffmem_safefree(s->in);
+	ffmem_safefree(s->out);
+	ffmem_free(s);
+}
+
+/** Check whether the input file can be converted by segments in parallel and start a track that reads its header.
+Return 0 if the segments will be started when the header is read. */
+static int segs_probe(fmed_cmd *fmed, const fmed_trk *trkinfo)
+{
+	struct segs *s;
+	ffstr name, ext;
+	void *trk;
+
+	if (fmed->in_files.len != 1 || fmed->outfn.len == 0
+		|| fmed->out_copy || fmed->rec || fmed->mix || fmed->gui
+		|| fmed->seek_time != 0 || fmed->until_time != 0 || fmed->split_time != 0 || fmed->fseek != 0) {
+		warnlog(core, NULL, "core", "--parallel-segments: must be used with 1 input file and --out, without --seek, --until, --split");
+		return 1;
+	}
+
+	const char *fn = *(char**)fmed->in_files.ptr;
+	ffpath_split3(fn, ffsz_len(fn), NULL, NULL, &ext);
+	if (!(ffstr_ieqz(&ext, "wav") || ffstr_ieqz(&ext, "flac") || ffstr_ieqz(&ext, "raw"))) {
+		warnlog(core, NULL, "core", "--parallel-segments: supported input formats: .wav, .flac, .raw");
+		return 1;
+	}
+
+	ffbool have_path = (NULL != ffpath_split3(fmed->outfn.ptr, fmed->outfn.len, NULL, &name, &ext));
+	ffbool raw = ffstr_ieqz(&ext, "raw");
+	ffbool flac = ffstr_ieqz(&ext, "flac");
+	if (!(ffstr_ieqz(&ext, "wav") || raw || flac)
+		|| (!have_path && ffstr_eqcz(&name, "@stdout"))
+		|| ffarr_end(&fmed->outfn) != ffs_find(fmed->outfn.ptr, fmed->outfn.len, '$')) {
+		warnlog(core, NULL, "core", "--parallel-segments: output must be a .wav, .flac or .raw file with a constant name");
+		return 1;
+	}
+
+	if (NULL == (s = ffmem_new(struct segs)))
+		return 1;
+	s->n = fmed->parallel_segments;
+	s->raw = raw;
+	s->flac = flac;
+	s->trkinfo = *trkinfo;
+	if (NULL == (s->in = ffsz_alcopyz(fn))
+		|| NULL == (s->out = ffsz_alcopystr(&fmed->outfn)))
+		goto err;
+
+	if (flac && !fmed->overwrite && fffile_exists(s->out)) {
+		// the output file is created only after all parts are converted: fail early
+		warnlog(core, NULL, "core", "--parallel-segments: %s: file exists", s->out);
+		goto err;
+	}
+
+	trk = g->track->create(FMED_TRK_TYPE_EXPAND, s->in);
+	if (trk == NULL || trk == FMED_TRK_EFMT)
+		goto err;
+	fmed_trk *t = g->track->conf(trk);
+	t->input_info = 1;
+	s->probe = t;
+	g->segs = s;
+	g->track->cmd(trk, FMED_TRACK_START);
+	return 0;
+
+err:
+	segs_free(s);
+	return 1;
+}
+
+static uint segs_gcd(uint a, uint b)
+{
+	while (b != 0) {
+		uint t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/** Add segments of the input file to the queue and start them in parallel.
+Part #0 is written directly to the output file (except .flac), the others - to temporary files.
+Thread: main. */
+static void segs_start(void *udata)
+{
+	struct segs *s = udata;
+	fmed_cmd *fmed = g->cmd;
+	const fmed_queue *qu = g->qu;
+	fmed_que_entry e, *qe, *first = NULL;
+	uint64 dur = 0;
+	uint n, unit;
+
+	if (g->psexit)
+		goto err;
+
+	if ((int64)s->total != FMED_NULL && s->total != 0 && s->rate != 0)
+		dur = ffpcm_time(s->total, s->rate);
+	n = ffmin(s->n, dur / SEGS_MINLEN);
+
+	if (n < 2) {
+		// the input is too short or its length is unknown: convert as usual
+		dbglog(core, NULL, "core", "--parallel-segments: not splitting input of %U msec", dur);
+		ffmem_tzero(&e);
+		ffstr_setz(&e.url, s->in);
+		if (NULL == (qe = qu->add(&e)))
+			goto err;
+		qu->cmdv(FMED_QUE_SETTRACKPROPS, qe, &s->trkinfo);
+		qu_setprops(fmed, qu, qe);
+		g->segs = NULL;
+		segs_free(s);
+		qu->cmd(FMED_QUE_PLAY, qe);
+		return;
+	}
+
+	// segment boundaries must fall on whole samples: msec * rate / 1000
+	unit = 1000 / segs_gcd(s->rate, 1000);
+
+	if (NULL == (s->parts = ffmem_callocT(n, char*)))
+		goto err;
+	s->n = n;
+	fmed_trk ti = s->trkinfo;
+	ti.out_overwrite = 1;
+
+	for (uint i = 0;  i != n;  i++) {
+		ffmem_tzero(&e);
+		ffstr_setz(&e.url, s->in);
+		e.from = dur * i / n / unit * unit;
+		if (i + 1 != n)
+			e.to = dur * (i + 1) / n / unit * unit;
+		if (NULL == (qe = qu->add(&e)))
+			goto err;
+
+		if (i == 0)
+			first = qe;
+
+		if (i == 0 && !s->flac) {
+			qu->cmdv(FMED_QUE_SETTRACKPROPS, qe, &s->trkinfo);
+			qu_setprops(fmed, qu, qe);
+			continue;
+		}
+
+		const char *ext = (s->raw) ? "raw" : (s->flac) ? "flac" : "wav";
+		if (NULL == (s->parts[i] = ffsz_alfmt("%s.part%u.%s", s->out, i, ext)))
+			goto err;
+		qu->cmdv(FMED_QUE_SETTRACKPROPS, qe, &ti);
+		qu_setprops(fmed, qu, qe);
+		qu->meta_set(qe, FFSTR("output"), s->parts[i], ffsz_len(s->parts[i]), FMED_QUE_TRKDICT | FMED_QUE_OVWRITE);
+	}
+
+	dbglog(core, NULL, "core", "--parallel-segments: %u segments of %U msec", n, dur / n);
+	core->props->parallel = 1;
+	qu->cmdv(FMED_QUE_XPLAY, first);
+	return;
+
+err:
+	g->segs = NULL;
+	segs_free(s);
+	g->psexit = 1;
+	core->sig(FMED_STOP);
+}
+
+static uint le32(const byte *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+static void le32_set(byte *p, uint val)
+{
+	p[0] = (byte)val;
+	p[1] = (byte)(val >> 8);
+	p[2] = (byte)(val >> 16);
+	p[3] = (byte)(val >> 24);
+}
+
+/** Find "data" chunk in .wav file.
+@off: offset of chunk data
+@size: size of chunk data */
+static int wav_datachunk(fffd f, uint64 *off, uint *size)
+{
+	byte buf[12];
+	uint64 pos = sizeof(buf);
+
+	if (sizeof(buf) != fffile_read(f, buf, sizeof(buf))
+		|| ffs_cmp(buf, "RIFF", 4) || ffs_cmp(buf + 8, "WAVE", 4))
+		return -1;
+
+	for (;;) {
+		if (8 != fffile_read(f, buf, 8))
+			return -1;
+		uint n = le32(buf + 4);
+		pos += 8;
+		if (!ffs_cmp(buf, "data", 4)) {
+			*off = pos;
+			*size = n;
+			return 0;
+		}
+		pos += n + (n & 1);
+		if (0 > fffile_seek(f, pos, SEEK_SET))
+			return -1;
+	}
+}
+
+/** Append the parts to the output .raw file. */
+static int segs_stitch_raw(struct segs *s)
+{
+	fffd f, fp = FF_BADFD;
+	ssize_t r;
+	uint64 total = 0;
+	byte *buf = NULL;
+	const char *fn = s->out;
+	int rc = -1;
+
+	if (FF_BADFD == (f = fffile_open(s->out, FFO_RDWR))) {
+		syserrlog(core, NULL, "core", "%s: %s", fffile_open_S, s->out);
+		return -1;
+	}
+	if (0 > fffile_seek(f, 0, SEEK_END))
+		goto syserr;
+
+	if (NULL == (buf = ffmem_alloc(SEGS_BUF))) {
+		syserrlog(core, NULL, "core", "%s", ffmem_alloc_S);
+		goto done;
+	}
+
+	for (uint i = 1;  i != s->n;  i++) {
+		fn = s->parts[i];
+		if (FF_BADFD == (fp = fffile_open(fn, FFO_RDONLY | FFO_NOATIME)))
+			goto syserr;
+
+		for (;;) {
+			if (0 > (r = fffile_read(fp, buf, SEGS_BUF)))
+				goto syserr;
+			if (r == 0)
+				break;
+			if (r != fffile_write(f, buf, r)) {
+				fn = s->out;
+				goto syserr;
+			}
+			total += r;
+		}
+
+		fffile_close(fp);
+		fp = FF_BADFD;
+	}
+
+	dbglog(core, NULL, "core", "--parallel-segments: stitched %u parts, appended: %U bytes", s->n, total);
+	rc = 0;
+	goto done;
+
+syserr:
+	syserrlog(core, NULL, "core", "%s", fn);
+
+done:
+	ffmem_safefree(buf);
+	if (fp != FF_BADFD)
+		fffile_close(fp);
+	fffile_close(f);
+	return rc;
+}
+
+/** Append audio data from the parts to the output .wav file and update its header. */
+static int segs_stitch(struct segs *s)
+{
+	fffd f, fp = FF_BADFD;
+	uint64 off, end, poff;
+	uint size, psize;
+	ssize_t r;
+	byte *buf = NULL, le[4];
+	const char *fn = s->out;
+	int rc = -1;
+
+	if (FF_BADFD == (f = fffile_open(s->out, FFO_RDWR))) {
+		syserrlog(core, NULL, "core", "%s: %s", fffile_open_S, s->out);
+		return -1;
+	}
+	if (0 != wav_datachunk(f, &off, &size))
+		goto badhdr;
+	end = off + size;
+	if (0 > fffile_seek(f, end, SEEK_SET))
+		goto syserr;
+
+	if (NULL == (buf = ffmem_alloc(SEGS_BUF))) {
+		syserrlog(core, NULL, "core", "%s", ffmem_alloc_S);
+		goto done;
+	}
+
+	for (uint i = 1;  i != s->n;  i++) {
+		fn = s->parts[i];
+		if (FF_BADFD == (fp = fffile_open(fn, FFO_RDONLY | FFO_NOATIME)))
+			goto syserr;
+		if (0 != wav_datachunk(fp, &poff, &psize))
+			goto badhdr;
+		if (0 > fffile_seek(fp, poff, SEEK_SET))
+			goto syserr;
+
+		for (uint64 n = psize;  n != 0;  n -= r) {
+			if (0 > (r = fffile_read(fp, buf, ffmin(n, SEGS_BUF))))
+				goto syserr;
+			if (r == 0)
+				break;
+			if (r != fffile_write(f, buf, r)) {
+				fn = s->out;
+				goto syserr;
+			}
+			end += r;
+		}
+
+		fffile_close(fp);
+		fp = FF_BADFD;
+	}
+
+	fn = s->out;
+	if (end - off > 0xffffffff) {
+		errlog(core, NULL, "core", "%s: audio data is too large for .wav", fn);
+		goto done;
+	}
+	size = end - off;
+	if (size & 1) {
+		// chunk must be padded to an even size
+		le[0] = 0;
+		if (1 != fffile_write(f, le, 1))
+			goto syserr;
+		end++;
+	}
+	if (0 != fffile_trunc(f, end))
+		goto syserr;
+
+	le32_set(le, size);
+	if (0 > fffile_seek(f, off - 4, SEEK_SET)
+		|| 4 != fffile_write(f, le, 4))
+		goto syserr;
+	le32_set(le, end - 8);
+	if (0 > fffile_seek(f, 4, SEEK_SET)
+		|| 4 != fffile_write(f, le, 4))
+		goto syserr;
+
+	dbglog(core, NULL, "core", "--parallel-segments: stitched %u parts, audio data: %u bytes", s->n, size);
+	rc = 0;
+	goto done;
+
+badhdr:
+	errlog(core, NULL, "core", "%s: unsupported .wav header", fn);
+	goto done;
+
+syserr:
+	syserrlog(core, NULL, "core", "%s", fn);
+
+done:
+	ffmem_safefree(buf);
+	if (fp != FF_BADFD)
+		fffile_close(fp);
+	fffile_close(f);
+	return rc;
+}
+
+/* FLAC stitching.
+Each part is a complete FLAC stream: its frames use fixed block size and are numbered from 0,
+ and its last frame may be shorter.  Such streams can't be concatenated as is,
+ so all frames are converted to variable block size, where a frame header contains the number of its first sample.
+The frame header is rebuilt and CRC-8, CRC-16 are recomputed; audio data is copied as is.
+Metadata blocks are taken from part #0:
+ STREAMINFO is updated for the whole stream (MD5 becomes unknown),
+ SEEKTABLE is turned into PADDING because the frame offsets have changed.
+The end of a frame is the position where CRC-16 of the frame data is 0 and either the file ends
+ or the next valid frame header begins. */
+
+enum {
+	FLAC_HDR_MAX = 16, //max. length of frame header
+	FLAC_SI_LEN = 34, //STREAMINFO
+	FLAC_PADDING = 1,
+	FLAC_SEEKTABLE = 3,
+};
+
+static ushort flac_crc16tab[256];
+
+static void flac_crc16_init(void)
+{
+	for (uint i = 0;  i != 256;  i++) {
+		uint crc = i << 8;
+		for (uint k = 0;  k != 8;  k++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+		flac_crc16tab[i] = (ushort)crc;
+	}
+}
+
+static uint flac_crc16(uint crc, const byte *d, size_t n)
+{
+	for (size_t i = 0;  i != n;  i++)
+		crc = ((crc << 8) ^ flac_crc16tab[(crc >> 8) ^ d[i]]) & 0xffff;
+	return crc;
+}
+
+static uint flac_crc8(const byte *d, size_t n)
+{
+	uint crc = 0;
+	for (size_t i = 0;  i != n;  i++) {
+		crc ^= d[i];
+		for (uint k = 0;  k != 8;  k++)
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) & 0xff : (crc << 1) & 0xff;
+	}
+	return crc;
+}
+
+struct flac_fhdr {
+	uint len; //header length, including CRC-8
+	uint numlen; //length of the coded frame/sample number
+	uint extlen; //length of block size and sample rate values following the number
+	uint samples;
+};
+
+/** Parse frame header.
+Return 0 if it's not a valid header. */
+static int flac_fhdr(const byte *d, size_t n, struct flac_fhdr *h)
+{
+	static const byte numlens[] = { 2,2,2,2, 3,3, 4, 5 }; //by the bits 3..5 of 0b11xxxxxx
+	uint bsc, src, i, numlen, ext = 0;
+
+	if (n < 6 || d[0] != 0xff || (d[1] & 0xfe) != 0xf8)
+		return 0;
+	bsc = d[2] >> 4;
+	src = d[2] & 0x0f;
+	if (bsc == 0 || src == 15 || (d[3] >> 4) >= 11 || (d[3] & 1))
+		return 0;
+
+	if (d[4] < 0x80)
+		numlen = 1;
+	else if (d[4] == 0xfe)
+		numlen = 7;
+	else if ((d[4] & 0xc0) == 0xc0 && d[4] != 0xff)
+		numlen = ((d[4] & 0xfc) == 0xfc) ? 6 : numlens[(d[4] >> 3) & 7];
+	else
+		return 0;
+	if (n < 4 + numlen)
+		return 0;
+	for (i = 1;  i != numlen;  i++) {
+		if ((d[4 + i] & 0xc0) != 0x80)
+			return 0;
+	}
+
+	i = 4 + numlen;
+	if (bsc == 6 || bsc == 7)
+		ext = bsc - 5;
+	if (src == 12)
+		ext += 1;
+	else if (src == 13 || src == 14)
+		ext += 2;
+	if (n < i + ext + 1
+		|| flac_crc8(d, i + ext) != d[i + ext])
+		return 0;
+
+	if (h == NULL)
+		return 1;
+	h->len = i + ext + 1;
+	h->numlen = numlen;
+	h->extlen = ext;
+	if (bsc == 1)
+		h->samples = 192;
+	else if (bsc <= 5)
+		h->samples = 576 << (bsc - 2);
+	else if (bsc == 6)
+		h->samples = d[i] + 1;
+	else if (bsc == 7)
+		h->samples = ((d[i] << 8) | d[i + 1]) + 1;
+	else
+		h->samples = 256 << (bsc - 8);
+	return 1;
+}
+
+/** Write frame header for variable block size mode.
+Return header length. */
+static uint flac_fhdr_write(byte *dst, const byte *src, const struct flac_fhdr *h, uint64 sample)
+{
+	uint i, n;
+
+	dst[0] = 0xff;
+	dst[1] = 0xf9;
+	dst[2] = src[2];
+	dst[3] = src[3];
+
+	// UTF-8-like coding of a 36-bit number
+	if (sample < 0x80) {
+		dst[4] = (byte)sample;
+		n = 1;
+	} else {
+		for (n = 2;  n != 7;  n++) {
+			if (sample < (1ULL << (5 * n + 1)))
+				break;
+		}
+		for (i = n - 1;  i != 0;  i--) {
+			dst[4 + i] = 0x80 | (sample & 0x3f);
+			sample >>= 6;
+		}
+		dst[4] = ((0xff00 >> n) & 0xff) | (byte)sample;
+	}
+
+	i = 4 + n;
+	ffmemcpy(dst + i, src + 4 + h->numlen, h->extlen);
+	i += h->extlen;
+	dst[i] = flac_crc8(dst, i);
+	return i + 1;
+}
+
+struct flac_rd {
+	fffd f;
+	byte *buf;
+	size_t cap, off, len;
+	uint eof :1;
+};
+
+/** Make at least 'need' bytes available at buf+off, unless the file ends earlier. */
+static int flac_rd_fill(struct flac_rd *rd, size_t need)
+{
+	ssize_t r;
+
+	if (rd->len - rd->off >= need || rd->eof)
+		return 0;
+
+	if (rd->off != 0) {
+		memmove(rd->buf, rd->buf + rd->off, rd->len - rd->off);
+		rd->len -= rd->off;
+		rd->off = 0;
+	}
+
+	if (need > rd->cap) {
+		size_t cap = ffmax(need, ffmax(rd->cap * 2, SEGS_BUF));
+		byte *p;
+		if (NULL == (p = ffmem_realloc(rd->buf, cap)))
+			return -1;
+		rd->buf = p;
+		rd->cap = cap;
+	}
+
+	while (rd->len < need) {
+		if (0 > (r = fffile_read(rd->f, rd->buf + rd->len, rd->cap - rd->len)))
+			return -1;
+		if (r == 0) {
+			rd->eof = 1;
+			break;
+		}
+		rd->len += r;
+	}
+	return 0;
+}
+
+struct flac_wr {
+	fffd f;
+	byte *buf;
+	size_t len;
+	uint64 off; //output file offset
+};
+
+static int flac_wr_flush(struct flac_wr *w)
+{
+	if (w->len != 0 && w->len != (size_t)fffile_write(w->f, w->buf, w->len))
+		return -1;
+	w->len = 0;
+	return 0;
+}
+
+static int flac_write(struct flac_wr *w, const void *data, size_t n)
+{
+	if (w->len + n > SEGS_BUF && 0 != flac_wr_flush(w))
+		return -1;
+	if (n >= SEGS_BUF) {
+		if (n != (size_t)fffile_write(w->f, data, n))
+			return -1;
+	} else {
+		ffmemcpy(w->buf + w->len, data, n);
+		w->len += n;
+	}
+	w->off += n;
+	return 0;
+}
+
+struct flac_stitch {
+	struct flac_rd rd;
+	struct flac_wr wr;
+	byte si[FLAC_SI_LEN]; //STREAMINFO of part #0
+	uint64 si_off; //output offset of STREAMINFO data
+	uint64 total; //samples
+	uint frames;
+	uint minbs, maxbs, prevbs;
+	uint minfs, maxfs;
+};
+
+/** Read the metadata blocks of a part.
+Part #0: copy them to the output. */
+static int flac_meta(struct flac_stitch *fs, uint ipart, const char *fn)
+{
+	struct flac_rd *rd = &fs->rd;
+	byte si[FLAC_SI_LEN];
+	uint last, type, len, bi = 0;
+
+	if (0 != flac_rd_fill(rd, 4))
+		return -1;
+	if (rd->len - rd->off < 4 || ffs_cmp(rd->buf + rd->off, "fLaC", 4))
+		goto bad;
+	if (ipart == 0 && 0 != flac_write(&fs->wr, "fLaC", 4))
+		return -1;
+	rd->off += 4;
+
+	do {
+		if (0 != flac_rd_fill(rd, 4))
+			return -1;
+		if (rd->len - rd->off < 4)
+			goto bad;
+		byte *d = rd->buf + rd->off;
+		last = d[0] & 0x80;
+		type = d[0] & 0x7f;
+		len = (d[1] << 16) | (d[2] << 8) | d[3];
+		if (bi == 0 && (type != 0 || len != FLAC_SI_LEN))
+			goto bad;
+		if (ipart == 0) {
+			if (type == FLAC_SEEKTABLE)
+				d[0] = last | FLAC_PADDING;
+			if (0 != flac_write(&fs->wr, d, 4))
+				return -1;
+			if (bi == 0)
+				fs->si_off = fs->wr.off;
+		}
+		rd->off += 4;
+
+		while (len != 0) {
+			uint n = ffmin(len, SEGS_BUF);
+			if (0 != flac_rd_fill(rd, n))
+				return -1;
+			if (rd->len - rd->off < n)
+				goto bad;
+			d = rd->buf + rd->off;
+			if (bi == 0)
+				ffmemcpy(si, d, FLAC_SI_LEN);
+			if (ipart == 0) {
+				if (type == FLAC_SEEKTABLE)
+					ffmem_zero(d, n);
+				if (0 != flac_write(&fs->wr, d, n))
+					return -1;
+			}
+			rd->off += n;
+			len -= n;
+		}
+		bi++;
+	} while (!last);
+
+	// sample rate, channels, bits per sample must be the same in all parts
+	if (ipart == 0)
+		ffmemcpy(fs->si, si, FLAC_SI_LEN);
+	else if (ffs_cmp(si + 10, fs->si + 10, 3) || (si[13] & 0xf0) != (fs->si[13] & 0xf0)) {
+		errlog(core, NULL, "core", "%s: audio format differs from part #0", fn);
+		return -2;
+	}
+	return 0;
+
+bad:
+	errlog(core, NULL, "core", "%s: unsupported FLAC header", fn);
+	return -2;
+}
+
+/** Convert the frames of a part and append them to the output. */
+static int flac_frames(struct flac_stitch *fs, const char *fn)
+{
+	struct flac_rd *rd = &fs->rd;
+	struct flac_fhdr h;
+	byte hdr[FLAC_HDR_MAX];
+	size_t p;
+	uint crc, hlen;
+
+	for (;;) {
+		if (0 != flac_rd_fill(rd, FLAC_HDR_MAX))
+			return -1;
+		if (rd->len == rd->off)
+			break;
+		if (!flac_fhdr(rd->buf + rd->off, rd->len - rd->off, &h))
+			goto bad;
+
+		// find the end of frame
+		crc = flac_crc16(0, rd->buf + rd->off, h.len);
+		p = h.len;
+		for (;;) {
+			if (rd->len - rd->off < p + FLAC_HDR_MAX && !rd->eof) {
+				if (0 != flac_rd_fill(rd, p + FLAC_HDR_MAX + SEGS_BUF))
+					return -1;
+				continue;
+			}
+			const byte *d = rd->buf + rd->off;
+			size_t n = rd->len - rd->off;
+			if (p == n) {
+				if (crc != 0)
+					goto bad;
+				break;
+			}
+			if (crc == 0 && p >= h.len + 2
+				&& d[p] == 0xff && flac_fhdr(d + p, n - p, NULL))
+				break;
+			crc = ((crc << 8) ^ flac_crc16tab[(crc >> 8) ^ d[p]]) & 0xffff;
+			p++;
+		}
+
+		if (fs->frames != 0) {
+			fs->minbs = ffmin(fs->minbs, fs->prevbs);
+			fs->maxbs = ffmax(fs->maxbs, fs->prevbs);
+		}
+		fs->prevbs = h.samples;
+
+		const byte *d = rd->buf + rd->off;
+		hlen = flac_fhdr_write(hdr, d, &h, fs->total);
+		size_t body = p - h.len - 2;
+		crc = flac_crc16(0, hdr, hlen);
+		crc = flac_crc16(crc, d + h.len, body);
+		byte be[2] = { (byte)(crc >> 8), (byte)crc };
+		if (0 != flac_write(&fs->wr, hdr, hlen)
+			|| 0 != flac_write(&fs->wr, d + h.len, body)
+			|| 0 != flac_write(&fs->wr, be, 2))
+			return -1;
+
+		uint fsize = hlen + body + 2;
+		fs->minfs = ffmin(fs->minfs, fsize);
+		fs->maxfs = ffmax(fs->maxfs, fsize);
+		fs->total += h.samples;
+		fs->frames++;
+		rd->off += p;
+	}
+	return 0;
+
+bad:
+	errlog(core, NULL, "core", "%s: bad FLAC frame at sample %U", fn, fs->total);
+	return -2;
+}
+
+/** Write the output .flac file from the parts. */
+static int segs_stitch_flac(struct segs *s)
+{
+	struct flac_stitch fs = {};
+	const char *fn = s->out;
+	int r, rc = -1;
+	uint flags = (s->trkinfo.out_overwrite) ? FFO_CREATE | FFO_TRUNC : FFO_CREATENEW;
+
+
+	fs.rd.f = FF_BADFD;
+	fs.minbs = fs.minfs = (uint)-1;
+	flac_crc16_init();
+
+	if (FF_BADFD == (fs.wr.f = fffile_open(s->out, flags | FFO_WRONLY))) {
+		syserrlog(core, NULL, "core", "%s: %s", fffile_open_S, s->out);
+		return -1;
+	}
+	if (NULL == (fs.wr.buf = ffmem_alloc(SEGS_BUF))) {
+		syserrlog(core, NULL, "core", "%s", ffmem_alloc_S);
+		goto done;
+	}
+
+	for (uint i = 0;  i != s->n;  i++) {
+		fn = s->parts[i];
+		if (FF_BADFD == (fs.rd.f = fffile_open(fn, FFO_RDONLY | FFO_NOATIME)))
+			goto syserr;
+		fs.rd.off = fs.rd.len = 0;
+		fs.rd.eof = 0;
+
+		if (0 != (r = flac_meta(&fs, i, fn))
+			|| 0 != (r = flac_frames(&fs, fn))) {
+			if (r == -2)
+				goto done;
+			goto syserr;
+		}
+
+		fffile_close(fs.rd.f);
+		fs.rd.f = FF_BADFD;
+	}
+
+	fn = s->out;
+	if (fs.frames == 0) {
+		errlog(core, NULL, "core", "%s: no audio frames", fn);
+		goto done;
+	}
+	if (fs.frames == 1)
+		fs.minbs = fs.maxbs = fs.prevbs;
+
+	byte *si = fs.si;
+	si[0] = (byte)(fs.minbs >> 8);
+	si[1] = (byte)fs.minbs;
+	si[2] = (byte)(fs.maxbs >> 8);
+	si[3] = (byte)fs.maxbs;
+	si[4] = (byte)(fs.minfs >> 16);
+	si[5] = (byte)(fs.minfs >> 8);
+	si[6] = (byte)fs.minfs;
+	si[7] = (byte)(fs.maxfs >> 16);
+	si[8] = (byte)(fs.maxfs >> 8);
+	si[9] = (byte)fs.maxfs;
+	si[13] = (si[13] & 0xf0) | ((fs.total >> 32) & 0x0f);
+	si[14] = (byte)(fs.total >> 24);
+	si[15] = (byte)(fs.total >> 16);
+	si[16] = (byte)(fs.total >> 8);
+	si[17] = (byte)fs.total;
+	ffmem_zero(si + 18, 16); //MD5 is unknown
+
+	if (0 != flac_wr_flush(&fs.wr)
+		|| 0 > fffile_seek(fs.wr.f, fs.si_off, SEEK_SET)
+		|| FLAC_SI_LEN != fffile_write(fs.wr.f, si, FLAC_SI_LEN))
+		goto syserr;
+
+	dbglog(core, NULL, "core", "--parallel-segments: stitched %u parts, frames: %u, samples: %U"
+		, s->n, fs.frames, fs.total);
+	rc = 0;
+	goto done;
+
+syserr:
+	syserrlog(core, NULL, "core", "%s", fn);
+
+done:
+	ffmem_safefree(fs.rd.buf);
+	ffmem_safefree(fs.wr.buf);
+	if (fs.rd.f != FF_BADFD)
+		fffile_close(fs.rd.f);
+	fffile_close(fs.wr.f);
+	if (rc != 0)
+		fffile_rm(s->out);
+	return rc;
+}
+
+/** Stitch the output file and delete the parts.  Called after all segments are finished. */
+static void segs_fin(struct segs *s)
+{
+	int r = 0;
+	if (!g->psexit) {
+		if (s->raw)
+			r = segs_stitch_raw(s);
+		else if (s->flac)
+			r = segs_stitch_flac(s);
+		else
+			r = segs_stitch(s);
+	}
+	if (r != 0)
+		g->psexit = 1;
+
+	for (uint i = 0;  s->parts != NULL && i != s->n;  i++) {
+		if (s->parts[i] != NULL)
+			fffile_rm(s->parts[i]);
+	}
+	segs_free(s);
+}
+
 /** Create a track to support recording from WASAPI in loopback mode.
 It generates silence and plays it via an audio device,
  so data from WASAPI in looopback mode can be read continuously. */
@@ -561,7 +561,7 @@ static void netin_write(netin *n, const ffstr *data)
 static void* netin_open(fmed_filt *d)
 {
 	netin *n;
-	n = (void*)fmed_getval("netin_ptr");
+	n = (void*)fmed_getval_id(FMED_TRKV_NETIN_PTR);
 	n->trk = d->trk;
 	n->state = IN_DATANEXT;
 	return n;
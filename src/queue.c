@@ -6,6 +6,9 @@ Copyright (c) 2015 Simon Zolin */
 #include <FF/data/m3u.h>
 #include <FFOS/dir.h>
 #include <FFOS/random.h>
+#include <FFOS/thread.h>
+#include <FFOS/process.h>
+#include <FFOS/file.h>
 
 
 #undef syserrlog
@@ -20,23 +23,114 @@ Metadata priority:
   . from .cue
   . from file or ICY server (transient)
   . artist/title from .m3u (used as transient due to lower priority)
+
+Metadata store:
+  . meta names are interned once per process: an entry stores numeric IDs instead of a string:
+     the key (equal for names which differ only in case) is used for lookups,
+     the name ID keeps the spelling the name was set with
+  . values are kept in a shared reference-counted pool, so equal values (album, artist)
+     of many entries occupy memory only once
+  . every entry has a direct index for the well-known names (meta_fixed[])
 */
 
 static const fmed_core *core;
 
 typedef struct plist plist;
 
+/** Well-known meta names.  Their keys are the indexes in this array. */
+static const char *const meta_fixed[] = {
+	"__dur", "__info",
+	"album", "albumartist", "artist", "comment", "date", "genre", "title", "tracknumber", "tracktotal",
+};
+
+struct meta_slot {
+	uint key;
+	uint name; // name ID
+	ffstr val; // pooled string
+};
+
+typedef struct metalist {
+	struct meta_slot *ptr;
+	uint len, cap;
+	byte fixed[FFCNT(meta_fixed)]; // key -> index+1 of the first slot with this key.  Valid if len <= 255.
+	uint *htab; // any key -> index+1 of the first slot with this key;  open addressing.  NULL if the list is small.
+	uint hcap; // power of 2
+} metalist;
+
+enum {
+	META_KEYS_CAP = 64, // initial hash table size (power of 2)
+	META_POOL_CAP = 1024,
+	META_POOL_MAXLEN = 1024, // don't deduplicate larger values
+	MLIST_HASH_MIN = 8, // index all keys of the list when it has this many slots
+};
+
+/** Interned meta names. */
+struct meta_keys {
+	ffarr names; //ffstr[]  name by ID
+	ffarr keys; //uint[]  name ID -> key: ID of the first name which is equal to it case-insensitively
+	uint *tab; // names;  open addressing: ID+1
+	uint *itab; // case-insensitive names;  open addressing: key+1
+	uint cap;
+	fflock lk;
+};
+
+/** Reference-counted string. */
+struct pstr {
+	struct pstr *next;
+	uint ref;
+	uint hash;
+	uint pooled :1;
+	size_t len;
+	char data[0];
+};
+
+struct meta_pool {
+	struct pstr **tab;
+	uint cap;
+	uint n;
+	fflock lk;
+};
+
+static int meta_keys_init(struct meta_keys *k);
+static void meta_keys_free(struct meta_keys *k);
+static int meta_key(const char *name, size_t len, uint add, uint *id);
+static ffstr meta_name(uint id);
+static int pool_init(struct meta_pool *pl);
+static void pool_free(struct meta_pool *pl);
+static char* pool_get(const char *s, size_t len);
+static void pstr_fill(struct pstr *p, const char *s, size_t len);
+static void pool_put(char *data);
+static int mlist_find(const metalist *m, uint key, size_t n);
+static int mlist_add(metalist *m, uint key, uint name, char *val, size_t len);
+static void mlist_rm(metalist *m, uint i);
+static void mlist_free(metalist *m);
+
+/** Node of an order-statistic tree (treap) of playlist entries. */
+struct pnode {
+	struct pnode *left, *right, *parent;
+	size_t size; // number of nodes in this subtree;  0: not linked
+	uint prio;
+};
+
+struct ptree {
+	struct pnode *root;
+	uint seed; // state of ptree_rnd();  protected by the same lock as the tree
+};
+
 typedef struct entry {
 	fmed_que_entry e;
 	fflist_item sib;
 
 	plist *plist;
 	fmed_trk *trk;
-	ffarr2 meta; //ffstr[]
-	ffarr2 tmeta; //ffstr[]. transient meta
+	metalist meta;
+	metalist tmeta; // transient meta
 	ffarr2 dict; //ffstr[]
 
-	size_t list_pos; //position number within playlist.  May be invalid.
+	struct pnode nodes[2]; // position within playlist;  position within filtered playlist
+	const struct snap_ent *snap; // meta that isn't parsed yet from plist.snap
+	ffchain_item xsib; // in xsched.pending
+	uint sid; // slot in plist.sidx + 1.  0: not indexed
 	uint refcount;
 	uint rm :1
 		, stop_after :1
@@ -47,27 +141,88 @@ typedef struct entry {
 		, trk_mixed :1
 		;
 
+	// protected by xsched.lk;  they don't share memory with the bit-fields above, which are written without the lock
+	byte xpending; // waiting in xsched.pending
+	byte xsched; // expand track started by xsched is running
+	byte xdone; // expanded by xsched already
+
 	char url[0];
 } entry;
 
 struct plist {
 	fflist_item sib;
 	fflist ents; //entry[]
-	ffarr indexes; //entry*[]  Get an entry by its number;  find a number by an entry pointer.
+	struct ptree index; // Get an entry by its number;  find a number by an entry pointer.
 	entry *cur, *xcursor;
 	struct plist *filtered_plist; //list with the filtered tracks
 	uint rm :1;
 	uint allow_random :1;
 	uint filtered :1;
 	uint parallel :1; // every item in this queue will start via FMED_TRACK_XSTART
+	struct snap *snap; // mapped snapshot data, while some entries refer to it
+	struct sidx *sidx; // search index;  NULL: not created yet
+	uint mods; // incremented on each change of the index.  plist_lock must be locked.
 };
 
 static void plist_free(plist *pl);
 static ssize_t plist_ent_idx(plist *pl, entry *e);
 static struct entry* plist_ent(struct plist *pl, size_t idx);
+static size_t plist_len(plist *pl);
+static int plist_ins(plist *pl, size_t idx, entry *e);
+static void plist_rmidx(plist *pl, entry *e);
+static entry** plist_toarr(plist *pl);
+static void plist_fromarr(plist *pl, entry **arr, size_t n);
+static void sidx_free(struct sidx *si);
+static void sidx_touch(entry *e);
+static void sidx_rm(entry *e);
+static ssize_t que_search(const ffstr *text, uint flags);
 
 struct que_conf {
 	byte next_if_err;
+	byte meta_cache;
+	byte expand_parallel;
+	byte gapless; // prepare the next track N seconds before the end of the current one.  0: disabled
+};
+
+/** Gapless playback state. */
+struct gapless {
+	fflock lk;
+	entry *cur; // the entry for which the next track is prepared
+	entry *next; // the prepared entry
+	void *trk; // the prepared track, until its queue filter is closed
+	uint state; //enum GL_STATE
+	uint waiting :1; // the prepared track is suspended at the gate
+};
+
+enum {
+	XSCHED_NOTIFY_MS = 250,
+	XSCHED_AHEAD = 2, // expand these entries after the current one first
+	XSCHED_VISIBLE = 32, // then the entries around the visible one
+};
+
+/** Expansion scheduler. */
+struct xsched {
+	fflock lk;
+	fflist pending; //entry[]
+	uint inflight; // expand tracks running
+	uint ndone; // expand tracks finished since the last notification
+	size_t visible; // position of the entry displayed most recently.  -1: unset
+	fftask tsk_run;
+	fftmrq_entry tmr;
+	uint run_posted :1
+		, tmr_active :1;
+};
+
+/** Cache of meta parsed from local files. */
+struct mcache {
+	struct mcache_ent **tab;
+	uint cap, n;
+	uint hand; // eviction: the next bucket to check
+	fflock lk;
+	ffthd loader;
+	uint loading :1 // the loader thread is started
+		, loaded :1
+		, dirty :1;
 };
 
 typedef struct que {
@@ -76,6 +231,12 @@ typedef struct que {
 	const fmed_track *track;
 	fmed_que_onchange_t onchange;
 	fflock plist_lock;
+	fflock snap_lock;
+	struct meta_keys keys;
+	struct meta_pool pool;
+	struct mcache mcache;
+	struct xsched xsched;
+	struct gapless gl;
 
 	struct que_conf conf;
 	uint list_random;
@@ -114,15 +275,39 @@ static const fmed_queue fmed_que_mgr = {
 
 static fmed_que_entry* que_add(plist *pl, fmed_que_entry *ent, entry *prev, uint flags);
 static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *val, uint flags);
+static void que_dict_set(entry *e, const ffstr *name, const ffstr *val, uint flags);
+static int que_arrfind(const ffstr *m, uint n, const char *name, size_t name_len);
+static ffstr* ent_meta_find(entry *e, uint key);
 static void que_play(entry *e);
-static void que_play2(entry *ent, uint flags);
+enum {
+	QUE_PLAY_XSTART = 1,
+	QUE_PLAY_GAPLESS = 2, // prepare the next track for gapless playback
+};
+static void* que_play2(entry *ent, uint flags);
 static void que_save(entry *first, const fflist_item *sentl, const char *fn);
+struct snap_ent;
+static void ent_snap_load(entry *e);
+static void snap_unref(plist *pl);
+static void snap_save(entry *first, const fflist_item *sentl, const char *fn);
+static int snap_load(plist *pl, const char *fn);
+static void mcache_save(struct mcache *c);
+static void mcache_free(struct mcache *c);
+static int mcache_get(entry *e);
+static void mcache_put(entry *e);
+static void xsched_add(entry *e, uint meta_only);
+static void xsched_run(void *param);
+static void xsched_fin(entry *e);
+static void xsched_notify(void *param);
+static void xsched_done(entry *e);
+static uint que_ncpu(void);
 static void ent_rm(entry *e);
 static void ent_free(entry *e);
 static void que_taskfunc(void *udata);
 static void rnd_init();
 enum CMD {
 	CMD_TRKFIN = 0x010000,
+	CMD_XSCHED_FIN, // expand track started by xsched has finished
+	CMD_GAPLESS, // prepare the next track
 };
 struct quetask {
 	uint cmd; //enum FMED_QUE or enum CMD
@@ -141,12 +326,29 @@ static void que_trk_close(void *ctx);
 static const fmed_filter fmed_que_trk = {
 	&que_trk_open, &que_trk_process, &que_trk_close
 };
+
+//GAPLESS
+static void* gl_open(fmed_filt *d);
+static int gl_process(void *ctx, fmed_filt *d);
+static void gl_close(void *ctx);
+static const fmed_filter fmed_que_gapless = {
+	&gl_open, &gl_process, &gl_close
+};
+static void gl_prepare(entry *e);
+static void gl_wait(void *trk);
+static int gl_ontrkfin(entry *e);
+static void gl_trkclose(void *trk);
 static const ffpars_arg que_conf_args[] = {
 	{ "next_if_error",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct que_conf, next_if_err) },
+	{ "meta_cache",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct que_conf, meta_cache) },
+	{ "expand_parallel",	FFPARS_TINT8,  FFPARS_DSTOFF(struct que_conf, expand_parallel) },
+	{ "gapless",	FFPARS_TINT8,  FFPARS_DSTOFF(struct que_conf, gapless) },
 };
 static int que_config(ffpars_ctx *ctx)
 {
 	qu->conf.next_if_err = 1;
+	qu->conf.meta_cache = 1;
+	qu->conf.gapless = 3;
 	ffpars_setargs(ctx, &qu->conf, que_conf_args, FFCNT(que_conf_args));
 	return 0;
 }
@@ -163,6 +365,8 @@ static const void* que_iface(const char *name)
 {
 	if (!ffsz_cmp(name, "track"))
 		return &fmed_que_trk;
+	else if (!ffsz_cmp(name, "gapless"))
+		return &fmed_que_gapless;
 	else if (!ffsz_cmp(name, "queue"))
 		return (void*)&fmed_que_mgr;
 	return NULL;
@@ -183,9 +387,25 @@ static int que_sig(uint signo)
 			return 1;
 		fflist_init(&qu->plists);
 		fflk_init(&qu->plist_lock);
+		fflk_init(&qu->snap_lock);
+		fflk_init(&qu->mcache.lk);
+		fflk_init(&qu->xsched.lk);
+		fflk_init(&qu->gl.lk);
+		fflist_init(&qu->xsched.pending);
+		qu->xsched.visible = -1;
+		qu->xsched.tsk_run.handler = &xsched_run;
+		qu->xsched.tmr.handler = &xsched_notify;
+		if (0 != meta_keys_init(&qu->keys)
+			|| 0 != pool_init(&qu->pool))
+			return 1;
 		break;
 
 	case FMED_OPEN:
+		if (qu->conf.meta_cache) {
+			fflk_lock(&qu->mcache.lk);
+			mcache_init(&qu->mcache);
+			fflk_unlock(&qu->mcache.lk);
+		}
 		que_cmd2(FMED_QUE_NEW, NULL, 0);
 		que_cmd2(FMED_QUE_SEL, (void*)0, 0);
 		qu->track = core->getmod("#core.track");
@@ -198,15 +418,11 @@ static int que_sig(uint signo)
 static void ent_rm(entry *e)
 {
 	if (!e->rm) {
-		ssize_t i = plist_ent_idx(e->plist, e);
-		if (i >= 0)
-			_ffarr_rmshift_i(&e->plist->indexes, i, 1, sizeof(entry*));
+		plist_rmidx(e->plist, e);
+		sidx_rm(e);
 
-		if (e->plist->filtered_plist != NULL) {
-			i = plist_ent_idx(e->plist->filtered_plist, e);
-			if (i >= 0)
-				_ffarr_rmshift_i(&e->plist->filtered_plist->indexes, i, 1, sizeof(entry*));
-		}
+		if (e->plist->filtered_plist != NULL)
+			plist_rmidx(e->plist->filtered_plist, e);
 	}
 
 	if (e->refcount != 0) {
@@ -238,9 +454,14 @@ static void ent_unref(entry *e)
 
 static void ent_free(entry *e)
 {
-	FFARR2_FREE_ALL(&e->meta, ffstr_free, ffstr);
+	if (e->snap != NULL) {
+		fflk_lock(&qu->snap_lock);
+		snap_unref(e->plist);
+		fflk_unlock(&qu->snap_lock);
+	}
+	mlist_free(&e->meta);
 	FFARR2_FREE_ALL(&e->dict, ffstr_free, ffstr);
-	FFARR2_FREE_ALL(&e->tmeta, ffstr_free, ffstr);
+	mlist_free(&e->tmeta);
 
 	ffmem_free(e->trk);
 	ffmem_free(e);
@@ -250,41 +471,272 @@ static void plist_free(plist *pl)
 {
 	if (pl == NULL)
 		return;
+	plist_free(pl->filtered_plist); // before the entries are freed: it unlinks their nodes
+	if (pl->filtered) {
+		for (size_t i = plist_len(pl);  i != 0;  i--) {
+			plist_rmidx(pl, plist_ent(pl, i - 1));
+		}
+	}
 	FFLIST_ENUMSAFE(&pl->ents, ent_free, entry, sib);
-	ffarr_free(&pl->indexes);
-	plist_free(pl->filtered_plist);
+	sidx_free(pl->sidx);
 	ffmem_free(pl);
 }
 
-/** Find a number by an entry pointer. */
-static ssize_t plist_ent_idx(plist *pl, entry *e)
+
+// PLAYLIST INDEX
+
+/** xorshift32: node priorities don't need to be of high quality.
+Each tree has its own state, so trees locked by different locks don't share it. */
+static uint ptree_rnd(struct ptree *t)
+{
+	uint x = t->seed;
+	if (x == 0)
+		x = 2463534242;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	t->seed = x;
+	return x;
+}
+
+#define psize(n)  (((n) != NULL) ? (n)->size : 0)
+
+/** Rotate 'x' up over its parent. */
+static void ptree_rotup(struct ptree *t, struct pnode *x)
 {
-	int update = 0;
-	if (!pl->filtered) {
-		entry *e2 = plist_ent(pl, e->list_pos);
-		if (e == e2)
-			return e->list_pos;
-		update = 1;
+	struct pnode *p = x->parent, *g = p->parent, *b;
+
+	if (p->left == x) {
+		b = x->right;
+		p->left = b;
+		x->right = p;
+	} else {
+		b = x->left;
+		p->right = b;
+		x->left = p;
 	}
+	if (b != NULL)
+		b->parent = p;
+	p->parent = x;
+
+	x->parent = g;
+	if (g == NULL)
+		t->root = x;
+	else if (g->left == p)
+		g->left = x;
+	else
+		g->right = x;
 
-	entry **p;
-	FFARR_WALKT(&pl->indexes, p, entry*) {
-		if (*p == e) {
-			if (update)
-				e->list_pos = p - (entry**)pl->indexes.ptr;
-			return p - (entry**)pl->indexes.ptr;
+	x->size = p->size;
+	p->size = psize(p->left) + psize(p->right) + 1;
+}
+
+/** Get node by its position. */
+static struct pnode* ptree_nth(const struct ptree *t, size_t i)
+{
+	struct pnode *n = t->root;
+	while (n != NULL) {
+		size_t l = psize(n->left);
+		if (i < l)
+			n = n->left;
+		else if (i == l)
+			return n;
+		else {
+			i -= l + 1;
+			n = n->right;
 		}
 	}
-	return -1;
+	return NULL;
+}
+
+/** Get position of the node. */
+static size_t ptree_rank(const struct pnode *n)
+{
+	size_t r = psize(n->left);
+	for (;  n->parent != NULL;  n = n->parent) {
+		if (n == n->parent->right)
+			r += psize(n->parent->left) + 1;
+	}
+	return r;
+}
+
+/** Insert node so that it gets position 'i'. */
+static void ptree_insert(struct ptree *t, size_t i, struct pnode *n)
+{
+	struct pnode **link = &t->root, *parent = NULL;
+
+	while (*link != NULL) {
+		parent = *link;
+		parent->size++;
+		size_t l = psize(parent->left);
+		if (i <= l)
+			link = &parent->left;
+		else {
+			i -= l + 1;
+			link = &parent->right;
+		}
+	}
+
+	n->left = n->right = NULL;
+	n->parent = parent;
+	n->size = 1;
+	n->prio = ptree_rnd(t);
+	*link = n;
+
+	while (n->parent != NULL && n->prio > n->parent->prio) {
+		ptree_rotup(t, n);
+	}
+}
+
+static void ptree_rm(struct ptree *t, struct pnode *n)
+{
+	// rotate the node down until it's a leaf
+	while (n->left != NULL || n->right != NULL) {
+		struct pnode *c = n->right;
+		if (n->left != NULL && (n->right == NULL || n->left->prio > n->right->prio))
+			c = n->left;
+		ptree_rotup(t, c);
+	}
+
+	struct pnode *p = n->parent;
+	if (p == NULL)
+		t->root = NULL;
+	else if (p->left == n)
+		p->left = NULL;
+	else
+		p->right = NULL;
+	for (;  p != NULL;  p = p->parent) {
+		p->size--;
+	}
+	n->parent = NULL;
+	n->size = 0;
+}
+
+/** In-order successor. */
+static struct pnode* ptree_next(struct pnode *n)
+{
+	if (n->right != NULL) {
+		for (n = n->right;  n->left != NULL;  n = n->left) {
+		}
+		return n;
+	}
+	while (n->parent != NULL && n == n->parent->right) {
+		n = n->parent;
+	}
+	return n->parent;
+}
+
+static entry* pnode_ent(const plist *pl, struct pnode *n)
+{
+	if (n == NULL)
+		return NULL;
+	return (pl->filtered) ? FF_GETPTR(entry, nodes[1], n) : FF_GETPTR(entry, nodes[0], n);
+}
+
+static size_t plist_len(plist *pl)
+{
+	return psize(pl->index.root);
+}
+
+/** Find a number by an entry pointer. */
+static ssize_t plist_ent_idx(plist *pl, entry *e)
+{
+	const struct pnode *n = &e->nodes[pl->filtered];
+	if (n->size == 0)
+		return -1;
+	return ptree_rank(n);
 }
 
 /** Get an entry pointer by its index. */
 static struct entry* plist_ent(struct plist *pl, size_t idx)
 {
-	if (idx >= pl->indexes.len)
+	return pnode_ent(pl, ptree_nth(&pl->index, idx));
+}
+
+/** Insert entry at position 'idx'. */
+static int plist_ins(plist *pl, size_t idx, entry *e)
+{
+	struct pnode *n = &e->nodes[pl->filtered];
+	if (n->size != 0)
+		return -1;
+	ptree_insert(&pl->index, idx, n);
+	pl->mods++;
+	return 0;
+}
+
+/** Remove entry from index. */
+static void plist_rmidx(plist *pl, entry *e)
+{
+	struct pnode *n = &e->nodes[pl->filtered];
+	if (n->size != 0) {
+		ptree_rm(&pl->index, n);
+		pl->mods++;
+	}
+}
+
+/** Get all entries in order.
+plist_lock must be locked. */
+static entry** plist_toarr(plist *pl)
+{
+	size_t i = 0;
+	entry **arr;
+	if (NULL == (arr = ffmem_allocT(plist_len(pl) + 1, entry*)))
 		return NULL;
-	struct entry *e = ((entry**)pl->indexes.ptr) [idx];
-	return e;
+
+	struct pnode *n = pl->index.root;
+	if (n != NULL) {
+		for (;  n->left != NULL;  n = n->left) {
+		}
+	}
+	for (;  n != NULL;  n = ptree_next(n)) {
+		arr[i++] = pnode_ent(pl, n);
+	}
+	return arr;
+}
+
+/** Rebuild index from array in O(n).
+The right spine of the tree is kept as a stack linked via 'parent'.
+plist_lock must be locked. */
+static void plist_fromarr(plist *pl, entry **arr, size_t n)
+{
+	struct pnode *last = NULL, *root = NULL, *nd, *c;
+
+	for (size_t i = 0;  i != n;  i++) {
+		nd = &arr[i]->nodes[pl->filtered];
+		nd->left = nd->right = NULL;
+		nd->size = 0;
+		nd->prio = ptree_rnd(&pl->index);
+
+		c = NULL;
+		while (last != NULL && last->prio < nd->prio) {
+			c = last;
+			last = last->parent;
+		}
+		nd->left = c;
+		if (c != NULL)
+			c->parent = nd;
+		nd->parent = last;
+		if (last != NULL)
+			last->right = nd;
+		else
+			root = nd;
+		last = nd;
+	}
+
+	// set subtree sizes in post-order;  size=0: not visited yet
+	for (nd = root;  nd != NULL;  ) {
+		if (nd->left != NULL && nd->left->size == 0)
+			nd = nd->left;
+		else if (nd->right != NULL && nd->right->size == 0)
+			nd = nd->right;
+		else {
+			nd->size = psize(nd->left) + psize(nd->right) + 1;
+			nd = nd->parent;
+		}
+	}
+
+	pl->index.root = root;
+	pl->mods++;
 }
 
 
@@ -293,6 +745,10 @@ static void que_destroy(void)
 	if (qu == NULL)
 		return;
 	FFLIST_ENUMSAFE(&qu->plists, plist_free, plist, sib);
+	mcache_save(&qu->mcache);
+	mcache_free(&qu->mcache);
+	meta_keys_free(&qu->keys);
+	pool_free(&qu->pool);
 	ffmem_free0(qu);
 }
 
@@ -351,7 +807,7 @@ static void que_xplay(entry *e)
 	for (;;) {
 		e->plist->xcursor = e;
 		ffbool last = (e->sib.next == fflist_sentl(&e->plist->ents));
-		que_play2(e, 1);
+		que_play2(e, QUE_PLAY_XSTART);
 		if (0 == core->cmd(FMED_WORKER_AVAIL))
 			break;
 		if (last)
@@ -374,16 +830,22 @@ static void que_play(entry *e)
 	que_play2(e, 0);
 }
 
-static void que_play2(entry *ent, uint flags)
+/**
+@flags: QUE_PLAY_*
+Return track object;  NULL on error. */
+static void* que_play2(entry *ent, uint flags)
 {
 	fmed_que_entry *e = &ent->e;
 	void *trk = qu->track->create(FMED_TRK_TYPE_PLAYBACK, e->url.ptr);
 	uint i;
 
 	if (trk == NULL)
-		return;
+		return NULL;
 	else if (trk == FMED_TRK_EFMT) {
 		entry *next;
+		if (flags & QUE_PLAY_GAPLESS)
+			return NULL; // it will be handled when the current track is finished
+
 		if (NULL != (next = que_getnext(ent))) {
 			struct quetask *qt = ffmem_new(struct quetask);
 			FF_ASSERT(qt != NULL);
@@ -393,7 +855,7 @@ static void que_play2(entry *ent, uint flags)
 		}
 
 		que_cmd(FMED_QUE_RM, e);
-		return;
+		return NULL;
 	}
 
 	fmed_trk *t = qu->track->conf(trk);
@@ -421,17 +883,32 @@ static void que_play2(entry *ent, uint flags)
 	const char *smeta = qu->track->getvalstr(trk, "meta");
 	if (smeta != FMED_PNULL && 0 != que_setmeta(ent, smeta, trk)) {
 		que_cmd(FMED_QUE_RM, e);
-		return;
+		return NULL;
 	}
 
-	FFARR2_FREE_ALL(&ent->tmeta, ffstr_free, ffstr);
+	if (qu->conf.gapless != 0
+		&& !qu->mixing
+		&& !(flags & QUE_PLAY_XSTART)
+		&& FMED_PNULL == qu->track->getvalstr(trk, "output")) {
+		qu->track->cmd(trk, FMED_TRACK_FILT_ADDLAST, "#queue.gapless");
+		if (flags & QUE_PLAY_GAPLESS) {
+			qu->track->setval(trk, "queue-gapless", 1);
+			gl_wait(trk);
+		}
+	}
+
+	ent_snap_load(ent);
+	fflk_lock(&qu->plist_lock);
+	mlist_free(&ent->tmeta);
+	fflk_unlock(&qu->plist_lock);
 
 	qu->track->setval(trk, "queue_item", (int64)e);
 	ent_ref(ent);
-	if (flags & 1)
-		qu->track->cmd(trk, FMED_TRACK_XSTART);
-	else
-		qu->track->cmd(trk, FMED_TRACK_START);
+	if (0 != qu->track->cmd(trk, (flags & QUE_PLAY_XSTART) ? FMED_TRACK_XSTART : FMED_TRACK_START))
+		return trk;
+	if (FMED_TRK_PIPE_IN == qu->track->cmd(trk, FMED_TRACK_PIPE))
+		ent_ref(ent); // for the output track of the conversion pipeline
+	return trk;
 }
 
 /** Save playlist file. */
@@ -495,155 +972,2444 @@ done:
 	ffm3u_fin(&m3);
 }
 
-static entry* que_getnext(entry *from)
-{
-	ffchain_item *it;
-	plist *pl = (from == NULL) ? qu->curlist : from->plist;
-	fflist *ents = &pl->ents;
+// SNAPSHOT
+/*
+Playlist snapshot: a binary copy of the playlist, written by FMED_QUE_SAVE|FMED_QUE_SNAP next to the .m3u8 file.
+The file is mapped into memory on load: entries are created from the records directly,
+ meta is parsed from the mapped data only when it's accessed for the first time.
+
+snap_hdr
+snap_ent[n]:
+  url[url_len] \0
+  (snap_pair name[name_len] \0 value[val_len] \0)[npairs]
+Records are 4-byte aligned.  Numbers are in host byte order.
+*/
 
-	if (pl->allow_random && qu->random && pl->indexes.len != 0) {
-		rnd_init();
-		uint i = ffrnd_get() % pl->indexes.len;
-		entry *e = ((entry**)pl->indexes.ptr) [i];
-		return e;
-	}
+#define SNAP_EXT  ".snap"
+#define SNAP_MAGIC  "fmsnap"
 
-	it = (from == NULL) ? ents->first : from->sib.next;
-	if (it == fflist_sentl(ents)) {
-		if (qu->repeat_all)
-			it = ents->first;
+enum {
+	SNAP_VER = 1,
+	SNAP_ENDIAN = 0x0102,
+	SNAP_WBUF = 64 * 1024,
+};
 
-		if (it == fflist_sentl(ents)) {
-			dbglog(core, NULL, "que", "no next file in playlist");
-			qu->track->cmd(NULL, FMED_TRACK_LAST);
-			return NULL;
-		}
+struct snap_hdr {
+	char magic[6];
+	ushort endian;
+	uint ver;
+	uint hdr_size;
+	uint64 n; // number of entries
+	uint64 size; // total file size
+};
 
-		dbglog(core, NULL, "que", "repeat_all: starting from the beginning");
-	}
+struct snap_ent {
+	uint size; // size of the record
+	int from, to, dur;
+	uint url_len;
+	uint npairs;
+};
 
-	return FF_GETPTR(entry, sib, it);
-}
+enum SNAP_PAIR_F {
+	SNAP_TMETA = 1,
+	SNAP_DICT = 2,
+	SNAP_NUM = 4, // dict value is int64
+};
 
-static void que_mix(void)
-{
-	fflist *ents = &qu->curlist->ents;
-	void *mxout;
-	entry *e;
+struct snap_pair {
+	ushort name_len;
+	ushort flags; //enum SNAP_PAIR_F
+	uint val_len;
+};
 
-	if (NULL == (mxout = qu->track->create(FMED_TRACK_MIX, NULL)))
-		return;
-	qu->track->setval(mxout, "mix_tracks", ents->len);
-	ent_ref(mxout);
-	qu->track->cmd(mxout, FMED_TRACK_START);
+/** Mapped snapshot data. */
+struct snap {
+	void *map;
+	size_t size;
+	uint refs; // entries with unparsed meta
+};
 
-	qu->mixing = 1;
-	FFLIST_WALK(ents, e, sib) {
-		que_play(e);
-	}
+static void snap_unref(plist *pl)
+{
+	struct snap *s = pl->snap;
+	if (--s->refs != 0)
+		return;
+	ffmap_unmap(s->map, s->size);
+	ffmem_free(s);
+	pl->snap = NULL;
 }
 
-/** Get playlist by its index. */
-static plist* plist_by_idx(size_t idx)
+/** Walk through the pairs of a record.
+Return pointer to the next pair;  NULL if there are no more pairs. */
+static const char* snap_pair_next(const char *p, const char *end, struct snap_pair *sp, ffstr *name, ffstr *val)
 {
-	uint i = 0;
-	fflist_item *li;
-	FFLIST_FOREACH(&qu->plists, li) {
-		if (i++ == idx)
-			return FF_GETPTR(plist, sib, li);
-	}
-	return NULL;
+	if ((size_t)(end - p) < sizeof(struct snap_pair))
+		return NULL;
+	ffmemcpy(sp, p, sizeof(struct snap_pair));
+	p += sizeof(struct snap_pair);
+	if ((size_t)(end - p) < (size_t)sp->name_len + 1 + sp->val_len + 1)
+		return NULL;
+	ffstr_set(name, p, sp->name_len);
+	p += sp->name_len + 1;
+	ffstr_set(val, p, sp->val_len);
+	p += sp->val_len + 1;
+	return p;
 }
 
-struct plist_sortdata {
-	ffstr meta; // meta key by which to sort
-	uint url :1
-		, dur :1
-		, reverse :1;
-};
-
-/** Compare two entries. */
-static int plist_entcmp(const void *a, const void *b, void *udata)
+/** Parse meta of the entry loaded from snapshot.
+Called on the first access to the entry's meta.
+May be called with plist_lock held: the lock order is plist_lock -> snap_lock. */
+static void ent_snap_load(entry *e)
 {
-	struct plist_sortdata *ps = udata;
-	struct entry *e1 = *(void**)a, *e2 = *(void**)b;
-	ffstr *s1, *s2;
-	int r = 0;
+	if (FF_READONCE(e->snap) == NULL)
+		return;
 
-	if (ps->url) {
-		r = ffstr_cmp2(&e1->e.url, &e2->e.url);
+	fflk_lock(&qu->snap_lock);
+	const struct snap_ent *se = e->snap;
+	if (se == NULL) {
+		fflk_unlock(&qu->snap_lock);
+		return; // parsed by another thread
+	}
 
-	} else if (ps->dur) {
-		r = ffint_cmp(e1->e.dur, e2->e.dur);
+	metalist m[2] = {};
+	struct snap_pair sp;
+	ffstr name, val;
+	const char *p = (char*)se + sizeof(struct snap_ent) + se->url_len + 1, *end = (char*)se + se->size;
+	for (uint i = 0;  i != se->npairs;  i++) {
+		p = snap_pair_next(p, end, &sp, &name, &val);
+		if (sp.flags & SNAP_DICT)
+			continue;
 
-	} else if (ps->meta.len != 0) {
-		s1 = que_meta_find(&e1->e, ps->meta.ptr, ps->meta.len);
-		s2 = que_meta_find(&e2->e, ps->meta.ptr, ps->meta.len);
-		if (s1 == NULL && s2 == NULL)
-			r = 0;
-		else if (s1 == NULL)
-			r = 1;
-		else if (s2 == NULL)
-			r = -1;
-		else
-			r = ffstr_cmp2(s1, s2);
+		char *sval;
+		int key;
+		uint id;
+		if (-1 == (key = meta_key(name.ptr, name.len, 1, &id))
+			|| NULL == (sval = pool_get(val.ptr, val.len)))
+			break;
+		if (0 != mlist_add(&m[!!(sp.flags & SNAP_TMETA)], key, id, sval, val.len)) {
+			pool_put(sval);
+			break;
+		}
 	}
 
-	if (ps->reverse)
-		r = -r;
-	return r;
+	e->meta = m[0];
+	e->tmeta = m[1];
+	FF_WRITEONCE(e->snap, NULL);
+	snap_unref(e->plist);
+	fflk_unlock(&qu->snap_lock);
 }
 
-/** Initialize random number generator */
-static void rnd_init()
+static int snap_wflush(fffd f, ffarr *buf)
 {
-	if (qu->rnd_ready)
-		return;
-	qu->rnd_ready = 1;
-	fftime t;
-	fftime_now(&t);
-	ffrnd_seed(t.sec);
+	if (buf->len != (size_t)fffile_write(f, buf->ptr, buf->len))
+		return -1;
+	buf->len = 0;
+	return 0;
 }
 
-/** Sort indexes randomly */
-static void sort_random(plist *pl)
+static int snap_wpair(ffarr *buf, uint flags, const ffstr *name, const void *val, size_t val_len)
 {
-	rnd_init();
-	entry **arr = (void*)pl->indexes.ptr;
-	for (size_t i = 0;  i != pl->indexes.len;  i++) {
-		size_t to = ffrnd_get() % pl->indexes.len;
-		_ffarr_swap(&arr[i], &arr[to], 1, sizeof(entry*));
-	}
+	struct snap_pair sp;
+	sp.name_len = ffmin(name->len, 0xffff);
+	sp.flags = flags;
+	sp.val_len = val_len;
+	if (NULL == ffarr_grow(buf, sizeof(struct snap_pair) + sp.name_len + 1 + val_len + 1, 0))
+		return -1;
+	ffarr_append(buf, &sp, sizeof(struct snap_pair));
+	ffarr_append(buf, name->ptr, sp.name_len);
+	*ffarr_push(buf, char) = '\0';
+	ffarr_append(buf, val, val_len);
+	*ffarr_push(buf, char) = '\0';
+	return 0;
 }
 
-/** Sort playlist entries. */
-static void plist_sort(struct plist *pl, const char *by, uint flags)
+/** Write snapshot of the playlist to "FILENAME.snap". */
+static void snap_save(entry *first, const fflist_item *sentl, const char *fn)
 {
-	if (ffsz_eq(by, "__random")) {
-		sort_random(pl);
-	} else {
-		struct plist_sortdata ps = {};
-		if (ffsz_eq(by, "__url"))
-			ps.url = 1;
-		else if (ffsz_eq(by, "__dur"))
-			ps.dur = 1;
-		else
-			ffstr_setz(&ps.meta, by);
-		ps.reverse = !!(flags & 1);
-		ffsort(pl->indexes.ptr, pl->indexes.len, sizeof(void*), &plist_entcmp, &ps);
+	fffd f = FF_BADFD;
+	int rc = -1;
+	entry *e;
+	ffarr buf = {}, fname = {}, tmpname = {};
+	struct snap_hdr h = {};
+	uint64 total;
+
+	if (0 == ffstr_catfmt(&fname, "%s" SNAP_EXT "%Z", fn)
+		|| 0 == ffstr_catfmt(&tmpname, "%s" SNAP_EXT ".tmp%Z", fn)
+		|| NULL == ffarr_alloc(&buf, SNAP_WBUF))
+		goto done;
+
+	if (FF_BADFD == (f = fffile_open(tmpname.ptr, FFO_CREATE | FFO_TRUNC | FFO_WRONLY))) {
+		syserrlog("%s: %s", fffile_open_S, tmpname.ptr);
+		goto done;
 	}
 
-	fflist_init(&pl->ents);
-	entry **arr = (void*)pl->indexes.ptr;
-	for (size_t i = 0;  i != pl->indexes.len;  i++) {
-		fflist_ins(&pl->ents, &arr[i]->sib);
+	ffmemcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+	h.endian = SNAP_ENDIAN;
+	h.ver = SNAP_VER;
+	h.hdr_size = sizeof(struct snap_hdr);
+	ffarr_append(&buf, &h, sizeof(struct snap_hdr));
+	total = sizeof(struct snap_hdr);
+
+	for (e = first;  &e->sib != sentl;  e = FF_GETPTR(entry, sib, e->sib.next)) {
+		if (e->rm)
+			continue;
+		ent_snap_load(e);
+
+		size_t off = buf.len;
+		struct snap_ent se = {};
+		se.from = e->e.from;
+		se.to = e->e.to;
+		se.dur = e->e.dur;
+		se.url_len = e->e.url.len;
+		se.npairs = e->meta.len + e->tmeta.len + e->dict.len / 2;
+		if (NULL == ffarr_grow(&buf, sizeof(struct snap_ent) + se.url_len + 1, 0))
+			goto done;
+		ffarr_append(&buf, &se, sizeof(struct snap_ent));
+		ffarr_append(&buf, e->e.url.ptr, se.url_len);
+		*ffarr_push(&buf, char) = '\0';
+
+		for (uint k = 0;  k != 2;  k++) {
+			const metalist *m = (k == 0) ? &e->meta : &e->tmeta;
+			for (uint i = 0;  i != m->len;  i++) {
+				ffstr name = meta_name(m->ptr[i].name);
+				if (0 != snap_wpair(&buf, (k == 1) ? SNAP_TMETA : 0, &name, m->ptr[i].val.ptr, m->ptr[i].val.len))
+					goto done;
+			}
+		}
+
+		const ffstr *dict = e->dict.ptr;
+		for (uint i = 0;  i != e->dict.len;  i += 2) {
+			int r;
+			if ((ssize_t)dict[i + 1].len >= 0)
+				r = snap_wpair(&buf, SNAP_DICT, &dict[i], dict[i + 1].ptr, dict[i + 1].len);
+			else
+				r = snap_wpair(&buf, SNAP_DICT | SNAP_NUM, &dict[i], dict[i + 1].ptr, sizeof(int64));
+			if (r != 0)
+				goto done;
+		}
+
+		// align
+		size_t n = ff_align_ceil2(buf.len - off, 4) - (buf.len - off);
+		if (NULL == ffarr_grow(&buf, n, 0))
+			goto done;
+		ffmem_zero(ffarr_end(&buf), n);
+		buf.len += n;
+		se.size = buf.len - off;
+		ffmemcpy(buf.ptr + off, &se.size, sizeof(se.size));
+
+		total += se.size;
+		h.n++;
+
+		if (buf.len >= SNAP_WBUF
+			&& 0 != snap_wflush(f, &buf))
+			goto done;
+	}
+
+	if (0 != snap_wflush(f, &buf))
+		goto done;
+
+	h.size = total;
+	if (0 != fffile_seek(f, 0, SEEK_SET)
+		|| sizeof(struct snap_hdr) != (size_t)fffile_write(f, &h, sizeof(struct snap_hdr)))
+		goto done;
+
+	fffile_safeclose(f);
+	if (0 != fffile_rename(tmpname.ptr, fname.ptr))
+		goto done;
+	dbglog0("saved playlist snapshot to %s (%U KB)", fname.ptr, total / 1024);
+	rc = 0;
+
+done:
+	if (rc != 0) {
+		syserrlog("saving playlist snapshot to file: %s", fname.ptr);
+		if (f != FF_BADFD) {
+			fffile_close(f);
+			fffile_rm(tmpname.ptr);
+		}
 	}
+	ffarr_free(&buf);
+	ffarr_free(&fname);
+	ffarr_free(&tmpname);
 }
 
-static void que_cmd(uint cmd, void *param)
+/** Check snapshot data and count entries. */
+static int snap_check(const char *data, size_t size)
 {
-	que_cmd2(cmd, param, 0);
-}
+	const struct snap_hdr *h = (void*)data;
+
+	if (size < sizeof(struct snap_hdr)
+		|| ffmemcmp(h->magic, SNAP_MAGIC, sizeof(h->magic))
+		|| h->endian != SNAP_ENDIAN
+		|| h->ver != SNAP_VER
+		|| h->hdr_size != sizeof(struct snap_hdr)
+		|| h->size != size)
+		return -1;
+
+	const char *p = data + sizeof(struct snap_hdr), *end = data + size;
+	for (uint64 i = 0;  i != h->n;  i++) {
+		const struct snap_ent *se = (void*)p;
+		if ((size_t)(end - p) < sizeof(struct snap_ent)
+			|| se->size < sizeof(struct snap_ent) || se->size > (size_t)(end - p)
+			|| (se->size % 4) != 0
+			|| se->url_len >= se->size - sizeof(struct snap_ent))
+			return -1;
+
+		struct snap_pair sp;
+		ffstr name, val;
+		const char *pp = p + sizeof(struct snap_ent) + se->url_len + 1, *pend = p + se->size;
+		for (uint k = 0;  k != se->npairs;  k++) {
+			if (NULL == (pp = snap_pair_next(pp, pend, &sp, &name, &val)))
+				return -1;
+			if ((sp.flags & SNAP_NUM) && sp.val_len != sizeof(int64))
+				return -1;
+		}
+		p += se->size;
+	}
+	return (p == end) ? 0 : -1;
+}
+
+/** Load playlist from snapshot if it's not older than the playlist file. */
+static int snap_load(plist *pl, const char *fn)
+{
+	int rc = -1;
+	fffd f = FF_BADFD;
+	fffileinfo fi;
+	fftime mt_list, mt_snap;
+	ffarr fname = {};
+	struct snap *s = NULL;
+	entry **arr = NULL;
+	size_t n = 0;
+
+	if (pl->snap != NULL || plist_len(pl) != 0)
+		return -1; // only an empty playlist can be loaded from snapshot
+
+	if (0 == ffstr_catfmt(&fname, "%s" SNAP_EXT "%Z", fn))
+		goto end;
+	if (0 != fffile_infofn(fn, &fi))
+		goto end;
+	mt_list = fffile_infomtime(&fi);
+	if (0 != fffile_infofn(fname.ptr, &fi))
+		goto end;
+	mt_snap = fffile_infomtime(&fi);
+	if (fftime_cmp(&mt_snap, &mt_list) < 0) {
+		dbglog0("%s: snapshot is older than the playlist", fname.ptr);
+		goto end;
+	}
+
+	if (FF_BADFD == (f = fffile_open(fname.ptr, FFO_RDONLY | FFO_NOATIME)))
+		goto end;
+	if (NULL == (s = ffmem_new(struct snap)))
+		goto end;
+	s->size = fffile_infosize(&fi);
+	if (s->size < sizeof(struct snap_hdr))
+		goto end;
+	fffd hmap = ffmap_create(f, s->size, FFMAP_PAGEREAD);
+	if (hmap == FF_BADFD)
+		goto end;
+	s->map = ffmap_open(hmap, 0, s->size, PROT_READ, MAP_SHARED);
+	ffmap_close(hmap);
+	if (s->map == NULL)
+		goto end;
+	fffile_safeclose(f);
+
+	if (0 != snap_check(s->map, s->size)) {
+		errlog(core, NULL, "que", "%s: bad snapshot data", fname.ptr);
+		goto end;
+	}
+
+	const struct snap_hdr *h = s->map;
+	if (NULL == (arr = ffmem_allocT(h->n + 1, entry*)))
+		goto end;
+
+	const char *p = (char*)s->map + sizeof(struct snap_hdr);
+	for (;  n != h->n;  n++) {
+		const struct snap_ent *se = (void*)p;
+		entry *e;
+		if (NULL == (e = ffmem_calloc(1, sizeof(entry) + se->url_len + 1)))
+			goto end;
+		arr[n] = e;
+		e->plist = pl;
+		ffmemcpy(e->url, p + sizeof(struct snap_ent), se->url_len + 1);
+		ffstr_set(&e->e.url, e->url, se->url_len);
+		e->e.from = se->from;
+		e->e.to = se->to;
+		e->e.dur = se->dur;
+
+		// track properties are few: copy them now;  meta is parsed on demand
+		struct snap_pair sp;
+		ffstr name, val;
+		uint nmeta = 0;
+		const char *pp = p + sizeof(struct snap_ent) + se->url_len + 1, *pend = p + se->size;
+		for (uint k = 0;  k != se->npairs;  k++) {
+			pp = snap_pair_next(pp, pend, &sp, &name, &val);
+			if (sp.flags & SNAP_DICT)
+				que_dict_set(e, &name, &val, (sp.flags & SNAP_NUM) ? FMED_QUE_NUM : 0);
+			else
+				nmeta++;
+		}
+		if (nmeta != 0) {
+			e->snap = se;
+			s->refs++;
+		}
+
+		p += se->size;
+	}
+
+	fflk_lock(&qu->plist_lock);
+	for (size_t i = 0;  i != n;  i++) {
+		fflist_ins(&pl->ents, &arr[i]->sib);
+	}
+	plist_fromarr(pl, arr, n);
+	if (s->refs != 0) {
+		pl->snap = s;
+		s = NULL;
+	}
+	fflk_unlock(&qu->plist_lock);
+	n = 0;
+
+	dbglog0("loaded %U entries from snapshot %s", h->n, fname.ptr);
+	rc = 0;
+
+end:
+	for (size_t i = 0;  i != n;  i++) {
+		arr[i]->snap = NULL;
+		ent_free(arr[i]);
+	}
+	ffmem_safefree(arr);
+	if (s != NULL) {
+		if (s->map != NULL)
+			ffmap_unmap(s->map, s->size);
+		ffmem_free(s);
+	}
+	fffile_safeclose(f);
+	ffarr_free(&fname);
+	return rc;
+}
+
+// META CACHE
+/*
+Meta and duration of local files parsed by expand tracks, stored in "<user_path>/meta.cache".
+A record is valid while the file's size, modification time and ID are the same.
+The expansion scheduler applies a valid record to the entry instead of starting a track;
+ expand tracks update the cache when they finish.
+The file is loaded by a separate thread on startup.  Until then the records stored by expand tracks are used,
+ and they take precedence over the loaded ones.
+When the cache is full, the records which weren't used recently are removed (CLOCK algorithm).
+A record is removed also if the file has changed.
+
+mcache_hdr
+mcache_rec[n]:
+  path[path_len] \0
+  (snap_pair name[name_len] \0 value[val_len] \0)[npairs]
+Records are 8-byte aligned.
+*/
+
+#define MCACHE_FN  "meta.cache"
+#define MCACHE_MAGIC  "fmmetac"
+
+enum {
+	MCACHE_VER = 1,
+	MCACHE_CAP = 4096, // initial hash table size (power of 2)
+	MCACHE_MAX = 1000000, // max. number of records
+};
+
+struct mcache_hdr {
+	char magic[7];
+	byte ver;
+	ushort endian;
+	ushort hdr_size;
+	uint n;
+};
+
+/** File identity. */
+struct mcache_key {
+	uint64 size;
+	uint64 id;
+	fftime mtime;
+};
+
+struct mcache_rec {
+	uint size; // size of the record
+	uint path_len;
+	struct mcache_key key;
+	int dur;
+	uint npairs;
+};
+
+struct mcache_ent {
+	struct mcache_ent *next;
+	uint hash;
+	uint used; // set on access, cleared by eviction
+	struct mcache_rec rec; // followed by the record data
+};
+
+#define mcache_path(r)  ((char*)(r) + sizeof(struct mcache_rec))
+
+/** Get the identity of a local file.
+Return 0 if the entry may use the cache. */
+static int mcache_fkey(const entry *e, struct mcache_key *k)
+{
+	fffileinfo fi;
+
+	if (!qu->conf.meta_cache
+		|| e->e.from != 0 || e->e.to != 0
+		|| -1 != ffstr_findz(&e->e.url, "://")
+		|| FMED_FT_FILE != core->cmd(FMED_FILETYPE, e->e.url.ptr)
+		|| 0 != fffile_infofn(e->e.url.ptr, &fi))
+		return -1;
+
+	ffmem_tzero(k);
+	k->size = fffile_infosize(&fi);
+	k->mtime = fffile_infomtime(&fi);
+#ifdef FF_UNIX
+	k->id = fi.st_ino;
+#else
+	k->id = 0; // file index isn't available from file attributes
+#endif
+	return 0;
+}
+
+static struct mcache_ent** mcache_findp(struct mcache *c, const char *path, size_t len, uint hash)
+{
+	struct mcache_ent **pe;
+	for (pe = &c->tab[hash & (c->cap - 1)];  *pe != NULL;  pe = &(*pe)->next) {
+		if ((*pe)->hash == hash
+			&& (*pe)->rec.path_len == len
+			&& !ffmemcmp(mcache_path(&(*pe)->rec), path, len))
+			break;
+	}
+	return pe;
+}
+
+/** Remove at least 1/16 of the records: skip those used since the previous check. */
+static void mcache_evict(struct mcache *c)
+{
+	struct mcache_ent **pe, *it;
+	uint n = 0;
+
+	while (n < MCACHE_MAX / 16) {
+		for (pe = &c->tab[c->hand];  *pe != NULL;  ) {
+			it = *pe;
+			if (it->used) {
+				it->used = 0;
+				pe = &it->next;
+				continue;
+			}
+			*pe = it->next;
+			ffmem_free(it);
+			c->n--;
+			n++;
+		}
+		c->hand = (c->hand + 1) & (c->cap - 1);
+	}
+	c->dirty = 1;
+	dbglog0("meta cache: removed %u records", n);
+}
+
+/** Add new record or replace the existing one. */
+static void mcache_ins(struct mcache *c, struct mcache_ent *ent)
+{
+	ent->hash = meta_hash(mcache_path(&ent->rec), ent->rec.path_len, 0);
+
+	if (c->n == c->cap) {
+		// rehash
+		struct mcache_ent **tab, *it, *next;
+		uint cap = c->cap * 2;
+		if (NULL != (tab = ffmem_callocT(cap, struct mcache_ent*))) {
+			for (uint i = 0;  i != c->cap;  i++) {
+				for (it = c->tab[i];  it != NULL;  it = next) {
+					next = it->next;
+					it->next = tab[it->hash & (cap - 1)];
+					tab[it->hash & (cap - 1)] = it;
+				}
+			}
+			ffmem_free(c->tab);
+			c->tab = tab;
+			c->cap = cap;
+		}
+	}
+
+	struct mcache_ent **pe = mcache_findp(c, mcache_path(&ent->rec), ent->rec.path_len, ent->hash);
+	if (*pe != NULL) {
+		ent->next = (*pe)->next;
+		ffmem_free(*pe);
+		*pe = ent;
+		return;
+	}
+
+	if (c->n == MCACHE_MAX) {
+		mcache_evict(c);
+		pe = mcache_findp(c, mcache_path(&ent->rec), ent->rec.path_len, ent->hash);
+	}
+	ent->next = NULL;
+	*pe = ent;
+	c->n++;
+}
+
+/** Check record data. */
+static int mcache_check(const struct mcache_rec *r, size_t avail)
+{
+	if (avail < sizeof(struct mcache_rec)
+		|| r->size < sizeof(struct mcache_rec) || r->size > avail
+		|| (r->size % 8) != 0
+		|| r->path_len >= r->size - sizeof(struct mcache_rec))
+		return -1;
+
+	struct snap_pair sp;
+	ffstr name, val;
+	const char *p = mcache_path(r) + r->path_len + 1, *end = (char*)r + r->size;
+	for (uint i = 0;  i != r->npairs;  i++) {
+		if (NULL == (p = snap_pair_next(p, end, &sp, &name, &val)))
+			return -1;
+	}
+	return 0;
+}
+
+/** Read cache file into the table which isn't shared yet. */
+static void mcache_load(struct mcache *c)
+{
+	char *fn = NULL;
+	fffd f = FF_BADFD;
+	ffarr buf = {};
+
+	c->cap = MCACHE_CAP;
+	if (NULL == (c->tab = ffmem_callocT(c->cap, struct mcache_ent*)))
+		return;
+
+	if (NULL == (fn = ffsz_alfmt("%s%s", core->props->user_path, MCACHE_FN)))
+		goto end;
+	if (FF_BADFD == (f = fffile_open(fn, FFO_RDONLY | FFO_NOATIME)))
+		goto end;
+	uint64 fsz = fffile_size(f);
+	if ((int64)fsz < (int64)sizeof(struct mcache_hdr)
+		|| NULL == ffarr_alloc(&buf, fsz)
+		|| fsz != (uint64)fffile_read(f, buf.ptr, fsz))
+		goto end;
+
+	const struct mcache_hdr *h = (void*)buf.ptr;
+	if (ffmemcmp(h->magic, MCACHE_MAGIC, sizeof(h->magic))
+		|| h->ver != MCACHE_VER
+		|| h->endian != SNAP_ENDIAN
+		|| h->hdr_size != sizeof(struct mcache_hdr)) {
+		dbglog0("%s: unsupported format", fn);
+		goto end;
+	}
+
+	const char *p = buf.ptr + sizeof(struct mcache_hdr), *end = buf.ptr + fsz;
+	for (uint i = 0;  i != h->n;  i++) {
+		struct mcache_rec *r = (void*)p;
+		if (0 != mcache_check(r, end - p)) {
+			errlog(core, NULL, "que", "%s: bad data", fn);
+			break;
+		}
+
+		struct mcache_ent *ent;
+		if (NULL == (ent = ffmem_alloc(sizeof(struct mcache_ent) - sizeof(struct mcache_rec) + r->size)))
+			break;
+		ffmemcpy(&ent->rec, r, r->size);
+		ent->used = 0;
+		mcache_ins(c, ent);
+		p += r->size;
+	}
+
+	dbglog0("%s: loaded %u records", fn, c->n);
+
+end:
+	fffile_safeclose(f);
+	ffarr_free(&buf);
+	ffmem_safefree(fn);
+}
+
+/** Load the cache file and merge its records into the shared table.  Thread: loader. */
+static int FFTHDCALL mcache_loader(void *param)
+{
+	struct mcache *c = param, tmp = {};
+	struct mcache_ent *it, *next, **pe;
+
+	mcache_load(&tmp);
+
+	for (uint i = 0;  tmp.tab != NULL && i != tmp.cap;  i++) {
+		// lock per bucket: the main thread mustn't wait for the whole table
+		fflk_lock(&c->lk);
+		for (it = tmp.tab[i];  it != NULL;  it = next) {
+			next = it->next;
+			pe = mcache_findp(c, mcache_path(&it->rec), it->rec.path_len, it->hash);
+			if (*pe != NULL) {
+				ffmem_free(it); // a newer record is stored already
+				continue;
+			}
+			mcache_ins(c, it);
+		}
+		fflk_unlock(&c->lk);
+	}
+	ffmem_safefree(tmp.tab);
+
+	fflk_lock(&c->lk);
+	c->loaded = 1;
+	fflk_unlock(&c->lk);
+	return 0;
+}
+
+/** Create the table and start loading the cache file.
+c->lk must be locked. */
+static int mcache_init(struct mcache *c)
+{
+	if (c->tab != NULL)
+		return 0;
+
+	c->cap = MCACHE_CAP;
+	if (NULL == (c->tab = ffmem_callocT(c->cap, struct mcache_ent*)))
+		return -1;
+
+	if (FFTHD_INV == (c->loader = ffthd_create(&mcache_loader, c, 0))) {
+		// the records will be used, but the file won't be overwritten
+		syserrlog("meta cache: %s", "thread create");
+		return 0;
+	}
+	c->loading = 1;
+	return 0;
+}
+
+/** Write cache file, if there were any changes.
+The file isn't written if it wasn't loaded, otherwise its records would be lost. */
+static void mcache_save(struct mcache *c)
+{
+	char *fn = NULL, *fntmp = NULL;
+	fffd f = FF_BADFD;
+	ffarr buf = {};
+	int rc = -1;
+
+	if (c->loading) {
+		ffthd_join(c->loader, -1, NULL);
+		c->loading = 0;
+	}
+
+	if (!c->dirty || !c->loaded)
+		return;
+
+	if (NULL == (fn = ffsz_alfmt("%s%s", core->props->user_path, MCACHE_FN))
+		|| NULL == (fntmp = ffsz_alfmt("%s.tmp", fn))
+		|| NULL == ffarr_alloc(&buf, SNAP_WBUF))
+		goto end;
+
+	if (FF_BADFD == (f = fffile_open(fntmp, FFO_CREATE | FFO_TRUNC | FFO_WRONLY))) {
+		if (0 != ffdir_make_path(fntmp, 0)
+			|| FF_BADFD == (f = fffile_open(fntmp, FFO_CREATE | FFO_TRUNC | FFO_WRONLY)))
+			goto end;
+	}
+
+	struct mcache_hdr h = {};
+	ffmemcpy(h.magic, MCACHE_MAGIC, sizeof(h.magic));
+	h.ver = MCACHE_VER;
+	h.endian = SNAP_ENDIAN;
+	h.hdr_size = sizeof(struct mcache_hdr);
+	h.n = c->n;
+	ffarr_append(&buf, &h, sizeof(struct mcache_hdr));
+
+	for (uint i = 0;  i != c->cap;  i++) {
+		for (struct mcache_ent *it = c->tab[i];  it != NULL;  it = it->next) {
+			if (buf.len + it->rec.size > buf.cap
+				&& 0 != snap_wflush(f, &buf))
+				goto end;
+			if (NULL == ffarr_append(&buf, &it->rec, it->rec.size))
+				goto end;
+		}
+	}
+	if (0 != snap_wflush(f, &buf))
+		goto end;
+
+	fffile_safeclose(f);
+	if (0 != fffile_rename(fntmp, fn))
+		goto end;
+	dbglog0("%s: saved %u records", fn, c->n);
+	rc = 0;
+
+end:
+	if (rc != 0) {
+		syserrlog("saving meta cache: %s", fn);
+		if (f != FF_BADFD) {
+			fffile_close(f);
+			fffile_rm(fntmp);
+		}
+	}
+	ffarr_free(&buf);
+	ffmem_safefree(fn);
+	ffmem_safefree(fntmp);
+}
+
+static void mcache_free(struct mcache *c)
+{
+	struct mcache_ent *it, *next;
+	if (c->tab == NULL)
+		return;
+	for (uint i = 0;  i != c->cap;  i++) {
+		for (it = c->tab[i];  it != NULL;  it = next) {
+			next = it->next;
+			ffmem_free(it);
+		}
+	}
+	ffmem_free(c->tab);
+}
+
+/** Set meta and duration of the entry from cache.
+Return 0 if there's a valid record for the file. */
+static int mcache_get(entry *e)
+{
+	struct mcache *c = &qu->mcache;
+	struct mcache_key k;
+	int rc = -1;
+
+	if (0 != mcache_fkey(e, &k))
+		return -1;
+
+	fflk_lock(&c->lk);
+	if (0 != mcache_init(c))
+		goto end;
+
+	uint hash = meta_hash(e->e.url.ptr, e->e.url.len, 0);
+	struct mcache_ent **pe = mcache_findp(c, e->e.url.ptr, e->e.url.len, hash), *ent = *pe;
+	if (ent == NULL)
+		goto end;
+	if (ent->rec.key.size != k.size
+		|| ent->rec.key.id != k.id
+		|| 0 != fftime_cmp(&ent->rec.key.mtime, &k.mtime)) {
+		// the file has changed: the record is of no use anymore
+		*pe = ent->next;
+		ffmem_free(ent);
+		c->n--;
+		c->dirty = 1;
+		goto end;
+	}
+	ent->used = 1;
+
+	const struct mcache_rec *r = &ent->rec;
+	struct snap_pair sp;
+	ffstr name, val;
+	const char *p = mcache_path(r) + r->path_len + 1, *pend = (char*)r + r->size;
+	for (uint i = 0;  i != r->npairs;  i++) {
+		p = snap_pair_next(p, pend, &sp, &name, &val);
+		que_meta_set(&e->e, &name, &val, FMED_QUE_TMETA | FMED_QUE_PRIV);
+	}
+	e->e.dur = r->dur;
+	dbglog0("%S: meta from cache", &e->e.url);
+	rc = 0;
+
+end:
+	fflk_unlock(&c->lk);
+	return rc;
+}
+
+/** Store meta and duration of the entry to cache. */
+static void mcache_put(entry *e)
+{
+	struct mcache *c = &qu->mcache;
+	struct mcache_key k;
+	struct mcache_ent *ent;
+	ffarr buf = {};
+
+	if (0 != mcache_fkey(e, &k))
+		return;
+
+	if (NULL == ffarr_alloc(&buf, sizeof(struct mcache_ent) + e->e.url.len + 1 + 256))
+		return;
+	buf.len = sizeof(struct mcache_ent);
+	ffarr_append(&buf, e->e.url.ptr, e->e.url.len);
+	*ffarr_push(&buf, char) = '\0';
+
+	uint n = 0;
+	fflk_lock(&qu->plist_lock);
+	for (uint i = 0;  i != e->tmeta.len;  i++) {
+		ffstr name = meta_name(e->tmeta.ptr[i].name);
+		if (0 != snap_wpair(&buf, 0, &name, e->tmeta.ptr[i].val.ptr, e->tmeta.ptr[i].val.len))
+			break;
+		n++;
+	}
+	fflk_unlock(&qu->plist_lock);
+
+	size_t pad = ff_align_ceil2(buf.len, 8) - buf.len;
+	if (NULL == ffarr_grow(&buf, pad, 0)) {
+		ffarr_free(&buf);
+		return;
+	}
+	ffmem_zero(ffarr_end(&buf), pad);
+	buf.len += pad;
+
+	ent = (void*)buf.ptr;
+	ent->rec.size = buf.len - FFOFF(struct mcache_ent, rec);
+	ent->rec.path_len = e->e.url.len;
+	ent->rec.key = k;
+	ent->rec.dur = e->e.dur;
+	ent->rec.npairs = n;
+	ent->used = 1;
+
+	fflk_lock(&c->lk);
+	if (0 == mcache_init(c)) {
+		mcache_ins(c, ent);
+		c->dirty = 1;
+		buf.ptr = NULL;
+	}
+	fflk_unlock(&c->lk);
+	ffarr_free(&buf);
+}
+
+// GAPLESS
+/*
+A few seconds before the end of the current track (#queue.gapless filter sees it)
+ the next track is created and started, but its #queue.gapless filter (placed right after the decoder)
+ holds the first decoded data.
+When the current track reaches its end, the filter sets 'snd_output_gapless' so that
+ the audio output doesn't drain the device and leaves it running.
+After the current track is finished, the next one is released and continues writing to the same device.
+If the current track is stopped (or anything else but normal completion), the prepared track is stopped too.
+*/
+
+enum GL_STATE {
+	GL_WAIT, // the prepared track must wait at the gate
+	GL_OPEN, // the prepared track may continue
+	GL_CANCEL, // the prepared track must exit
+};
+
+enum GLF_STATE {
+	GLF_GATE,
+	GLF_MONITOR,
+	GLF_PASS,
+};
+
+struct gapless_filt {
+	entry *e;
+	uint state; //enum GLF_STATE
+};
+
+/** Prepare the next track.  Thread: main.
+The caller holds a reference to 'e'. */
+static void gl_prepare(entry *e)
+{
+	struct gapless *gl = &qu->gl;
+	entry *next;
+
+	if (e->refcount == 1 // already finished: only the caller's reference is left
+		|| e->plist->cur != e
+		|| e->stop_after
+		|| qu->mixing
+		|| e->plist->parallel
+		|| (e->plist->allow_random && qu->random))
+		return;
+
+	fflk_lock(&gl->lk);
+	uint busy = (gl->trk != NULL);
+	fflk_unlock(&gl->lk);
+	if (busy)
+		return;
+
+	if (e->sib.next != fflist_sentl(&e->plist->ents))
+		next = FF_GETPTR(entry, sib, e->sib.next);
+	else if (qu->repeat_all && e->plist->ents.first != &e->sib)
+		next = FF_GETPTR(entry, sib, e->plist->ents.first);
+	else
+		return;
+
+	if (next == e
+		|| -1 != que_arrfind(next->dict.ptr, next->dict.len, FFSTR("output")))
+		return;
+
+	dbglog(core, NULL, "que", "gapless: preparing %S", &next->e.url);
+	gl->cur = e;
+	gl->next = next;
+	if (NULL == que_play2(next, QUE_PLAY_GAPLESS)) {
+		gl->cur = NULL;
+		gl->next = NULL;
+	}
+}
+
+/** Called by que_play2() before the prepared track is started. */
+static void gl_wait(void *trk)
+{
+	struct gapless *gl = &qu->gl;
+	fflk_lock(&gl->lk);
+	gl->trk = trk;
+	gl->state = GL_WAIT;
+	gl->waiting = 0;
+	fflk_unlock(&gl->lk);
+}
+
+/** Track is finished.  Thread: main.
+Return 1 if the next track must not be started. */
+static int gl_ontrkfin(entry *e)
+{
+	struct gapless *gl = &qu->gl;
+
+	if (e == gl->next && e != gl->cur) {
+		fflk_lock(&gl->lk);
+		uint released = (gl->state == GL_OPEN);
+		fflk_unlock(&gl->lk);
+		if (!released) {
+			// the prepared track has exited before the current one was finished
+			gl->next = NULL;
+			return 1;
+		}
+		gl->next = NULL;
+		return 0;
+	}
+
+	if (e != gl->cur)
+		return 0;
+	gl->cur = NULL;
+
+	uint release = !(qu->mixing
+		|| e->stop_after
+		|| e->expand
+		|| e->trk_stopped
+		|| e->trk_err);
+
+	fflk_lock(&gl->lk);
+	void *trk = gl->trk;
+	if (trk == NULL) {
+		// the prepared track has exited already
+		fflk_unlock(&gl->lk);
+		return 0;
+	}
+
+	if (release) {
+		dbglog(core, NULL, "que", "gapless: continuing with %S", &gl->next->e.url);
+		gl->state = GL_OPEN;
+		gl->next->plist->cur = gl->next;
+	} else {
+		dbglog(core, NULL, "que", "gapless: cancelling %S", &gl->next->e.url);
+		gl->state = GL_CANCEL;
+		qu->track->cmd(trk, FMED_TRACK_STOP);
+	}
+	if (gl->waiting) {
+		gl->waiting = 0;
+		qu->track->cmd(trk, FMED_TRACK_WAKE);
+	}
+	fflk_unlock(&gl->lk);
+	return release;
+}
+
+/** Track's queue filter is closed.  Thread: worker. */
+static void gl_trkclose(void *trk)
+{
+	struct gapless *gl = &qu->gl;
+	fflk_lock(&gl->lk);
+	if (gl->trk == trk)
+		gl->trk = NULL;
+	fflk_unlock(&gl->lk);
+}
+
+static void* gl_open(fmed_filt *d)
+{
+	struct gapless_filt *g;
+	entry *e = (void*)d->track->getval_id(d->trk, FMED_TRKV_QUEUE_ITEM);
+
+	if ((int64)e == FMED_NULL)
+		return FMED_FILT_SKIP;
+	if (NULL == (g = ffmem_new(struct gapless_filt)))
+		return NULL;
+	g->e = e;
+	g->state = GLF_MONITOR;
+	if (FMED_NULL != d->track->getval(d->trk, "queue-gapless"))
+		g->state = GLF_GATE;
+	return g;
+}
+
+static void gl_close(void *ctx)
+{
+	ffmem_free(ctx);
+}
+
+static int gl_process(void *ctx, fmed_filt *d)
+{
+	struct gapless_filt *g = ctx;
+	struct gapless *gl = &qu->gl;
+
+	if (d->flags & FMED_FSTOP) {
+		d->outlen = 0;
+		if (g->state == GLF_GATE)
+			return FMED_RFIN; // don't let the next filters open the audio device
+		return FMED_RDONE;
+	}
+
+	switch (g->state) {
+	case GLF_GATE:
+		fflk_lock(&gl->lk);
+		if (gl->trk == d->trk) {
+			switch (gl->state) {
+			case GL_WAIT:
+				gl->waiting = 1;
+				fflk_unlock(&gl->lk);
+				return FMED_RASYNC; // wait until the current track is finished
+
+			case GL_CANCEL:
+				fflk_unlock(&gl->lk);
+				d->outlen = 0;
+				return FMED_RFIN;
+			}
+			gl->trk = NULL;
+		}
+		fflk_unlock(&gl->lk);
+		dbglog(core, d->trk, "que", "gapless: released");
+		g->state = GLF_MONITOR;
+		// fallthrough
+
+	case GLF_MONITOR:
+		if ((int64)d->audio.total == FMED_NULL
+			|| (int64)d->audio.until != FMED_NULL
+			|| d->audio.fmt.sample_rate == 0)
+			break;
+		if (d->audio.pos + ffpcm_samples(qu->conf.gapless * 1000, d->audio.fmt.sample_rate)
+			< d->audio.total)
+			break;
+
+		g->state = GLF_PASS;
+		struct quetask *qt = ffmem_new(struct quetask);
+		FF_ASSERT(qt != NULL);
+		qt->cmd = CMD_GAPLESS;
+		qt->param = (size_t)g->e;
+		ent_ref(g->e); // the entry must live until the task is handled
+		que_task_add(qt);
+		break;
+
+	case GLF_PASS:
+		break;
+	}
+
+	if (d->flags & FMED_FLAST) {
+		fflk_lock(&gl->lk);
+		if (gl->cur == g->e && gl->trk != NULL && gl->state == GL_WAIT)
+			d->snd_output_gapless = 1;
+		fflk_unlock(&gl->lk);
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_ROK;
+}
+
+// EXPANSION SCHEDULER
+/*
+FMED_QUE_EXPAND puts the entry into the pending list:
+ directories and playlists added by user, and local files whose rows GUI displays without duration.
+The scheduler (on the main thread) takes the meta of a local file from the meta cache if it's there,
+ otherwise starts an expand track: up to 'expand_parallel' tracks at once, spreading them across workers.
+Which entry goes first:
+  . the entries following the currently playing one
+  . the entries around the one displayed by the user most recently (FMED_QUE_SET_VISIBLE)
+  . the others in the order they were added
+The user is notified about finished expansions with one FMED_QUE_ONUPDATE per XSCHED_NOTIFY_MS.
+*/
+
+/** Get the number of CPUs. */
+static uint que_ncpu(void)
+{
+	ffsysconf sc;
+	ffsc_init(&sc);
+	int n = ffsc_get(&sc, _SC_NPROCESSORS_ONLN);
+	return ffmax(n, 1);
+}
+
+static uint xsched_limit(void)
+{
+	if (qu->conf.expand_parallel == 0)
+		qu->conf.expand_parallel = ffmin(que_ncpu(), 255);
+	return qu->conf.expand_parallel;
+}
+
+/** Schedule the entry for expansion.  Thread-safe.
+meta_only: the entry is a local file which needs meta and duration: skip if it's expanded already */
+static void xsched_add(entry *e, uint meta_only)
+{
+	struct xsched *xs = &qu->xsched;
+	uint post = 0;
+
+	if (meta_only && -1 != ffstr_findz(&e->e.url, "://"))
+		return;
+
+	fflk_lock(&xs->lk);
+	if (e->xpending || e->xsched
+		|| (meta_only && e->xdone)) {
+		fflk_unlock(&xs->lk);
+		return;
+	}
+	ent_ref(e);
+	e->xpending = 1;
+	fflist_ins(&xs->pending, &e->xsib);
+	if (!xs->run_posted) {
+		xs->run_posted = 1;
+		post = 1;
+	}
+	fflk_unlock(&xs->lk);
+
+	if (post)
+		core->task(&xs->tsk_run, FMED_TASK_POST);
+}
+
+/** Find the pending entry that should be expanded first.
+Both plist_lock and xsched.lk must be locked. */
+static entry* xsched_pick(struct xsched *xs)
+{
+	entry *e;
+	plist *pl = qu->curlist;
+	ssize_t cur;
+
+	if (pl->cur != NULL
+		&& -1 != (cur = plist_ent_idx(pl, pl->cur))) {
+		for (uint i = 1;  i <= XSCHED_AHEAD;  i++) {
+			if (NULL == (e = plist_ent(pl, cur + i)))
+				break;
+			if (e->xpending)
+				goto done;
+		}
+	}
+
+	// the indexes shown by GUI refer to the filtered list, if there's one
+	if (pl->filtered_plist != NULL)
+		pl = pl->filtered_plist;
+	size_t vis = FF_READONCE(xs->visible);
+	if (vis != (size_t)-1) {
+		size_t i = (vis > XSCHED_VISIBLE) ? vis - XSCHED_VISIBLE : 0;
+		for (;  i != vis + XSCHED_VISIBLE;  i++) {
+			if (NULL == (e = plist_ent(pl, i)))
+				break;
+			if (e->xpending)
+				goto done;
+		}
+	}
+
+	e = FF_GETPTR(entry, xsib, xs->pending.first);
+
+done:
+	return e;
+}
+
+static int xsched_start(entry *e)
+{
+	void *trk = qu->track->create(FMED_TRK_TYPE_EXPAND, e->e.url.ptr);
+	if (trk == NULL || trk == FMED_TRK_EFMT)
+		return -1;
+	fmed_trk *t = qu->track->conf(trk);
+	t->input_info = 1;
+	qu->track->setval(trk, "queue_item", (int64)e);
+	qu->track->setval(trk, "queue-xsched", 1);
+	qu->track->cmd(trk, (xsched_limit() > 1) ? FMED_TRACK_XSTART : FMED_TRACK_START);
+	return 0;
+}
+
+/** Start expand tracks while there are free slots. */
+static void xsched_run(void *param)
+{
+	struct xsched *xs = &qu->xsched;
+	entry *e;
+
+	fflk_lock(&xs->lk);
+	xs->run_posted = 0;
+	fflk_unlock(&xs->lk);
+
+	for (;;) {
+		e = NULL;
+		fflk_lock(&qu->plist_lock);
+		fflk_lock(&xs->lk);
+		if (xs->pending.len != 0 && xs->inflight < xsched_limit()) {
+			e = xsched_pick(xs);
+			fflist_rm(&xs->pending, &e->xsib);
+			e->xpending = 0;
+			e->xsched = 1;
+			xs->inflight++;
+		}
+		fflk_unlock(&xs->lk);
+		fflk_unlock(&qu->plist_lock);
+		if (e == NULL)
+			break;
+
+		if (!e->rm && 0 == mcache_get(e)) {
+			xsched_fin(e);
+			ent_unref(e);
+			continue;
+		}
+
+		if (e->rm || 0 != xsched_start(e)) {
+			fflk_lock(&xs->lk);
+			e->xsched = 0;
+			xs->inflight--;
+			fflk_unlock(&xs->lk);
+			ent_unref(e);
+		}
+	}
+}
+
+static void xsched_notify(void *param)
+{
+	struct xsched *xs = &qu->xsched;
+
+	fflk_lock(&xs->lk);
+	uint n = xs->ndone;
+	xs->ndone = 0;
+	xs->tmr_active = 0;
+	fflk_unlock(&xs->lk);
+
+	if (n != 0 && qu->onchange != NULL)
+		qu->onchange(NULL, FMED_QUE_ONUPDATE);
+}
+
+/** The entry is expanded: the user will be notified by timer. */
+static void xsched_fin(entry *e)
+{
+	struct xsched *xs = &qu->xsched;
+	uint tmr = 0;
+
+	fflk_lock(&xs->lk);
+	e->xsched = 0;
+	e->xdone = 1;
+	xs->inflight--;
+	xs->ndone++;
+	if (!xs->tmr_active) {
+		xs->tmr_active = 1;
+		tmr = 1;
+	}
+	fflk_unlock(&xs->lk);
+
+	if (tmr)
+		core->timer(&xs->tmr, -XSCHED_NOTIFY_MS, 0);
+}
+
+/** Expand track has finished. */
+static void xsched_done(entry *e)
+{
+	xsched_fin(e);
+	xsched_run(NULL);
+}
+
+static entry* que_getnext(entry *from)
+{
+	ffchain_item *it;
+	plist *pl = (from == NULL) ? qu->curlist : from->plist;
+	fflist *ents = &pl->ents;
+
+	if (pl->allow_random && qu->random && plist_len(pl) != 0) {
+		rnd_init();
+		size_t i = ffrnd_get() % plist_len(pl);
+		entry *e = plist_ent(pl, i);
+		return e;
+	}
+
+	it = (from == NULL) ? ents->first : from->sib.next;
+	if (it == fflist_sentl(ents)) {
+		if (qu->repeat_all)
+			it = ents->first;
+
+		if (it == fflist_sentl(ents)) {
+			dbglog(core, NULL, "que", "no next file in playlist");
+			qu->track->cmd(NULL, FMED_TRACK_LAST);
+			return NULL;
+		}
+
+		dbglog(core, NULL, "que", "repeat_all: starting from the beginning");
+	}
+
+	return FF_GETPTR(entry, sib, it);
+}
+
+static void que_mix(void)
+{
+	fflist *ents = &qu->curlist->ents;
+	void *mxout;
+	entry *e;
+
+	if (NULL == (mxout = qu->track->create(FMED_TRACK_MIX, NULL)))
+		return;
+	qu->track->setval(mxout, "mix_tracks", ents->len);
+	ent_ref(mxout);
+	qu->track->cmd(mxout, FMED_TRACK_START);
+
+	qu->mixing = 1;
+	FFLIST_WALK(ents, e, sib) {
+		que_play(e);
+	}
+}
+
+/** Get playlist by its index. */
+static plist* plist_by_idx(size_t idx)
+{
+	uint i = 0;
+	fflist_item *li;
+	FFLIST_FOREACH(&qu->plists, li) {
+		if (i++ == idx)
+			return FF_GETPTR(plist, sib, li);
+	}
+	return NULL;
+}
+
+// SORT
+
+enum {
+	SORT_MAXKEYS = 4,
+	SORT_RUN = 16, // sort runs of this size by insertion
+	SORT_PARALLEL_MIN = 64 * 1024, // sort in parallel only lists larger than this
+	SORT_MAXTHREADS = 8,
+	SORT_ATTEMPTS = 3, // sort again if the list has changed meanwhile, but not more than this
+	SORT_URL = -2,
+	SORT_DUR = -3,
+};
+
+/** Key types in sort order. */
+enum SKEY_T {
+	SKEY_NUM,
+	SKEY_STR,
+	SKEY_NONE, // no value: sorts after any value
+};
+
+/** Normalized sort key of an entry. */
+struct skey {
+	uint type; //enum SKEY_T
+	uint len;
+	union {
+		int64 num;
+		size_t off; // offset of the string in sort_job.buf, until the job's keys are complete
+		const char *ptr; // collation key: UTF-8 string, see coll_fold()
+	};
+};
+
+struct sitem {
+	entry *e;
+	const struct skey *k; //[nkeys]
+};
+
+struct plist_sortdata;
+
+/** Sort a contiguous part of the list. */
+struct sort_job {
+	struct plist_sortdata *ps;
+	size_t off, n;
+	ffarr buf; // collation keys
+	ffthd th;
+};
+
+struct plist_sortdata {
+	uint nkeys;
+	int keys[SORT_MAXKEYS]; // meta key;  SORT_URL;  SORT_DUR;  -1: meta name isn't known by any entry
+	uint reverse :1;
+	entry **ents;
+	size_t n;
+	struct skey *skeys; //[n * nkeys]
+	struct sitem *items, *tmp;
+	struct sort_job jobs[SORT_MAXTHREADS];
+	uint njobs;
+};
+
+/** Parse the value as a number: "12" or "12/20" (track number). */
+static int skey_num(const ffstr *s, int64 *num)
+{
+	size_t i;
+	uint64 n = 0;
+	for (i = 0;  i != s->len && i != 18 && s->ptr[i] >= '0' && s->ptr[i] <= '9';  i++) {
+		n = n * 10 + (s->ptr[i] - '0');
+	}
+	if (i == 0 || (i != s->len && s->ptr[i] != '/'))
+		return 0;
+	*num = n;
+	return 1;
+}
+
+/** Base Latin letter of U+00C0..U+017F;  '.': keep the character */
+static const char coll_latin[] =
+	"aaaaaaaceeeeiiiidnooooo.ouuuuy.saaaaaaaceeeeiiiidnooooo.ouuuuy.y" // U+00C0
+	"aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiiijjkkkllllllllll" // U+0100
+	"nnnnnnnnnoooooooorrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs"; // U+0143
+
+/** Get the primary collation weight of a character:
+ letters are compared without case and diacritics (Latin, Greek, Cyrillic). */
+static uint coll_fold(uint c)
+{
+	if (c < 0x80)
+		return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+	if (c == 0xde)
+		return 0xfe; // thorn
+	if (c >= 0xc0 && c < 0x180) {
+		uint b = (byte)coll_latin[c - 0xc0];
+		return (b != '.') ? b : c;
+	}
+	if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2)
+		return c + 0x20;
+	if (c == 0x3c2)
+		return 0x3c3; // final sigma
+	if (c == 0x401 || c == 0x451)
+		return 0x435; // io -> ie
+	if (c >= 0x400 && c <= 0x40f)
+		return c + 0x50;
+	if (c >= 0x410 && c <= 0x42f)
+		return c + 0x20;
+	return c;
+}
+
+/** Decode UTF-8 character.
+Return the number of bytes;  0 if the sequence is invalid. */
+static uint coll_utf8_dec(const byte *s, size_t len, uint *c)
+{
+	uint n, ch = s[0];
+	if (ch < 0x80) {
+		*c = ch;
+		return 1;
+	} else if ((ch & 0xe0) == 0xc0) {
+		n = 2;
+		ch &= 0x1f;
+	} else if ((ch & 0xf0) == 0xe0) {
+		n = 3;
+		ch &= 0x0f;
+	} else if ((ch & 0xf8) == 0xf0) {
+		n = 4;
+		ch &= 0x07;
+	} else
+		return 0;
+
+	if (len < n)
+		return 0;
+	for (uint i = 1;  i != n;  i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		ch = (ch << 6) | (s[i] & 0x3f);
+	}
+	*c = ch;
+	return n;
+}
+
+static uint coll_utf8_enc(char *d, uint c)
+{
+	if (c < 0x80) {
+		d[0] = c;
+		return 1;
+	} else if (c < 0x800) {
+		d[0] = 0xc0 | (c >> 6);
+		d[1] = 0x80 | (c & 0x3f);
+		return 2;
+	} else if (c < 0x10000) {
+		d[0] = 0xe0 | (c >> 12);
+		d[1] = 0x80 | ((c >> 6) & 0x3f);
+		d[2] = 0x80 | (c & 0x3f);
+		return 3;
+	}
+	d[0] = 0xf0 | (c >> 18);
+	d[1] = 0x80 | ((c >> 12) & 0x3f);
+	d[2] = 0x80 | ((c >> 6) & 0x3f);
+	d[3] = 0x80 | (c & 0x3f);
+	return 4;
+}
+
+/** Store the collation key of the string: UTF-8 of the characters' weights.
+Byte order of UTF-8 is the order of code points, so the keys are compared with memcmp().
+A weight is never encoded longer than its character, invalid bytes are copied as is. */
+static int skey_str(struct sort_job *j, struct skey *k, const ffstr *s)
+{
+	if (NULL == ffarr_grow(&j->buf, s->len, FFARR_GROWQUARTER))
+		return -1;
+	char *d = ffarr_end(&j->buf), *d0 = d;
+	const byte *p = (byte*)s->ptr, *end = (byte*)s->ptr + s->len;
+	while (p != end) {
+		uint c, n = coll_utf8_dec(p, end - p, &c);
+		if (n == 0) {
+			*d++ = *p++;
+			continue;
+		}
+		p += n;
+		d += coll_utf8_enc(d, coll_fold(c));
+	}
+	k->type = SKEY_STR;
+	k->off = j->buf.len;
+	k->len = d - d0;
+	j->buf.len += d - d0;
+	return 0;
+}
+
+/** Extract sort keys of the entry. */
+static int skey_fill(struct sort_job *j, entry *e, struct skey *k)
+{
+	const struct plist_sortdata *ps = j->ps;
+	for (uint i = 0;  i != ps->nkeys;  i++, k++) {
+		ffstr *val;
+		k->type = SKEY_NONE;
+
+		switch (ps->keys[i]) {
+		case SORT_DUR:
+			k->type = SKEY_NUM;
+			k->num = e->e.dur;
+			break;
+
+		case SORT_URL:
+			if (0 != skey_str(j, k, &e->e.url))
+				return -1;
+			break;
+
+		case -1:
+			break;
+
+		default:
+			if (NULL == (val = ent_meta_find(e, ps->keys[i])))
+				break;
+			if (skey_num(val, &k->num)) {
+				k->type = SKEY_NUM;
+				break;
+			}
+			if (0 != skey_str(j, k, val))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int skey_cmp(const struct skey *a, const struct skey *b)
+{
+	if (a->type != b->type)
+		return (a->type < b->type) ? -1 : 1;
+
+	switch (a->type) {
+	case SKEY_NUM:
+		return ffint_cmp(a->num, b->num);
+
+	case SKEY_STR: {
+		int r = ffmemcmp(a->ptr, b->ptr, ffmin(a->len, b->len));
+		if (r != 0)
+			return r;
+		return ffint_cmp(a->len, b->len);
+	}
+	}
+	return 0;
+}
+
+/** Compare two entries by all keys. */
+static int sitem_cmp(const struct plist_sortdata *ps, const struct sitem *a, const struct sitem *b)
+{
+	for (uint i = 0;  i != ps->nkeys;  i++) {
+		int r = skey_cmp(&a->k[i], &b->k[i]);
+		if (r != 0)
+			return (ps->reverse) ? -r : r;
+	}
+	return 0;
+}
+
+/** Merge two sorted arrays.  Items from the left array go first if equal. */
+static void sort_merge(const struct plist_sortdata *ps, struct sitem *dst
+	, const struct sitem *l, size_t nl, const struct sitem *r, size_t nr)
+{
+	size_t i = 0, j = 0;
+	while (i != nl && j != nr) {
+		if (sitem_cmp(ps, &r[j], &l[i]) < 0)
+			*dst++ = r[j++];
+		else
+			*dst++ = l[i++];
+	}
+	ffmemcpy(dst, &l[i], (nl - i) * sizeof(struct sitem));
+	ffmemcpy(dst + nl - i, &r[j], (nr - j) * sizeof(struct sitem));
+}
+
+/** Stable bottom-up merge sort.
+@tmp: buffer of the same size */
+static void sort_items(const struct plist_sortdata *ps, struct sitem *a, struct sitem *tmp, size_t n)
+{
+	for (size_t lo = 0;  lo < n;  lo += SORT_RUN) {
+		size_t hi = ffmin(lo + SORT_RUN, n);
+		for (size_t i = lo + 1;  i < hi;  i++) {
+			struct sitem x = a[i];
+			size_t j;
+			for (j = i;  j != lo && sitem_cmp(ps, &a[j - 1], &x) > 0;  j--) {
+				a[j] = a[j - 1];
+			}
+			a[j] = x;
+		}
+	}
+
+	struct sitem *src = a, *dst = tmp, *t;
+	for (size_t w = SORT_RUN;  w < n;  w *= 2) {
+		for (size_t lo = 0;  lo < n;  lo += 2 * w) {
+			size_t mid = ffmin(lo + w, n), hi = ffmin(lo + 2 * w, n);
+			sort_merge(ps, &dst[lo], &src[lo], mid - lo, &src[mid], hi - mid);
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != a)
+		ffmemcpy(a, src, n * sizeof(struct sitem));
+}
+
+/** Extract the keys of a part of the list.
+The values are copied into the job's buffer, so the entries aren't accessed while sorting. */
+static int sort_job_keys(struct sort_job *j)
+{
+	struct plist_sortdata *ps = j->ps;
+	struct skey *k = &ps->skeys[j->off * ps->nkeys];
+	struct sitem *it = &ps->items[j->off];
+
+	for (size_t i = 0;  i != j->n;  i++) {
+		entry *e = ps->ents[j->off + i];
+		if (0 != skey_fill(j, e, &k[i * ps->nkeys]))
+			return -1;
+		it[i].e = e;
+		it[i].k = &k[i * ps->nkeys];
+	}
+
+	// the buffer won't be reallocated anymore: convert offsets to pointers
+	for (size_t i = 0;  i != j->n * ps->nkeys;  i++) {
+		if (k[i].type == SKEY_STR)
+			k[i].ptr = j->buf.ptr + k[i].off;
+	}
+	return 0;
+}
+
+/** Sort a part of the list by the extracted keys. */
+static int FFTHDCALL sort_job_run(void *param)
+{
+	struct sort_job *j = param;
+	sort_items(j->ps, &j->ps->items[j->off], &j->ps->tmp[j->off], j->n);
+	return 0;
+}
+
+/** Get the number of threads to sort 'n' entries. */
+static uint sort_nthreads(size_t n)
+{
+	if (n < SORT_PARALLEL_MIN)
+		return 1;
+	return ffmin(que_ncpu(), SORT_MAXTHREADS);
+}
+
+/** Parse "NAME[,NAME...]" */
+static int sort_keys(struct plist_sortdata *ps, const char *by)
+{
+	ffstr s, name;
+	ffstr_setz(&s, by);
+	while (s.len != 0) {
+		ffstr_shift(&s, ffstr_nextval(s.ptr, s.len, &name, ','));
+		if (name.len == 0)
+			continue;
+		if (ps->nkeys == SORT_MAXKEYS)
+			return -1;
+
+		int key;
+		if (ffstr_eqcz(&name, "__url"))
+			key = SORT_URL;
+		else if (ffstr_eqcz(&name, "__dur"))
+			key = SORT_DUR;
+		else
+			key = meta_key(name.ptr, name.len, 0, NULL);
+		ps->keys[ps->nkeys++] = key;
+	}
+	return (ps->nkeys != 0) ? 0 : -1;
+}
+
+/** Prepare sorting of 'n' entries.  The keys are parsed already. */
+static int sort_init(struct plist_sortdata *ps, entry **ents, size_t n)
+{
+	ps->ents = ents;
+	ps->n = n;
+	ps->njobs = sort_nthreads(n);
+
+	if (NULL == (ps->skeys = ffmem_allocT(n * ps->nkeys + 1, struct skey))
+		|| NULL == (ps->items = ffmem_allocT(n + 1, struct sitem))
+		|| NULL == (ps->tmp = ffmem_allocT(n + 1, struct sitem)))
+		return -1;
+
+	for (uint i = 0;  i != ps->njobs;  i++) {
+		struct sort_job *j = &ps->jobs[i];
+		j->ps = ps;
+		j->off = n * i / ps->njobs;
+		j->n = n * (i + 1) / ps->njobs - j->off;
+		j->th = FFTHD_INV;
+	}
+	return 0;
+}
+
+/** Extract the keys of all entries.
+plist_lock must be locked: the keys are a snapshot of the values. */
+static int sort_extract(struct plist_sortdata *ps)
+{
+	for (size_t i = 0;  i != ps->n;  i++) {
+		ent_snap_load(ps->ents[i]);
+	}
+
+	for (uint i = 0;  i != ps->njobs;  i++) {
+		if (0 != sort_job_keys(&ps->jobs[i]))
+			return -1;
+	}
+	return 0;
+}
+
+/** Sort the entries by the extracted keys.  The entries themselves aren't accessed.
+Large lists are split into parts which are sorted in parallel, then the sorted parts are merged.
+The sort is stable. */
+static void sort_run(struct plist_sortdata *ps)
+{
+	struct sort_job *jobs = ps->jobs;
+	uint nj = ps->njobs;
+	size_t n = ps->n;
+
+	for (uint i = 1;  i < nj;  i++) {
+		if (FFTHD_INV == (jobs[i].th = ffthd_create(&sort_job_run, &jobs[i], 0)))
+			sort_job_run(&jobs[i]);
+	}
+	sort_job_run(&jobs[0]);
+	for (uint i = 1;  i < nj;  i++) {
+		if (jobs[i].th != FFTHD_INV)
+			ffthd_join(jobs[i].th, -1, NULL);
+	}
+
+	// merge the sorted parts
+	struct sitem *src = ps->items, *dst = ps->tmp, *t;
+	for (uint w = 1;  w < nj;  w *= 2) {
+		for (uint i = 0;  i < nj;  i += 2 * w) {
+			size_t lo = jobs[i].off;
+			size_t mid = (i + w < nj) ? jobs[i + w].off : n;
+			size_t hi = (i + 2 * w < nj) ? jobs[i + 2 * w].off : n;
+			sort_merge(ps, &dst[lo], &src[lo], mid - lo, &src[mid], hi - mid);
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	for (size_t i = 0;  i != n;  i++) {
+		ps->ents[i] = src[i].e;
+	}
+}
+
+/** Free the data of the previous sort;  the parsed keys are kept. */
+static void sort_reset(struct plist_sortdata *ps)
+{
+	for (uint i = 0;  i != ps->njobs;  i++) {
+		ffarr_free(&ps->jobs[i].buf);
+	}
+	ffmem_zero(ps->jobs, sizeof(ps->jobs));
+	ps->njobs = 0;
+	ffmem_free0(ps->skeys);
+	ffmem_free0(ps->items);
+	ffmem_free0(ps->tmp);
+}
+
+/** Initialize random number generator */
+static void rnd_init()
+{
+	if (qu->rnd_ready)
+		return;
+	qu->rnd_ready = 1;
+	fftime t;
+	fftime_now(&t);
+	ffrnd_seed(t.sec);
+}
+
+/** Sort indexes randomly */
+static void sort_random(entry **arr, size_t n)
+{
+	rnd_init();
+	for (size_t i = 0;  i != n;  i++) {
+		size_t to = ffrnd_get() % n;
+		_ffarr_swap(&arr[i], &arr[to], 1, sizeof(entry*));
+	}
+}
+
+/** Set the new order of the entries.
+The entries removed from the index but still referenced stay in the list (after the others) until they are released.
+plist_lock must be locked. */
+static void plist_reorder(plist *pl, entry **arr, size_t n)
+{
+	size_t nrm = pl->ents.len - n;
+	for (size_t i = 0;  i != n;  i++) {
+		fflist_rm(&pl->ents, &arr[i]->sib);
+	}
+	for (size_t i = 0;  i != n;  i++) {
+		fflist_ins(&pl->ents, &arr[i]->sib);
+	}
+	for (size_t i = 0;  i != nrm;  i++) {
+		fflist_item *it = pl->ents.first;
+		fflist_rm(&pl->ents, it);
+		fflist_ins(&pl->ents, it);
+	}
+
+	plist_fromarr(pl, arr, n);
+
+	struct sidx *si = pl->sidx;
+	if (si != NULL) {
+		// the previous search result is in the old order
+		fflk_lock(&si->lk);
+		si->gen++;
+		fflk_unlock(&si->lk);
+	}
+}
+
+/** Sort playlist entries.
+The entries and their keys are taken under plist_lock, then they are sorted without the lock.
+The new order is applied only if the list hasn't changed meanwhile (plist.mods), otherwise the sort is repeated. */
+static void plist_sort(struct plist *pl, const char *by, uint flags)
+{
+	struct plist_sortdata ps = {};
+	entry **arr = NULL;
+	size_t n;
+	uint mods, random = ffsz_eq(by, "__random");
+
+	if (!random && 0 != sort_keys(&ps, by)) {
+		errlog(core, NULL, "que", "sort: bad keys: %s", by);
+		return;
+	}
+	ps.reverse = !!(flags & 1);
+
+	for (uint i = 0;  ;  i++) {
+		if (i == SORT_ATTEMPTS) {
+			fmed_warnlog(core, NULL, "que", "sort: the list keeps changing, giving up");
+			break;
+		}
+
+		fflk_lock(&qu->plist_lock);
+		n = plist_len(pl);
+		mods = pl->mods;
+		if (NULL == (arr = plist_toarr(pl))
+			|| (!random && (0 != sort_init(&ps, arr, n) || 0 != sort_extract(&ps)))) {
+			fflk_unlock(&qu->plist_lock);
+			syserrlog("%s", ffmem_alloc_S);
+			break;
+		}
+		fflk_unlock(&qu->plist_lock);
+
+		if (random)
+			sort_random(arr, n);
+		else
+			sort_run(&ps);
+
+		fflk_lock(&qu->plist_lock);
+		if (pl->mods == mods) {
+			plist_reorder(pl, arr, n);
+			fflk_unlock(&qu->plist_lock);
+			break;
+		}
+		fflk_unlock(&qu->plist_lock);
+		dbglog0("sort: the list has changed while sorting", 0);
+		ffmem_free0(arr);
+		sort_reset(&ps);
+	}
+
+	ffmem_safefree(arr);
+	sort_reset(&ps);
+}
+
+// SEARCH INDEX
+/*
+Trigram index over the case-folded URL and meta values of the entries in a playlist.
+It's created on the first search, then kept up to date:
+ a new or changed entry is put into 'dirty' list and is (re)indexed before the next search.
+An entry is indexed under a new slot number each time,
+ so the posting lists are always sorted and are only appended to;
+ the postings of the old slot are ignored and are removed by rebuilding the index
+ when there are too many of them.
+Search:
+  . refine the previous result, if the text was extended and the playlist hasn't changed since
+  . or intersect the posting lists of the text's trigrams, starting from the shortest one
+  . check each candidate by the same rules as before: case-insensitive substring of URL or meta value
+*/
+
+enum {
+	SIDX_GRAMS_CAP = 4 * 1024,
+	SIDX_QGRAMS = 16, // max. trigrams of the search text to look up
+	SIDX_REBUILD_MIN = 4 * 1024, // rebuild the index if there are more unused slots than this...
+	// ...and more than a half of all slots
+};
+
+struct sgram {
+	uint key; // 3 case-folded bytes
+	uint len, cap;
+	uint *slots; // sorted.  NULL: unused cell
+};
+
+struct sidx {
+	fflock lk;
+	ffarr ents; //entry*[]: slot -> entry.  NULL: the slot isn't used anymore
+	size_t ndead;
+	ffarr dirty; //uint[]: slots of the entries to index
+	struct sgram *grams;
+	uint cap, ngrams;
+	uint gen; // incremented when the playlist or meta changes
+
+	// the previous search
+	ffarr text;
+	uint flags;
+	uint res_gen;
+	ffarr res; //entry*[]
+};
+
+static inline uint sidx_lower(uint c)
+{
+	return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static inline uint sidx_key(const char *s)
+{
+	return (sidx_lower((byte)s[0]) << 16) | (sidx_lower((byte)s[1]) << 8) | sidx_lower((byte)s[2]);
+}
+
+static void sidx_grams_free(struct sidx *si)
+{
+	for (uint i = 0;  i != si->cap;  i++) {
+		ffmem_safefree(si->grams[i].slots);
+	}
+	ffmem_safefree(si->grams);
+	si->grams = NULL;
+	si->cap = si->ngrams = 0;
+}
+
+static void sidx_free(struct sidx *si)
+{
+	if (si == NULL)
+		return;
+	sidx_grams_free(si);
+	ffarr_free(&si->ents);
+	ffarr_free(&si->dirty);
+	ffarr_free(&si->text);
+	ffarr_free(&si->res);
+	ffmem_free(si);
+}
+
+/** Find a trigram's posting list.
+@add: add a new cell if not found */
+static struct sgram* sgram_find(struct sidx *si, uint key, uint add)
+{
+	if (add && (si->ngrams + 1) * 4 > si->cap * 3) {
+		uint cap = (si->cap != 0) ? si->cap * 2 : SIDX_GRAMS_CAP;
+		struct sgram *g = ffmem_callocT(cap, struct sgram);
+		if (g == NULL)
+			return NULL;
+		for (uint i = 0;  i != si->cap;  i++) {
+			if (si->grams[i].slots == NULL)
+				continue;
+			uint k = (si->grams[i].key * 2654435761U) & (cap - 1);
+			while (g[k].slots != NULL)
+				k = (k + 1) & (cap - 1);
+			g[k] = si->grams[i];
+		}
+		ffmem_safefree(si->grams);
+		si->grams = g;
+		si->cap = cap;
+	}
+
+	if (si->cap == 0)
+		return NULL;
+
+	uint k = (key * 2654435761U) & (si->cap - 1);
+	for (;;) {
+		struct sgram *g = &si->grams[k];
+		if (g->slots == NULL)
+			break;
+		if (g->key == key)
+			return g;
+		k = (k + 1) & (si->cap - 1);
+	}
+
+	if (!add)
+		return NULL;
+	struct sgram *g = &si->grams[k];
+	if (NULL == (g->slots = ffmem_allocT(4, uint)))
+		return NULL;
+	g->key = key;
+	g->len = 0;
+	g->cap = 4;
+	si->ngrams++;
+	return g;
+}
+
+/** Add trigrams of the string to the index. */
+static int sidx_addstr(struct sidx *si, uint slot, const ffstr *s)
+{
+	for (size_t i = 0;  i + 3 <= s->len;  i++) {
+		struct sgram *g = sgram_find(si, sidx_key(&s->ptr[i]), 1);
+		if (g == NULL)
+			return -1;
+		if (g->len != 0 && g->slots[g->len - 1] == slot)
+			continue; // the entry is already there
+		if (g->len == g->cap) {
+			uint *p = ffmem_realloc(g->slots, g->cap * 2 * sizeof(uint));
+			if (p == NULL)
+				return -1;
+			g->slots = p;
+			g->cap *= 2;
+		}
+		g->slots[g->len++] = slot;
+	}
+	return 0;
+}
+
+/** Index the entry under a new slot.
+plist_lock and sidx.lk must be locked. */
+static int sidx_index(struct sidx *si, entry *e)
+{
+	entry **p;
+	if (NULL == (p = ffarr_pushgrowT(&si->ents, 1024, entry*)))
+		return -1;
+	*p = e;
+	e->sid = si->ents.len;
+	uint slot = e->sid - 1;
+
+	if (0 != sidx_addstr(si, slot, &e->e.url))
+		return -1;
+
+	ffstr name, *val;
+	for (uint i = 0;  NULL != (val = que_meta(&e->e, i, &name, 0));  i++) {
+		if (val == FMED_QUE_SKIP)
+			continue;
+		if (0 != sidx_addstr(si, slot, val))
+			return -1;
+	}
+	return 0;
+}
+
+/** Schedule the entry for (re)indexing after it's added or its meta is changed.  Thread-safe. */
+static void sidx_touch(entry *e)
+{
+	struct sidx *si = FF_READONCE(e->plist->sidx);
+	if (si == NULL)
+		return;
+
+	fflk_lock(&si->lk);
+	si->gen++;
+	if (e->sid == 0) {
+		entry **p;
+		if (NULL == (p = ffarr_pushgrowT(&si->ents, 1024, entry*)))
+			goto end;
+		*p = e;
+		e->sid = si->ents.len;
+	}
+	uint *d = (uint*)si->dirty.ptr;
+	if (si->dirty.len != 0 && d[si->dirty.len - 1] == e->sid - 1)
+		goto end; // the same entry is being updated
+	uint *ps;
+	if (NULL == (ps = ffarr_pushgrowT(&si->dirty, 256, uint)))
+		goto end;
+	*ps = e->sid - 1;
+
+end:
+	fflk_unlock(&si->lk);
+}
+
+/** The entry is removed from playlist. */
+static void sidx_rm(entry *e)
+{
+	struct sidx *si = e->plist->sidx;
+	if (si == NULL)
+		return;
+
+	fflk_lock(&si->lk);
+	if (e->sid != 0) {
+		entry **ents = (void*)si->ents.ptr;
+		ents[e->sid - 1] = NULL;
+		si->ndead++;
+		e->sid = 0;
+	}
+	si->gen++;
+	fflk_unlock(&si->lk);
+}
+
+/** Index the entries from 'dirty' list. */
+static int sidx_update(plist *pl)
+{
+	struct sidx *si = pl->sidx;
+	int rc = 0;
+	entry *e;
+	ffarr a = {}; //entry*[]
+
+	fflk_lock(&si->lk);
+	if (si->ndead >= SIDX_REBUILD_MIN && si->ndead > si->ents.len / 2) {
+		// start from scratch: all entries are dirty
+		dbglog0("search index: rebuilding: %L/%L slots unused", si->ndead, si->ents.len);
+		sidx_grams_free(si);
+		si->ents.len = 0;
+		si->dirty.len = 0;
+		si->ndead = 0;
+		FFLIST_WALK(&pl->ents, e, sib) {
+			e->sid = 0;
+		}
+		fflk_unlock(&si->lk);
+		FFLIST_WALK(&pl->ents, e, sib) {
+			if (!e->rm)
+				sidx_touch(e);
+		}
+		fflk_lock(&si->lk);
+	}
+
+	const uint *d = (void*)si->dirty.ptr;
+	entry **ents = (void*)si->ents.ptr;
+	for (size_t i = 0;  i != si->dirty.len;  i++) {
+		if (NULL == (e = ents[d[i]]))
+			continue;
+		entry **pe;
+		if (NULL == (pe = ffarr_pushgrowT(&a, 256, entry*))) {
+			rc = -1;
+			break;
+		}
+		*pe = e;
+	}
+	si->dirty.len = 0;
+	fflk_unlock(&si->lk);
+
+	entry **arr = (void*)a.ptr;
+	for (size_t i = 0;  i != a.len;  i++) {
+		ent_snap_load(arr[i]);
+	}
+
+	// values must not change while they are being indexed
+	fflk_lock(&qu->plist_lock);
+	fflk_lock(&si->lk);
+	ents = (void*)si->ents.ptr;
+	for (size_t i = 0;  i != a.len;  i++) {
+		e = arr[i];
+		if (e->sid == 0 || ents[e->sid - 1] != e)
+			continue; // removed or duplicate
+		ents[e->sid - 1] = NULL;
+		si->ndead++;
+		if (0 != sidx_index(si, e)) {
+			rc = -1;
+			break;
+		}
+		ents = (void*)si->ents.ptr;
+	}
+	fflk_unlock(&si->lk);
+	fflk_unlock(&qu->plist_lock);
+
+	ffarr_free(&a);
+	return rc;
+}
+
+static int sidx_create(plist *pl)
+{
+	struct sidx *si;
+	entry *e;
+	if (NULL == (si = ffmem_new(struct sidx)))
+		return -1;
+	fflk_init(&si->lk);
+
+	// for sidx_touch() to see it
+	FF_WRITEONCE(pl->sidx, si);
+	FFLIST_WALK(&pl->ents, e, sib) {
+		if (!e->rm)
+			sidx_touch(e);
+	}
+	return 0;
+}
+
+/** Check if the entry matches the search text.
+plist_lock must be locked. */
+static int sidx_match(entry *e, const ffstr *text, uint flags)
+{
+	if ((flags & FMED_QUE_SEARCH_URL)
+		&& -1 != ffstr_ifind(&e->e.url, text->ptr, text->len))
+		return 1;
+
+	if (flags & FMED_QUE_SEARCH_META) {
+		ffstr name, *val;
+		for (uint i = 0;  NULL != (val = que_meta(&e->e, i, &name, 0));  i++) {
+			if (val == FMED_QUE_SKIP)
+				continue;
+			if (-1 != ffstr_ifind(val, text->ptr, text->len))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/** Get the slots of the entries containing all trigrams of the text.
+sidx.lk must be locked. */
+static int sidx_lookup(struct sidx *si, const ffstr *text, ffarr *slots)
+{
+	struct sgram *g[SIDX_QGRAMS], *t;
+	uint n = 0;
+
+	for (size_t i = 0;  i + 3 <= text->len && n != SIDX_QGRAMS;  i++) {
+		if (NULL == (t = sgram_find(si, sidx_key(&text->ptr[i]), 0)))
+			return 0; // no entry contains this trigram
+		uint k;
+		for (k = 0;  k != n;  k++) {
+			if (g[k] == t)
+				break;
+		}
+		if (k != n)
+			continue;
+
+		// insert, sorted by the number of entries
+		for (k = n;  k != 0 && g[k - 1]->len > t->len;  k--) {
+			g[k] = g[k - 1];
+		}
+		g[k] = t;
+		n++;
+	}
+
+	if (NULL == ffarr_alloc(slots, g[0]->len * sizeof(uint)))
+		return -1;
+	uint *r = (void*)slots->ptr;
+	size_t nr = g[0]->len;
+	ffmemcpy(r, g[0]->slots, nr * sizeof(uint));
+
+	for (uint k = 1;  k != n && nr != 0;  k++) {
+		const uint *s = g[k]->slots;
+		size_t lo = 0, out = 0;
+		for (size_t i = 0;  i != nr;  i++) {
+			// binary search for r[i] in s[lo..)
+			size_t l = lo, h = g[k]->len;
+			while (l < h) {
+				size_t m = (l + h) / 2;
+				if (s[m] < r[i])
+					l = m + 1;
+				else
+					h = m;
+			}
+			lo = l;
+			if (lo == g[k]->len)
+				break;
+			if (s[lo] == r[i])
+				r[out++] = r[i];
+		}
+		nr = out;
+	}
+	slots->len = nr;
+	return 0;
+}
+
+/** Sort entries by their position in playlist. */
+static int sidx_sortpos(plist *pl, entry **ents, size_t n)
+{
+	struct plist_sortdata ps = {};
+	int rc = -1;
+	ps.nkeys = 1;
+	if (NULL == (ps.skeys = ffmem_allocT(n + 1, struct skey))
+		|| NULL == (ps.items = ffmem_allocT(n + 1, struct sitem))
+		|| NULL == (ps.tmp = ffmem_allocT(n + 1, struct sitem)))
+		goto end;
+
+	for (size_t i = 0;  i != n;  i++) {
+		ps.skeys[i].type = SKEY_NUM;
+		ps.skeys[i].num = plist_ent_idx(pl, ents[i]);
+		ps.items[i].e = ents[i];
+		ps.items[i].k = &ps.skeys[i];
+	}
+	sort_items(&ps, ps.items, ps.tmp, n);
+	for (size_t i = 0;  i != n;  i++) {
+		ents[i] = ps.items[i].e;
+	}
+	rc = 0;
+
+end:
+	ffmem_safefree(ps.skeys);
+	ffmem_safefree(ps.items);
+	ffmem_safefree(ps.tmp);
+	return rc;
+}
+
+/** Find the entries matching the text.
+Result is stored in sidx.res in the order of playlist. */
+static int sidx_search(plist *pl, const ffstr *text, uint flags)
+{
+	struct sidx *si;
+	int rc = -1;
+	ffarr cand = {}; //entry*[]
+	ffarr slots = {}; //uint[]
+	ffstr ftext;
+	entry *e, **p;
+
+	if (pl->sidx == NULL && 0 != sidx_create(pl))
+		return -1;
+	si = pl->sidx;
+	if (0 != sidx_update(pl))
+		goto end;
+
+	fflk_lock(&qu->plist_lock);
+	fflk_lock(&si->lk);
+
+	ffstr_set2(&ftext, &si->text);
+	if (si->res_gen == si->gen && si->flags == flags && ftext.len != 0
+		&& -1 != ffstr_ifind(text, ftext.ptr, ftext.len)) {
+		// refine the previous result
+		dbglog0("search: refining %L entries", si->res.len);
+		cand = si->res;
+		ffarr_null(&si->res);
+
+	} else if (text->len >= 3) {
+		if (0 != sidx_lookup(si, text, &slots))
+			goto end_locked;
+		dbglog0("search: %L candidates", slots.len);
+		const uint *s = (void*)slots.ptr;
+		entry **ents = (void*)si->ents.ptr;
+		if (NULL == ffarr_allocT(&cand, slots.len, entry*))
+			goto end_locked;
+		for (size_t i = 0;  i != slots.len;  i++) {
+			if (NULL != (e = ents[s[i]]))
+				*ffarr_pushT(&cand, entry*) = e;
+		}
+
+	} else {
+		// too short for the index: check every entry
+		if (NULL == ffarr_allocT(&cand, pl->ents.len, entry*))
+			goto end_locked;
+		FFLIST_WALK(&pl->ents, e, sib) {
+			if (!e->rm)
+				*ffarr_pushT(&cand, entry*) = e;
+		}
+	}
+
+	p = (void*)cand.ptr;
+	size_t n = 0;
+	for (size_t i = 0;  i != cand.len;  i++) {
+		if (sidx_match(p[i], text, flags))
+			p[n++] = p[i];
+	}
+	cand.len = n;
+
+	if (0 != sidx_sortpos(pl, (void*)cand.ptr, cand.len))
+		goto end_locked;
+
+	ffarr_free(&si->res);
+	si->res = cand;
+	ffarr_null(&cand);
+	si->res_gen = si->gen;
+	si->flags = flags;
+	si->text.len = 0;
+	if (NULL == ffarr_append(&si->text, text->ptr, text->len))
+		si->res_gen = si->gen - 1;
+	rc = 0;
+
+end_locked:
+	if (rc != 0)
+		si->res_gen = si->gen - 1; // the previous result isn't valid anymore
+	fflk_unlock(&si->lk);
+	fflk_unlock(&qu->plist_lock);
+
+end:
+	ffarr_free(&cand);
+	ffarr_free(&slots);
+	return rc;
+}
+
+/** Search in the current playlist and fill the filtered list with the result. */
+static ssize_t que_search(const ffstr *text, uint flags)
+{
+	plist *pl = qu->curlist, *fpl;
+
+	if (0 != sidx_search(pl, text, flags)) {
+		syserrlog("%s", ffmem_alloc_S);
+		return -1;
+	}
+
+	if (0 != que_cmdv(FMED_QUE_NEW_FILTERED))
+		return -1;
+	fpl = pl->filtered_plist;
+
+	// lock order: plist_lock -> sidx.lk
+	fflk_lock(&qu->plist_lock);
+	fflk_lock(&pl->sidx->lk);
+	size_t n = pl->sidx->res.len;
+	plist_fromarr(fpl, (void*)pl->sidx->res.ptr, n);
+	fflk_unlock(&pl->sidx->lk);
+	fflk_unlock(&qu->plist_lock);
+
+	dbglog0("search: '%S': %L entries", text, n);
+	return n;
+}
+
+static void que_cmd(uint cmd, void *param)
+{
+	que_cmd2(cmd, param, 0);
+}
 
 // matches enum FMED_QUE
 static const char *const scmds[] = {
@@ -655,7 +3421,7 @@ static const char *const scmds[] = {
 	"sort", "count",
 	"xplay", "add2", "add-after", "settrackprops", "copytrackprops",
 	"", "", "", "",
-	"expand2",
+	"expand2", "load-snap", "set-visible", "search",
 };
 
 static ssize_t que_cmdv(uint cmd, ...)
@@ -801,9 +3567,44 @@ static ssize_t que_cmdv(uint cmd, ...)
 		qu->repeat_all = val;
 		goto end;
 	}
-	case FMED_QUE_SET_QUITIFDONE: {
-		uint val = va_arg(va, uint);
-		qu->quit_if_done = val;
+	case FMED_QUE_SET_QUITIFDONE: {
+		uint val = va_arg(va, uint);
+		qu->quit_if_done = val;
+		goto end;
+	}
+
+	case FMED_QUE_SEARCH: {
+		const ffstr *text = va_arg(va, ffstr*);
+		uint flags = va_arg(va, uint);
+		r = que_search(text, flags);
+		goto end;
+	}
+
+	case FMED_QUE_SET_VISIBLE:
+		FF_WRITEONCE(qu->xsched.visible, va_arg(va, size_t));
+		goto end;
+
+	case FMED_QUE_SAVE: {
+		size_t plid = va_arg(va, size_t);
+		void *fn = va_arg(va, void*);
+		r = que_cmd2(FMED_QUE_SAVE | cmdflags, (void*)plid, (size_t)fn);
+		goto end;
+	}
+
+	case FMED_QUE_LOAD_SNAP: {
+		int plid = va_arg(va, int);
+		const char *fn = va_arg(va, char*);
+		pl = (plid != -1) ? plist_by_idx(plid) : qu->curlist;
+		if (pl == NULL) {
+			r = -1;
+			goto end;
+		}
+		r = snap_load(pl, fn);
+		if (r == 0) {
+			// the index of the empty list is of no use now
+			sidx_free(pl->sidx);
+			pl->sidx = NULL;
+		}
 		goto end;
 	}
 
@@ -915,13 +3716,7 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 	case FMED_QUE_EXPAND: {
 		void *r = param;
 		e = FF_GETPTR(entry, e, r);
-		void *trk = qu->track->create(FMED_TRK_TYPE_EXPAND, e->e.url.ptr);
-		fmed_trk *t = qu->track->conf(trk);
-		t->input_info = 1;
-		e->expand = 1;
-		qu->track->setval(trk, "queue_item", (int64)e);
-		ent_ref(e);
-		qu->track->cmd(trk, FMED_TRACK_START);
+		xsched_add(e, (param2 == 1));
 		return (size_t)r;
 	}
 
@@ -958,6 +3753,7 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 
 	case FMED_QUE_HAVEUSERMETA:
 		e = param;
+		ent_snap_load(e);
 		return (e->meta.len != 0 || e->no_tmeta);
 
 
@@ -970,6 +3766,8 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 			return -1;
 		ents = &pl->ents;
 		que_save(FF_GETPTR(entry, sib, ents->first), fflist_sentl(ents), (void*)param2);
+		if (flags & FMED_QUE_SNAP)
+			snap_save(FF_GETPTR(entry, sib, ents->first), fflist_sentl(ents), (void*)param2);
 		break;
 
 	case FMED_QUE_CLEAR:
@@ -1019,7 +3817,7 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 			uint i = 0;
 			if (*ent != NULL)
 				i = que_cmdv(FMED_QUE_ID, *ent) + 1;
-			if (i == pl->indexes.len)
+			if (i == plist_len(pl))
 				return 0;
 			*ent = (void*)que_cmdv(FMED_QUE_ITEM, (size_t)i);
 			return 1;
@@ -1080,9 +3878,8 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 	case FMED_QUE_ADD_FILTERED:
 		e = param;
 		pl = qu->curlist->filtered_plist;
-		if (NULL == ffarr_growT(&pl->indexes, 1, 16, entry*))
+		if (0 != plist_ins(pl, plist_len(pl), e))
 			return -1;
-		*ffarr_pushT(&pl->indexes, entry*) = e;
 		break;
 
 	case FMED_QUE_DEL_FILTERED:
@@ -1137,22 +3934,15 @@ static fmed_que_entry* que_add(plist *pl, fmed_que_entry *ent, entry *prev, uint
 
 	ffchain_append(&e->sib, (prev != NULL) ? &prev->sib : e->plist->ents.last);
 	e->plist->ents.len++;
-	if (NULL == ffarr_growT(&e->plist->indexes, 1, FFARR_GROWQUARTER | 16, entry*)) {
-		ent_rm(e);
-		fflk_unlock(&qu->plist_lock);
-		return NULL;
-	}
-	ssize_t i = e->plist->indexes.len;
+	ssize_t i = plist_len(e->plist);
 	if (prev != NULL) {
 		i = plist_ent_idx(e->plist, prev);
 		FF_ASSERT(i != -1);
 		i++;
-		_ffarr_shiftr(&e->plist->indexes, i, 1, sizeof(entry*));
 	}
-	e->list_pos = i;
-	((entry**)e->plist->indexes.ptr) [i] = e;
-	e->plist->indexes.len++;
+	plist_ins(e->plist, i, e);
 	fflk_unlock(&qu->plist_lock);
+	sidx_touch(e);
 
 	dbglog(core, NULL, "que", "added: (%d: %d-%d) %S"
 		, ent->dur, ent->from, ent->to, &ent->url);
@@ -1184,31 +3974,106 @@ static void _que_meta_set(fmed_que_entry *ent, const char *name, size_t name_len
 static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *val, uint flags)
 {
 	entry *e = FF_GETPTR(entry, e, ent);
-	char *sname, *sval;
-	ffarr2 *a;
+	metalist *m;
+	char *sval;
+	int key, i;
+	uint id;
+
+	ent_snap_load(e);
 
 	if (!(flags & FMED_QUE_NUM)) {
 		dbglog0("meta #%u: %S: %S f:%xu"
-			, (e->meta.len + e->tmeta.len) / 2 + 1, name, val, flags);
+			, e->meta.len + e->tmeta.len + 1, name, val, flags);
+	}
+
+	if (!(flags & FMED_QUE_PRIV) && ffstr_matchz(name, "__")) {
+		fmed_warnlog(core, NULL, "queue", "meta names starting with \"__\" are considered private: \"%S\""
+			, name);
+		return;
 	}
 
-	a = &e->meta;
+	if ((flags & (FMED_QUE_TMETA | FMED_QUE_TRKDICT)) == FMED_QUE_TRKDICT) {
+		que_dict_set(e, name, val, flags);
+		return;
+	}
+
+	m = &e->meta;
 	if (flags & FMED_QUE_TMETA) {
 		if (e->no_tmeta)
 			return;
-		a = &e->tmeta;
+		m = &e->tmeta;
+	}
+
+	key = meta_key(name->ptr, name->len, !(flags & FMED_QUE_METADEL), &id);
+	if (key == -1 && !(flags & FMED_QUE_METADEL))
+		goto err;
+
+	if (flags & (FMED_QUE_OVWRITE | FMED_QUE_METADEL)) {
+		i = (key != -1) ? mlist_find(m, key, m->len) : -1;
+
+		if (i == -1) {
+
+		} else if (flags & FMED_QUE_METADEL) {
+			fflk_lock(&qu->plist_lock);
+			mlist_rm(m, i);
+			fflk_unlock(&qu->plist_lock);
+			sidx_touch(e);
+
+		} else {
+			if (NULL == (sval = pool_get(val->ptr, val->len)))
+				goto err;
+
+			fflk_lock(&qu->plist_lock);
+			char *old = m->ptr[i].val.ptr;
+			ffstr_set(&m->ptr[i].val, sval, val->len);
+			fflk_unlock(&qu->plist_lock);
+			pool_put(old);
+		}
+
+		if (m == &e->meta) {
+			ffstr empty;
+			empty.len = 0;
+			que_meta_set(ent, name, &empty, FMED_QUE_TMETA | FMED_QUE_METADEL | (flags & ~(FMED_QUE_OVWRITE | FMED_QUE_ACQUIRE)));
+		}
 
-	} else if (flags & FMED_QUE_TRKDICT) {
-		a = &e->dict;
-		if ((flags & FMED_QUE_NUM) && val->len != sizeof(int64))
+		if (flags & FMED_QUE_METADEL)
 			return;
+
+		if (i != -1)
+			goto done;
 	}
 
-	if (!(flags & FMED_QUE_PRIV) && ffstr_matchz(name, "__")) {
-		fmed_warnlog(core, NULL, "queue", "meta names starting with \"__\" are considered private: \"%S\""
-			, name);
-		return;
+	if (NULL == (sval = pool_get(val->ptr, val->len)))
+		goto err;
+
+	fflk_lock(&qu->plist_lock);
+	if (0 != mlist_add(m, key, id, sval, val->len)) {
+		fflk_unlock(&qu->plist_lock);
+		pool_put(sval);
+		goto err;
 	}
+	fflk_unlock(&qu->plist_lock);
+
+done:
+	sidx_touch(e);
+	if (flags & FMED_QUE_ACQUIRE)
+		ffmem_free(val->ptr);
+	return;
+
+err:
+	if (flags & FMED_QUE_ACQUIRE)
+		ffmem_free(val->ptr);
+	syserrlog("%s", ffmem_alloc_S);
+}
+
+/** Set track property for the entry. */
+static void que_dict_set(entry *e, const ffstr *name, const ffstr *val, uint flags)
+{
+	char *sname, *sval;
+	ffarr2 *a = &e->dict;
+
+	if ((flags & FMED_QUE_NUM) && val->len != sizeof(int64))
+		return;
 
 	if (flags & (FMED_QUE_OVWRITE | FMED_QUE_METADEL)) {
 		int i = que_arrfind(a->ptr, a->len, name->ptr, name->len);
@@ -1222,6 +4087,7 @@ static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *va
 			_ffarr_rm(&ar, i, 2, sizeof(ffstr));
 			a->len -= 2;
 			fflk_unlock(&qu->plist_lock);
+			return;
 
 		} else {
 			if (NULL == (sval = ffsz_alcopy(val->ptr, val->len)))
@@ -1232,16 +4098,8 @@ static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *va
 			ffstr_free(&arr[i + 1]);
 			ffstr_set(&arr[i + 1], sval, val->len);
 			fflk_unlock(&qu->plist_lock);
-		}
-
-		if (a == &e->meta) {
-			ffstr empty;
-			empty.len = 0;
-			que_meta_set(ent, name, &empty, FMED_QUE_TMETA | FMED_QUE_METADEL | (flags & ~FMED_QUE_OVWRITE));
-		}
-
-		if (i != -1)
 			return;
+		}
 
 		if (flags & FMED_QUE_METADEL)
 			return;
@@ -1265,7 +4123,7 @@ static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *va
 	ffstr *arr = a->ptr;
 	ffstr_set(&arr[a->len], sname, name->len);
 	ffstr_set(&arr[a->len + 1], sval, val->len);
-	if ((flags & (FMED_QUE_TRKDICT | FMED_QUE_NUM)) == (FMED_QUE_TRKDICT | FMED_QUE_NUM))
+	if (flags & FMED_QUE_NUM)
 		arr[a->len + 1].len = -(ssize_t)arr[a->len + 1].len;
 	a->len += 2;
 	fflk_unlock(&qu->plist_lock);
@@ -1279,49 +4137,59 @@ err:
 
 static ffstr* que_meta_find(fmed_que_entry *ent, const char *name, size_t name_len)
 {
-	int i;
 	entry *e = FF_GETPTR(entry, e, ent);
+	int key;
 
 	if (name_len == (size_t)-1)
 		name_len = ffsz_len(name);
 
+	ent_snap_load(e);
+	if (-1 == (key = meta_key(name, name_len, 0, NULL)))
+		return NULL;
+	return ent_meta_find(e, key);
+}
+
+/** Find meta value by key: user meta has higher priority than transient meta. */
+static ffstr* ent_meta_find(entry *e, uint key)
+{
+	int i;
 	for (uint k = 0;  k != 2;  k++) {
-		const ffarr2 *meta = (k == 0) ? &e->meta : &e->tmeta;
-		if (-1 != (i = que_arrfind(meta->ptr, meta->len, name, name_len)))
-			return &((ffstr*)meta->ptr)[i + 1];
+		metalist *m = (k == 0) ? &e->meta : &e->tmeta;
+		if (-1 != (i = mlist_find(m, key, m->len)))
+			return &m->ptr[i].val;
 	}
-
 	return NULL;
 }
 
 static ffstr* que_meta(fmed_que_entry *ent, size_t n, ffstr *name, uint flags)
 {
 	entry *e = FF_GETPTR(entry, e, ent);
+	metalist *m;
 	size_t nn;
-	ffstr *m;
 
-	n *= 2;
-	if (n == e->meta.len + e->tmeta.len)
+	ent_snap_load(e);
+	if (n >= e->meta.len + e->tmeta.len)
 		return NULL;
 
 	if (n < e->meta.len) {
-		m = e->meta.ptr;
+		m = &e->meta;
 		nn = n;
 	} else {
 		if (flags & FMED_QUE_NO_TMETA)
 			return NULL;
-		m = e->tmeta.ptr;
+		m = &e->tmeta;
 		nn = n - e->meta.len;
 	}
 
-	*name = m[nn];
+	uint key = m->ptr[nn].key;
+	*name = meta_name(m->ptr[nn].name);
 
 	if (flags & FMED_QUE_UNIQ) {
-		if (-1 != que_arrfind(e->meta.ptr, ffmin(n, e->meta.len), name->ptr, name->len))
+		if (-1 != mlist_find(&e->meta, key, ffmin(n, e->meta.len)))
 			return FMED_QUE_SKIP;
 
 		if (n >= e->meta.len) {
-			if (-1 != que_arrfind(e->tmeta.ptr, nn, name->ptr, name->len))
+			if (-1 != mlist_find(&e->tmeta, key, nn))
 				return FMED_QUE_SKIP;
 		}
 	}
@@ -1329,19 +4197,408 @@ static ffstr* que_meta(fmed_que_entry *ent, size_t n, ffstr *name, uint flags)
 	if (ffstr_matchz(name, "__"))
 		return FMED_QUE_SKIP;
 
-	return &m[nn + 1];
+	return &m->ptr[nn].val;
+}
+
+
+// META STORE
+
+/** Case-insensitive FNV-1a hash. */
+static uint meta_hash(const char *s, size_t len, uint icase)
+{
+	uint h = 2166136261;
+	for (size_t i = 0;  i != len;  i++) {
+		uint c = (byte)s[i];
+		if (icase && c >= 'A' && c <= 'Z')
+			c |= 0x20;
+		h = (h ^ c) * 16777619;
+	}
+	return h;
+}
+
+static int meta_keys_init(struct meta_keys *k)
+{
+	fflk_init(&k->lk);
+	k->cap = META_KEYS_CAP;
+	if (NULL == (k->tab = ffmem_callocT(k->cap, uint))
+		|| NULL == (k->itab = ffmem_callocT(k->cap, uint)))
+		return -1;
+	for (uint i = 0;  i != FFCNT(meta_fixed);  i++) {
+		if (i != (uint)meta_key(meta_fixed[i], ffsz_len(meta_fixed[i]), 1, NULL))
+			return -1;
+	}
+	return 0;
+}
+
+static void meta_keys_free(struct meta_keys *k)
+{
+	FFARR_FREE_ALL(&k->names, ffstr_free, ffstr);
+	ffarr_free(&k->keys);
+	ffmem_safefree(k->tab);
+	ffmem_safefree(k->itab);
+}
+
+/** Find the slot for the name in hash table.
+@icase: 0: 'tab';  1: 'itab' */
+static uint meta_keys_slot(const struct meta_keys *k, uint icase, const char *name, size_t len, uint hash)
+{
+	const ffstr *names = (void*)k->names.ptr;
+	const uint *tab = (icase) ? k->itab : k->tab;
+	uint i;
+	for (i = hash & (k->cap - 1);  tab[i] != 0;  i = (i + 1) & (k->cap - 1)) {
+		const ffstr *s = &names[tab[i] - 1];
+		if ((icase) ? ffstr_ieq(s, name, len) : ffstr_eq(s, name, len))
+			break;
+	}
+	return i;
+}
+
+/** Double the size of hash tables. */
+static int meta_keys_grow(struct meta_keys *k)
+{
+	uint *tab, *itab, cap = k->cap * 2;
+	if (NULL == (tab = ffmem_callocT(cap, uint))
+		|| NULL == (itab = ffmem_callocT(cap, uint))) {
+		ffmem_safefree(tab);
+		return -1;
+	}
+	ffmem_free(k->tab);
+	ffmem_free(k->itab);
+	k->tab = tab;
+	k->itab = itab;
+	k->cap = cap;
+
+	const ffstr *names = (void*)k->names.ptr;
+	const uint *keys = (void*)k->keys.ptr;
+	for (uint n = 0;  n != k->names.len;  n++) {
+		uint i = meta_keys_slot(k, 0, names[n].ptr, names[n].len, meta_hash(names[n].ptr, names[n].len, 0));
+		k->tab[i] = n + 1;
+		if (keys[n] == n) {
+			i = meta_keys_slot(k, 1, names[n].ptr, names[n].len, meta_hash(names[n].ptr, names[n].len, 1));
+			k->itab[i] = n + 1;
+		}
+	}
+	return 0;
+}
+
+/** Get key for meta name.
+Names which differ only in case have the same key, but each spelling is stored with its own ID.
+@add: intern the name if it's not found
+@id: (optional) name ID
+Return -1 if not found. */
+static int meta_key(const char *name, size_t len, uint add, uint *id)
+{
+	struct meta_keys *k = &qu->keys;
+	uint h = meta_hash(name, len, 0), ih = meta_hash(name, len, 1), i, ii;
+	int key = -1;
+	uint n;
+
+	fflk_lock(&k->lk);
+	i = meta_keys_slot(k, 0, name, len, h);
+	if (k->tab[i] != 0) {
+		n = k->tab[i] - 1;
+		key = *ffarr_itemT(&k->keys, n, uint);
+		goto end;
+	}
+
+	ii = meta_keys_slot(k, 1, name, len, ih);
+	if (!add) {
+		if (k->itab[ii] != 0) {
+			n = k->itab[ii] - 1;
+			key = n;
+		}
+		goto end;
+	}
+
+	if ((k->names.len + 1) * 2 > k->cap) {
+		if (0 != meta_keys_grow(k))
+			goto end;
+		i = meta_keys_slot(k, 0, name, len, h);
+		ii = meta_keys_slot(k, 1, name, len, ih);
+	}
+
+	ffstr *s;
+	uint *pkey;
+	char *sname;
+	if (NULL == (pkey = ffarr_pushgrowT(&k->keys, 64, uint)))
+		goto end;
+	if (NULL == (sname = ffsz_alcopy(name, len))) {
+		k->keys.len--;
+		goto end;
+	}
+	if (NULL == (s = ffarr_pushgrowT(&k->names, 64, ffstr))) {
+		k->keys.len--;
+		ffmem_free(sname);
+		goto end;
+	}
+	ffstr_set(s, sname, len);
+	n = k->names.len - 1;
+	k->tab[i] = n + 1;
+	if (k->itab[ii] == 0)
+		k->itab[ii] = n + 1;
+	key = k->itab[ii] - 1;
+	*pkey = key;
+
+end:
+	fflk_unlock(&k->lk);
+	if (key != -1 && id != NULL)
+		*id = n;
+	return key;
+}
+
+/** Get meta name by its ID. */
+static ffstr meta_name(uint id)
+{
+	ffstr s;
+	fflk_lock(&qu->keys.lk);
+	s = ((ffstr*)qu->keys.names.ptr)[id];
+	fflk_unlock(&qu->keys.lk);
+	return s;
+}
+
+/** Get a reference to a string from the pool.
+Equal strings are stored once.  Large strings aren't deduplicated. */
+static char* pool_get(const char *s, size_t len)
+{
+	struct meta_pool *pl = &qu->pool;
+	struct pstr *p;
+	uint h;
+
+	if (len > META_POOL_MAXLEN) {
+		if (NULL == (p = ffmem_alloc(sizeof(struct pstr) + len + 1)))
+			return NULL;
+		p->pooled = 0;
+		pstr_fill(p, s, len);
+		return p->data;
+	}
+
+	h = meta_hash(s, len, 0);
+	fflk_lock(&pl->lk);
+	for (p = pl->tab[h & (pl->cap - 1)];  p != NULL;  p = p->next) {
+		if (p->hash == h && p->len == len && !ffmemcmp(p->data, s, len)) {
+			p->ref++;
+			fflk_unlock(&pl->lk);
+			return p->data;
+		}
+	}
+
+	if (pl->n == pl->cap) {
+		// rehash
+		struct pstr **tab, *next;
+		uint cap = pl->cap * 2;
+		if (NULL == (tab = ffmem_callocT(cap, struct pstr*))) {
+			fflk_unlock(&pl->lk);
+			return NULL;
+		}
+		for (uint i = 0;  i != pl->cap;  i++) {
+			for (p = pl->tab[i];  p != NULL;  p = next) {
+				next = p->next;
+				p->next = tab[p->hash & (cap - 1)];
+				tab[p->hash & (cap - 1)] = p;
+			}
+		}
+		ffmem_free(pl->tab);
+		pl->tab = tab;
+		pl->cap = cap;
+	}
+
+	if (NULL == (p = ffmem_alloc(sizeof(struct pstr) + len + 1))) {
+		fflk_unlock(&pl->lk);
+		return NULL;
+	}
+	p->pooled = 1;
+	p->hash = h;
+	pstr_fill(p, s, len);
+	p->next = pl->tab[h & (pl->cap - 1)];
+	pl->tab[h & (pl->cap - 1)] = p;
+	pl->n++;
+	fflk_unlock(&pl->lk);
+	return p->data;
+}
+
+static void pstr_fill(struct pstr *p, const char *s, size_t len)
+{
+	p->ref = 1;
+	p->len = len;
+	ffmemcpy(p->data, s, len);
+	p->data[len] = '\0';
+}
+
+/** Release a reference to a string returned by pool_get(). */
+static void pool_put(char *data)
+{
+	struct meta_pool *pl = &qu->pool;
+	struct pstr *p = FF_GETPTR(struct pstr, data, data), **pp;
+
+	if (!p->pooled) {
+		ffmem_free(p);
+		return;
+	}
+
+	fflk_lock(&pl->lk);
+	if (--p->ref != 0) {
+		fflk_unlock(&pl->lk);
+		return;
+	}
+	for (pp = &pl->tab[p->hash & (pl->cap - 1)];  *pp != p;  pp = &(*pp)->next) {
+	}
+	*pp = p->next;
+	pl->n--;
+	fflk_unlock(&pl->lk);
+	ffmem_free(p);
+}
+
+static int pool_init(struct meta_pool *pl)
+{
+	fflk_init(&pl->lk);
+	pl->cap = META_POOL_CAP;
+	if (NULL == (pl->tab = ffmem_callocT(pl->cap, struct pstr*)))
+		return -1;
+	return 0;
+}
+
+static void pool_free(struct meta_pool *pl)
+{
+	struct pstr *p, *next;
+	for (uint i = 0;  i != pl->cap;  i++) {
+		for (p = pl->tab[i];  p != NULL;  p = next) {
+			next = p->next;
+			ffmem_free(p);
+		}
+	}
+	ffmem_safefree(pl->tab);
+}
+
+static uint mlist_hslot(const metalist *m, uint key)
+{
+	uint i = (key * 0x9e3779b1) & (m->hcap - 1);
+	while (m->htab[i] != 0 && m->ptr[m->htab[i] - 1].key != key)
+		i = (i + 1) & (m->hcap - 1);
+	return i;
+}
+
+/** Find the first slot with the key among the first 'n' slots. */
+static int mlist_find(const metalist *m, uint key, size_t n)
+{
+	if (m->htab != NULL) {
+		uint i = m->htab[mlist_hslot(m, key)];
+		return (i != 0 && i - 1 < n) ? (int)i - 1 : -1;
+	}
+
+	if (key < FFCNT(meta_fixed) && m->len <= 0xff) {
+		uint i = m->fixed[key];
+		return (i != 0 && i - 1 < n) ? (int)i - 1 : -1;
+	}
+
+	for (size_t i = 0;  i != n;  i++) {
+		if (m->ptr[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+/** Build the hash index of all keys.
+The list stays without it (and is searched linearly for non-fixed keys) if memory allocation fails. */
+static void mlist_hindex(metalist *m)
+{
+	uint cap = (m->hcap != 0) ? m->hcap : 16;
+	while (cap < m->len * 2)
+		cap *= 2;
+
+	if (cap != m->hcap) {
+		ffmem_safefree(m->htab);
+		m->hcap = 0;
+		if (NULL == (m->htab = ffmem_callocT(cap, uint)))
+			return;
+		m->hcap = cap;
+	} else {
+		ffmem_zero(m->htab, cap * sizeof(uint));
+	}
+
+	for (uint i = 0;  i != m->len;  i++) {
+		uint k = mlist_hslot(m, m->ptr[i].key);
+		if (m->htab[k] == 0)
+			m->htab[k] = i + 1;
+	}
+}
+
+static void mlist_index(metalist *m)
+{
+	ffmem_zero(m->fixed, sizeof(m->fixed));
+	for (uint i = m->len;  i != 0;  i--) {
+		uint key = m->ptr[i - 1].key;
+		if (key < FFCNT(meta_fixed))
+			m->fixed[key] = i;
+	}
+
+	if (m->htab != NULL)
+		mlist_hindex(m);
+}
+
+static int mlist_add(metalist *m, uint key, uint name, char *val, size_t len)
+{
+	if (m->len == m->cap) {
+		uint cap = (m->cap == 0) ? 8 : m->cap * 2;
+		void *p;
+		if (NULL == (p = ffmem_realloc(m->ptr, cap * sizeof(struct meta_slot))))
+			return -1;
+		m->ptr = p;
+		m->cap = cap;
+	}
+
+	struct meta_slot *sl = &m->ptr[m->len++];
+	sl->key = key;
+	sl->name = name;
+	ffstr_set(&sl->val, val, len);
+	if (key < FFCNT(meta_fixed) && m->fixed[key] == 0 && m->len <= 0xff)
+		m->fixed[key] = m->len;
+
+	if (m->htab == NULL) {
+		if (m->len >= MLIST_HASH_MIN)
+			mlist_hindex(m);
+	} else if (m->len * 2 > m->hcap) {
+		mlist_hindex(m);
+	} else {
+		uint k = mlist_hslot(m, key);
+		if (m->htab[k] == 0)
+			m->htab[k] = m->len;
+	}
+	return 0;
+}
+
+static void mlist_rm(metalist *m, uint i)
+{
+	pool_put(m->ptr[i].val.ptr);
+	memmove(&m->ptr[i], &m->ptr[i + 1], (m->len - i - 1) * sizeof(struct meta_slot));
+	m->len--;
+	mlist_index(m);
+}
+
+static void mlist_free(metalist *m)
+{
+	for (uint i = 0;  i != m->len;  i++) {
+		pool_put(m->ptr[i].val.ptr);
+	}
+	ffmem_safefree(m->ptr);
+	ffmem_safefree(m->htab);
+	ffmem_zero(m, sizeof(*m));
 }
 
 
 static void que_ontrkfin(entry *e)
 {
+	if (gl_ontrkfin(e)) {
+		ent_unref(e);
+		return;
+	}
+
 	if (qu->mixing) {
 		if (qu->quit_if_done && e->trk_mixed)
 			core->sig(FMED_STOP);
 	} else if (e->stop_after)
 		e->stop_after = 0;
 	else if (e->expand || e->trk_stopped)
-	{}
+		e->expand = 0; // the entry may be played later
 	else if (!e->trk_err)
 		que_cmd(FMED_QUE_NEXT2, &e->e);
 	ent_unref(e);
@@ -1352,6 +4609,15 @@ static void que_taskfunc(void *udata)
 	struct quetask *qt = udata;
 	qt->tsk.handler = NULL;
 	switch ((enum CMD)qt->cmd) {
+	case CMD_GAPLESS:
+		gl_prepare((void*)qt->param);
+		ent_unref((void*)qt->param);
+		break;
+	case CMD_XSCHED_FIN:
+		// the entry's playback state isn't affected by the scheduler's tracks
+		xsched_done((void*)qt->param);
+		ent_unref((void*)qt->param);
+		break;
 	case CMD_TRKFIN:
 		que_ontrkfin((void*)qt->param);
 		break;
@@ -1379,13 +4645,22 @@ typedef struct que_trk {
 static void* que_trk_open(fmed_filt *d)
 {
 	que_trk *t;
-	entry *e = (void*)d->track->getval(d->trk, "queue_item");
+	entry *e = (void*)d->track->getval_id(d->trk, FMED_TRKV_QUEUE_ITEM);
 
 	if ((int64)e == FMED_NULL)
 		return FMED_FILT_SKIP; //the track wasn't created by this module
 
-	t = ffmem_tcalloc1(que_trk);
+	t = fmed_trk_allocT(d, que_trk);
 	if (t == NULL) {
+		if (FMED_NULL != d->track->getval(d->trk, "queue-xsched")) {
+			// free the scheduler's slot
+			struct quetask *qt = ffmem_new(struct quetask);
+			FF_ASSERT(qt != NULL);
+			qt->cmd = CMD_XSCHED_FIN;
+			qt->param = (size_t)e;
+			que_task_add(qt);
+			return NULL;
+		}
 		ent_unref(e);
 		return NULL;
 	}
@@ -1394,33 +4669,71 @@ static void* que_trk_open(fmed_filt *d)
 	t->e = e;
 	t->d = d;
 
-	if (1 == fmed_getval("error")) {
+	if (1 == fmed_getval_id(FMED_TRKV_ERROR)) {
 		que_trk_close(t);
 		return NULL;
 	}
 	return t;
 }
 
+/**
+Conversion pipeline: the entry is referenced by both tracks.
+The input track just releases its reference, and the output track reports the completion.
+If the output track wasn't started, the input track releases the reference of the output track too. */
 static void que_trk_close(void *ctx)
 {
 	que_trk *t = ctx;
+	uint pipe = t->track->cmd(t->trk, FMED_TRACK_PIPE);
+
+	if (pipe == (FMED_TRK_PIPE_IN | FMED_TRK_PIPE_FSTARTED)) {
+		gl_trkclose(t->trk);
+		ent_unref(t->e);
+		return;
+	} else if (pipe == FMED_TRK_PIPE_IN) {
+		ent_unref(t->e);
+	}
 
 	if ((int64)t->d->audio.total != FMED_NULL && t->d->audio.fmt.sample_rate != 0)
 		t->e->e.dur = ffpcm_time(t->d->audio.total, t->d->audio.fmt.sample_rate);
 
-	int stopped = t->track->getval(t->trk, "stopped");
-	int err = t->track->getval(t->trk, "error");
-	t->e->trk_stopped = (stopped != FMED_NULL);
-	t->e->trk_err = (err != FMED_NULL)
-		&& !qu->next_if_err;
-	t->e->trk_mixed = (FMED_NULL != t->track->getval(t->trk, "mix_tracks"));
+	int stopped = t->track->getval_id(t->trk, FMED_TRKV_STOPPED);
+	int err = t->track->getval_id(t->trk, FMED_TRKV_ERROR);
+	uint xsched = (FMED_NULL != t->track->getval(t->trk, "queue-xsched"));
+	if (!xsched) {
+		// the entry may be playing while the scheduler expands it
+		t->e->trk_stopped = (stopped != FMED_NULL);
+		t->e->trk_err = (err != FMED_NULL)
+			&& !qu->next_if_err;
+		t->e->trk_mixed = (FMED_NULL != t->track->getval_id(t->trk, FMED_TRKV_MIX_TRACKS));
+	}
+
+	if ((t->e->expand || xsched) && err == FMED_NULL && stopped == FMED_NULL
+		&& (int64)t->d->audio.total != FMED_NULL) {
+		// the same format as GUI uses
+		char buf[255];
+		ffstr name, val;
+		const fmed_filt *d = t->d;
+		ffstr_setz(&name, "__info");
+		val.ptr = buf;
+		val.len = ffs_fmt(buf, buf + sizeof(buf), "%u kbps, %s, %u Hz, %s, %s"
+			, (d->audio.bitrate + 500) / 1000
+			, (d->audio.decoder != NULL) ? d->audio.decoder : ""
+			, d->audio.fmt.sample_rate
+			, ffpcm_fmtstr(d->audio.fmt.format)
+			, ffpcm_channelstr(d->audio.fmt.channels));
+		que_meta_set(&t->e->e, &name, &val, FMED_QUE_TMETA | FMED_QUE_PRIV | FMED_QUE_OVWRITE);
+
+		mcache_put(t->e);
+	}
 
 	struct quetask *qt = ffmem_new(struct quetask);
 	FF_ASSERT(qt != NULL);
-	qt->cmd = CMD_TRKFIN;
+	qt->cmd = (xsched) ? CMD_XSCHED_FIN : CMD_TRKFIN;
 	qt->param = (size_t)t->e;
 	que_task_add(qt);
 
+	gl_trkclose(t->trk);
+
 	int64 v = t->track->getval(t->trk, "queue-ondone");
 	if (v != FMED_NULL) {
 		void (*ondone)(void*) = (void*)(size_t)v;
@@ -1429,8 +4742,6 @@ static void que_trk_close(void *ctx)
 		void *ctx = (void*)(size_t)v;
 		ondone(ctx);
 	}
-
-	ffmem_free(t);
 }
 
 static int que_trk_process(void *ctx, fmed_filt *d)
@@ -23,6 +23,24 @@ Copyright (c) 2016 Simon Zolin */
 enum {
 	N_FILTERS = 32, //allow up to this number of filters to be added while track is running
 	ALLOWSLEEP_TIMEOUT = 5000,
+	FILT_HIST = 24, //number of log2 buckets for filter call time: [0], [1], [2..3], [4..7], ... usec
+	CHAIN_CACHE_MAX = 64, //max. number of cached chain templates
+	CHAIN_KEY_MAX = 64,
+	CHAIN_EXT_MAX = 16,
+};
+
+/** Filter call statistics. */
+struct filt_stat {
+	uint64 ncalls;
+	uint64 in, out; //bytes consumed/produced
+	uint64 total, max; //usec
+	uint hist[FILT_HIST];
+};
+
+/** Statistics of all tracks for a filter module. */
+struct filt_stat_ent {
+	char *name;
+	struct filt_stat st;
 };
 
 struct tracks {
@@ -31,7 +49,16 @@ struct tracks {
 	const struct fmed_trk_mon *mon;
 	fftmrq_entry allowsleep_tmr;
 	const fmed_queue *qu;
+	ffarr fstats; //struct filt_stat_ent[]
+	ffarr chains; //struct chain_tmpl*[]
+	fflock chains_lk;
+	uint pipe_trks; //number of output tracks of conversion pipelines
 	uint stop_sig :1;
+	uint conv_pipeline :1; // use conversion pipeline
+	uint stdio_splice :1; // stdin -> stdout passthrough
+	uint last_pending :1; // FMED_TRACK_LAST is received while output tracks are still active
+	uint filter_stats :1; // collect filter call statistics
+	uint print_stats :1; // print statistics for all tracks on exit
 };
 
 static struct tracks *g;
@@ -45,7 +72,7 @@ typedef struct fmed_f {
 	} d;
 	const char *name;
 	const fmed_filter *filt;
-	fftime clk;
+	struct filt_stat st;
 	unsigned opened :1
 
 		/** This filter won't return any more data, it won't be called again.
@@ -56,15 +83,42 @@ typedef struct fmed_f {
 		, want_input :1;
 } fmed_f;
 
-typedef struct dict_ent {
+/** Pre-resolved filters for tracks of the same shape. */
+struct chain_tmpl {
+	char key[CHAIN_KEY_MAX];
+	uint keylen;
+	uint n;
+	uint out :1; //output chain: set props below
+	uint conv_gain :1;
+	uint out_seekable :1;
+	fmed_f slots[0]; //filt=NULL: create conversion pipeline here
+};
+
+typedef struct dict_ent dict_ent;
+struct dict_ent {
 	ffrbt_node nod;
+	dict_ent *next; //next entry with the same CRC
 	const char *name;
 	union {
 		int64 val;
 		void *pval;
 	};
 	uint acq :1;
-} dict_ent;
+	uint set :1; //for values with fixed ID
+};
+
+/** Block of the track's arena memory.  Data follows the header. */
+struct arena_blk {
+	struct arena_blk *next;
+	size_t off, cap;
+};
+
+enum {
+	ARENA_ALIGN = 16,
+	ARENA_HDR = (sizeof(struct arena_blk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1),
+	ARENA_FIRST = N_FILTERS * sizeof(fmed_f) + 4 * 1024, //arena memory allocated together with the track object
+	ARENA_BLOCK = 16 * 1024,
+};
 
 enum TRK_ST {
 	TRK_ST_STOPPED,
@@ -80,10 +134,12 @@ typedef struct fm_trk {
 	ffchain_item chain_parent;
 	struct {FFARR(fmed_f)} filters;
 	fflist_cursor cur;
+	dict_ent vals[_FMED_TRKV_END]; //values with fixed ID
 	ffrbtree dict;
 	ffrbtree meta;
 	struct ffps_perf psperf;
 	fftask tsk, tsk_stop, tsk_main;
+	fflock wlk; //protects wid, kq: tasks are posted by other threads while the track is moved to another worker
 	uint wid; //associated worker ID
 	fffd kq; //worker's kqueue
 
@@ -92,23 +148,79 @@ typedef struct fm_trk {
 
 	uint state; //enum TRK_ST
 	uint wflags;
+	struct trk_pipe *pipe; //conversion pipeline this track is a part of
+	uint dict_acq :1; //dictionary has values with acquired data
+	uint meta_acq :1; //meta has values with acquired data
+
+	struct arena_blk *arena; //the current arena block
+	struct arena_blk arena0; //the first arena block, its data follows
 } fm_trk;
 
+enum {
+	PIPE_BLOCKS = 4,
+};
+
+enum PIPE_ST {
+	PIPE_ACTIVE,
+	PIPE_EOF,
+	PIPE_STOP,
+	PIPE_ERR,
+};
+
+struct pipe_blk {
+	ffarr buf;
+	size_t len;
+	int gain; //the input track's gain at the moment the block was written
+	void *ni[FFPCM_CHMASK + 1]; //channels for non-interleaved data
+};
+
+/** Connection between input and output tracks of the conversion pipeline. */
+struct trk_pipe {
+	uint ref; //Thread: main
+	fflock lk; //protects wtrk, rtrk: the peer is woken up by another thread while main thread may detach it
+	fm_trk *wtrk, *rtrk; //input (writer) and output (reader) tracks
+	struct pipe_blk blks[PIPE_BLOCKS];
+	ffatomic nwritten, nread; //number of blocks written/read
+	ffatomic wwait, rwait; //writer/reader waits for a wake-up signal
+	uint wstate; //enum PIPE_ST.  Set by writer.
+	uint rclosed; //set by reader
+	uint started :1; //output track is started
+	uint rhold :1; //reader: the current block is still in use by the next filters
+};
+
 
 static int trk_setout_file(fm_trk *t);
 static int trk_setout(fm_trk *t);
+static int trk_setout_build(fm_trk *t);
 static int trk_opened(fm_trk *t);
 static int trk_open(fm_trk *t, const char *fn);
 static void trk_open_capt(fm_trk *t);
 static void trk_free(fm_trk *t);
 static void trk_fin(fm_trk *t);
+static void trk_onlast(fm_trk *t);
 static void trk_process(void *udata);
+static void trk_onasync(void *udata);
+static int trk_migrate(fm_trk *t);
 static void trk_stop(fm_trk *t, uint flags);
 static fmed_f* trk_modbyext(fm_trk *t, uint flags, const ffstr *ext);
-static void trk_printtime(fm_trk *t);
+static void trk_stat_add(fm_trk *t);
+static void filt_stat_update(struct filt_stat *st, uint64 us, size_t in, size_t out);
+static void fstats_print(void);
+static void fstats_free(void);
 static int trk_meta_enum(fm_trk *t, fmed_trk_meta *meta);
 static int trk_meta_copy(fm_trk *t, fm_trk *src);
+static void trk_vals_copy(fm_trk *t, fm_trk *src);
+static int trk_pipe_want(fm_trk *t);
+static int trk_splice_want(fm_trk *t);
+static void trk_splice_setup(fm_trk *t);
+static fm_trk* trk_pipe_create(fm_trk *t);
+static void trk_pipe_free(fm_trk *t);
+static void pipe_rclose(struct trk_pipe *p);
 static char* chain_print(fm_trk *t, const ffchain_item *mark, char *buf, size_t cap);
+static int chain_outkey(fm_trk *t, ffstr *key, char *buf, size_t cap);
+static int chain_apply(fm_trk *t, const ffstr *key);
+static void chain_add(fm_trk *t, const ffstr *key, uint off, uint out);
+static void chains_free(void);
 static void allowsleep(uint val);
 
 static fmed_f* addfilter(fm_trk *t, const char *modname);
@@ -117,7 +229,12 @@ static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name);
 static int filt_call(fm_trk *t, fmed_f *f);
 static void filt_close(fm_trk *t, fmed_f *f);
 
+static void* arena_alloc(fm_trk *t, size_t size);
+static char* arena_strdup(fm_trk *t, const char *s, size_t len);
+static void arena_free(fm_trk *t);
+
 static dict_ent* dict_add(fm_trk *t, const char *name, uint *f);
+static void dict_rm(fm_trk *t, dict_ent *ent);
 static void dict_ent_free(dict_ent *e);
 
 // TRACK
@@ -136,11 +253,37 @@ static int64 trk_setval4(void *trk, const char *name, int64 val, uint flags);
 static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint flags);
 static char* trk_getvalstr3(void *trk, const void *name, uint flags);
 static void trk_meta_set(void *trk, const ffstr *name, const ffstr *val, uint flags);
+static int64 trk_getval_id(void *trk, uint id);
+static void trk_setval_id(void *trk, uint id, int64 val);
+static void* trk_alloc(void *trk, size_t size);
 const fmed_track _fmed_track = {
 	&trk_create, &trk_conf, &trk_copy_info, &trk_cmd, &trk_cmd2,
 	&trk_popval, &trk_getval, &trk_getvalstr, &trk_setval, &trk_setvalstr, &trk_setval4, &trk_setvalstr4, &trk_getvalstr3,
 	&trk_loginfo,
 	&trk_meta_set,
+	&trk_getval_id, &trk_setval_id,
+	&trk_alloc,
+};
+
+/** Names of values with fixed ID.  Sorted.
+Indexed by enum FMED_TRKV. */
+static const char *const trkv_names[] = {
+	"audio_bitrate",
+	"audio_enc_delay",
+	"audio_end_padding",
+	"audio_frame_samples",
+	"error",
+	"flac_in_frsamples",
+	"icy_meta_int",
+	"low_latency",
+	"mix_tracks",
+	"mpeg_delay",
+	"netin_ptr",
+	"ogg_flush",
+	"ogg_granpos",
+	"out_bufsize",
+	"queue_item",
+	"stopped",
 };
 
 
@@ -150,6 +293,10 @@ int tracks_init(void)
 		return -1;
 	g->qu = core->getmod("#queue.queue");
 	fflist_init(&g->trks);
+	fflk_init(&g->chains_lk);
+	g->filter_stats = (core->getval("filter_stats") == 1);
+	g->conv_pipeline = (core->getval("conv_pipeline") == 1);
+	g->stdio_splice = (core->getval("stdio_splice") == 1);
 	return 0;
 }
 
@@ -165,6 +312,9 @@ void tracks_destroy(void)
 	}
 	if (g->allowsleep_tmr.handler != NULL)
 		allowsleep(2);
+	fstats_print();
+	fstats_free();
+	chains_free();
 	ffmem_free0(g);
 }
 
@@ -194,27 +344,46 @@ static int trk_open(fm_trk *t, const char *fn)
 	trk_setvalstr(t, "input", fn);
 	addfilter(t, "#queue.track");
 
-	if (0 == fffile_infofn(fn, &fi) && fffile_isdir(fffile_infoattr(&fi))) {
+	if (ffs_match(fn, ffsz_len(fn), "http://", 7)) {
+		addfilter(t, "net.http");
+		return 0;
+	}
+
+	uint have_path = (NULL != ffpath_split2(fn, ffsz_len(fn), NULL, &name));
+	ffpath_splitname(name.ptr, name.len, &name, &ext);
+	ffbool std = (!have_path && ffstr_eqcz(&name, "@stdin"));
+
+	char buf[CHAIN_KEY_MAX];
+	ffstr key;
+	ffstr_set(&key, buf, ffs_fmt(buf, buf + sizeof(buf), "i%u.%S", std, &ext));
+	if (ext.len <= CHAIN_EXT_MAX && 0 == chain_apply(t, &key))
+		return 0;
+
+	/* Check for a directory only if the file extension isn't known:
+	 a file with a known extension is opened without an extra stat() call. */
+	const fmed_modinfo *mi = NULL;
+	if (ext.len != 0)
+		mi = core->getmod2(FMED_MOD_INEXT, ext.ptr, ext.len);
+	if (mi == NULL && !std
+		&& 0 == fffile_infofn(fn, &fi) && fffile_isdir(fffile_infoattr(&fi))) {
 		addfilter(t, "plist.dir");
 		return 0;
 	}
 
-	if (ffs_match(fn, ffsz_len(fn), "http://", 7)) {
-		addfilter(t, "net.http");
-	} else {
-		uint have_path = (NULL != ffpath_split2(fn, ffsz_len(fn), NULL, &name));
-		ffpath_splitname(name.ptr, name.len, &name, &ext);
-		if (!have_path && ffstr_eqcz(&name, "@stdin"))
-			addfilter(t, "#file.stdin");
-		else
-			addfilter(t, "#file.in");
+	uint off = t->filters.len;
 
-		if (NULL == trk_modbyext(t, FMED_MOD_INEXT, &ext)) {
-			errlog(t, "can't open file: \"%s\"", fn);
-			return 1;
-		}
+	if (std)
+		addfilter(t, "#file.stdin");
+	else
+		addfilter(t, "#file.in");
+
+	if (mi == NULL || NULL == addfilter1(t, mi)) {
+		errlog(t, "can't open file: \"%s\"", fn);
+		return 1;
 	}
 
+	if (ext.len <= CHAIN_EXT_MAX)
+		chain_add(t, &key, off, 0);
 	return 0;
 }
 
@@ -233,7 +402,29 @@ static void trk_open_capt(fm_trk *t)
 	addfilter(t, "#soundmod.rtpeak");
 }
 
+/** Set output filters, reuse the cached chain for the same track shape. */
 static int trk_setout(fm_trk *t)
+{
+	char buf[CHAIN_KEY_MAX];
+	ffstr key;
+
+	if (0 != chain_outkey(t, &key, buf, sizeof(buf)))
+		return trk_setout_build(t);
+
+	if (0 == chain_apply(t, &key))
+		return 0;
+
+	uint off = t->filters.len;
+	int r;
+	if (0 != (r = trk_setout_build(t)))
+		return r;
+	if (trk_pipe_want(t) && t->pipe == NULL)
+		return 0; // failed to create pipeline: don't cache
+	chain_add(t, &key, off, 1);
+	return 0;
+}
+
+static int trk_setout_build(fm_trk *t)
 {
 	const char *s;
 	ffbool stream_copy = t->props.stream_copy;
@@ -272,8 +463,18 @@ static int trk_setout(fm_trk *t)
 		addfilter(t, "#soundmod.membuf");
 	}
 
+	if (trk_pipe_want(t)) {
+		fm_trk *o = trk_pipe_create(t);
+		if (o != NULL)
+			t = o; // the next filters are added to the output track
+	}
+
+	t->props.conv_gain = 0;
 	if (t->props.type != FMED_TRK_TYPE_MIXOUT && !stream_copy) {
-		addfilter(t, "#soundmod.gain");
+		if (!t->props.use_dynanorm && (int64)t->props.audio.split == FMED_NULL)
+			t->props.conv_gain = 1; // #soundmod.autoconv is the next filter: apply gain in the same pass with conversion
+		else
+			addfilter(t, "#soundmod.gain");
 	}
 
 	if (t->props.use_dynanorm)
@@ -365,30 +566,34 @@ static int trk_opened(fm_trk *t)
 Example of a typical chain:
  #queue.track
  -> INPUT
- -> DECODER -> (#soundmod.until) -> UI -> #soundmod.gain -> (#soundmod.conv/conv-soxr) -> (ENCODER)
+ -> DECODER -> (#soundmod.until) -> UI -> #soundmod.autoconv -> (#soundmod.conv/conv-soxr) -> (ENCODER)
+ (gain is applied by #soundmod.conv, or by #soundmod.autoconv if no conversion is needed)
  -> OUTPUT
 */
 static void* trk_create(uint cmd, const char *fn)
 {
-	fm_trk *t = ffmem_tcalloc1(fm_trk);
+	fm_trk *t = ffmem_calloc(1, FFOFF(fm_trk, arena0) + ARENA_HDR + ARENA_FIRST);
 	if (t == NULL)
 		return NULL;
+	t->arena0.cap = ARENA_FIRST;
+	t->arena = &t->arena0;
 	ffchain_init(&t->filt_chain);
 	t->cur = ffchain_sentl(&t->filt_chain);
 	ffrbt_init(&t->dict);
 	ffrbt_init(&t->meta);
 	fftask_set(&t->tsk, &trk_process, t);
+	fflk_init(&t->wlk);
 
 	trk_copy_info(&t->props, NULL);
 	t->props.track = &_fmed_track;
-	t->props.handler = &trk_process;
+	t->props.handler = &trk_onasync;
 	t->props.trk = t;
 
 	t->id.len = ffs_fmt(t->sid, t->sid + sizeof(t->sid), "*%L", ffatom_incret(&g->trkid));
 	t->id.ptr = t->sid;
 
-	if (NULL == ffarr_allocT((ffarr*)&t->filters, N_FILTERS, fmed_f))
-		goto err;
+	t->filters.ptr = arena_alloc(t, N_FILTERS * sizeof(fmed_f));
+	t->filters.cap = N_FILTERS;
 
 	switch (cmd) {
 
@@ -483,49 +688,204 @@ static void trk_copy_info(fmed_trk *dst, const fmed_trk *src)
 static void trk_onstop(void *p)
 {
 	fm_trk *t = p;
-	trk_setval(t, "stopped", 1);
+	trk_setval_id(t, FMED_TRKV_STOPPED, 1);
 	t->props.flags |= FMED_FSTOP;
 	if (t->state != TRK_ST_ACTIVE)
 		trk_fin(t);
 }
 
+/** Post the task to the track's worker.  Thread: any. */
+static void trk_post(fm_trk *t, fftask *task)
+{
+	fflk_lock(&t->wlk);
+	core->cmd(FMED_TASK_XPOST, task, t->wid);
+	fflk_unlock(&t->wlk);
+}
+
 /** Submit track stop event. */
 static void trk_stop(fm_trk *t, uint flags)
 {
 	fftask_set(&t->tsk_stop, &trk_onstop, t);
-	core->cmd(FMED_TASK_XPOST, &t->tsk_stop, t->wid);
+	trk_post(t, &t->tsk_stop);
+}
+
+static void filt_stat_update(static void filt_stat_update(struct filt_stat *st, uint64 us, size_t in, size_t out)
+{
+	uint i = 0;
+	while (i != FILT_HIST - 1 && (us >> i) != 0)
+		i++;
+	st->hist[i]++;
+	st->ncalls++;
+	st->in += in;
+	st->out += out;
+	st->total += us;
+	st->max = ffmax(st->max, us);
+}
+
+static void filt_stat_add(struct filt_stat *dst, const struct filt_stat *src)
+{
+	dst->ncalls += src->ncalls;
+	dst->in += src->in;
+	dst->out += src->out;
+	dst->total += src->total;
+	dst->max = ffmax(dst->max, src->max);
+	for (uint i = 0;  i != FILT_HIST;  i++) {
+		dst->hist[i] += src->hist[i];
+	}
+}
+
+/** Get the upper bound (usec) of the histogram bucket containing the percentile. */
+static uint64 filt_stat_percentile(const struct filt_stat *st, uint pct)
+{
+	uint64 lim = (st->ncalls * pct + 99) / 100, n = 0;
+	uint i;
+	for (i = 0;  i != FILT_HIST - 1;  i++) {
+		n += st->hist[i];
+		if (n >= lim)
+			break;
+	}
+	return (i == 0) ? 0 : ((1ULL << i) - 1);
 }
 
-static void trk_printtime(fm_trk *t)
+static void filt_stat_print(ffarr *buf, const char *name, const struct filt_stat *st)
+{
+	ffstr_catfmt(buf, "%s: calls:%U  in:%UKB  out:%UKB  time:%Uus  p50:%Uus  p99:%Uus  max:%Uus\n"
+		, name, st->ncalls, st->in / 1024, st->out / 1024, st->total
+		, filt_stat_percentile(st, 50), filt_stat_percentile(st, 99), st->max);
+}
+
+/** Print filter statistics for the track and add them to statistics for all tracks. */
+static void trk_stat_add(fm_trk *t)
 {
 	fmed_f *pf;
-	ffstr3 s = {0};
-	fftime all = {0};
+	ffarr buf = {};
+	uint print = (t->props.print_time || core->loglev == FMED_LOG_DEBUG);
 
 	FFARR_WALK(&t->filters, pf) {
-		fftime_add(&all, &pf->clk);
+		if (pf->st.ncalls == 0)
+			continue;
+
+		if (print)
+			filt_stat_print(&buf, pf->name, &pf->st);
+
+		struct filt_stat_ent *ent;
+		FFARR_WALKT(&g->fstats, ent, struct filt_stat_ent) {
+			if (ffsz_eq(ent->name, pf->name))
+				goto found;
+		}
+		if (NULL == (ent = ffarr_pushgrowT(&g->fstats, 16, struct filt_stat_ent)))
+			continue;
+		ffmem_tzero(ent);
+		if (NULL == (ent->name = ffsz_alcopyz(pf->name))) {
+			g->fstats.len--;
+			continue;
+		}
+found:
+		filt_stat_add(&ent->st, &pf->st);
 	}
-	if (fftime_empty(&all))
+
+	if (t->props.print_time)
+		g->print_stats = 1;
+
+	if (buf.len != 0)
+		core->log((t->props.print_time) ? FMED_LOG_INFO : FMED_LOG_DEBUG, t, "track"
+			, "filter statistics:\n%S", &buf);
+	ffarr_free(&buf);
+}
+
+/** Print filter statistics for all tracks. */
+static void fstats_print(void)
+{
+	ffarr buf = {};
+	const struct filt_stat_ent *ent;
+
+	if (!(g->print_stats || core->loglev == FMED_LOG_DEBUG))
 		return;
-	ffstr_catfmt(&s, "time: %u.%06u.  ", (int)fftime_sec(&all), (int)fftime_usec(&all));
 
-	FFARR_WALK(&t->filters, pf) {
-		ffstr_catfmt(&s, "%s: %u.%06u (%u%%), "
-			, pf->name, (int)fftime_sec(&pf->clk), (int)fftime_usec(&pf->clk)
-			, (int)(fftime_mcs(&pf->clk) * 100 / fftime_mcs(&all)));
+	FFARR_WALKT(&g->fstats, ent, struct filt_stat_ent) {
+		filt_stat_print(&buf, ent->name, &ent->st);
 	}
-	if (s.len > FFSLEN(", "))
-		s.len -= FFSLEN(", ");
+	if (buf.len != 0)
+		core->log((g->print_stats) ? FMED_LOG_INFO : FMED_LOG_DEBUG, NULL, "track"
+			, "filter statistics (all tracks):\n%S", &buf);
+	ffarr_free(&buf);
+}
 
-	dbglog(t, "%S", &s);
-	ffarr_free(&s);
+static void fstats_free(void)
+{
+	struct filt_stat_ent *ent;
+	FFARR_WALKT(&g->fstats, ent, struct filt_stat_ent) {
+		ffmem_free(ent->name);
+	}
+	ffarr_free(&g->fstats);
 }
 
+/** Free acquired data of the entry and all entries chained to it.
+Entries themselves are allocated from the track's arena. */
 static void dict_ent_free(dict_ent *e)
 {
-	if (e->acq)
-		ffmem_free(e->pval);
-	ffmem_free(e);
+	for (;  e != NULL;  e = e->next) {
+		if (e->acq)
+			ffmem_free(e->pval);
+	}
+}
+
+/** Allocate zero-filled memory from the track's arena.
+The memory is released all at once when the track is destroyed. */
+static void* arena_alloc(fm_trk *t, size_t size)
+{
+	struct arena_blk *b = t->arena;
+
+	size = ff_align_ceil(size, ARENA_ALIGN);
+	if (b->cap - b->off < size) {
+		size_t cap = ffmax(size, ARENA_BLOCK);
+		struct arena_blk *nb;
+		if (NULL == (nb = ffmem_calloc(1, ARENA_HDR + cap)))
+			return NULL;
+		nb->cap = cap;
+
+		if (size > ARENA_BLOCK / 2) {
+			// large allocation: don't waste the free space in the current block
+			nb->next = b->next;
+			b->next = nb;
+			nb->off = size;
+			return (byte*)nb + ARENA_HDR;
+		}
+
+		nb->next = b;
+		t->arena = b = nb;
+	}
+
+	void *p = (byte*)b + ARENA_HDR + b->off;
+	b->off += size;
+	return p;
+}
+
+static char* arena_strdup(fm_trk *t, const char *s, size_t len)
+{
+	char *p;
+	if (NULL == (p = arena_alloc(t, len + 1)))
+		return NULL;
+	ffmemcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+/** Free all arena blocks except the first one which is a part of the track object. */
+static void arena_free(fm_trk *t)
+{
+	struct arena_blk *b, *next;
+	for (b = t->arena;  b != NULL;  b = next) {
+		next = b->next;
+		if (b != &t->arena0)
+			ffmem_free(b);
+	}
+}
+
+static void* trk_alloc(void *trk, size_t size)
+{
+	fm_trk *t = trk;
+	return arena_alloc(t, size);
 }
 
 static void trk_free_tsk(void *param)
@@ -540,6 +900,17 @@ static void trk_fin(fm_trk *t)
 	core->task(&t->tsk_main, FMED_TASK_POST);
 }
 
+/** Signal the delayed FMED_TRACK_LAST when there are no more tracks to wait for. */
+static void trk_onlast(fm_trk *t)
+{
+	if (g->pipe_trks != 0
+		|| (core->props->parallel && g->trks.len != 0))
+		return;
+	g->last_pending = 0;
+	if (g->mon != NULL)
+		g->mon->onsig(&t->props, FMED_TRK_ONLAST);
+}
+
 /** Free memory associated with the track.  Thread: main. */
 static void trk_free(fm_trk *t)
 {
@@ -573,13 +944,20 @@ static void trk_free(fm_trk *t)
 		}
 	}
 
-	if (core->loglev == FMED_LOG_DEBUG)
-		trk_printtime(t);
+	if (g->filter_stats)
+		trk_stat_add(t);
 
-	ffarr_free(&t->filters);
+	if (t->pipe != NULL)
+		trk_pipe_free(t);
 
-	ffrbt_freeall(&t->dict, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
-	ffrbt_freeall(&t->meta, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
+	for (uint i = 0;  i != _FMED_TRKV_END;  i++) {
+		if (t->vals[i].acq)
+			ffmem_free(t->vals[i].pval);
+	}
+	if (t->dict_acq)
+		ffrbt_freeall(&t->dict, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
+	if (t->meta_acq)
+		ffrbt_freeall(&t->meta, (ffrbt_free_t)&dict_ent_free, FFOFF(dict_ent, nod));
 
 	if (fflist_exists(&g->trks, &t->sib)) {
 		fflist_rm(&g->trks, &t->sib);
@@ -590,7 +968,11 @@ static void trk_free(fm_trk *t)
 	if (g->mon != NULL)
 		g->mon->onsig(&t->props, FMED_TRK_ONCLOSE);
 
+	if (g->last_pending)
+		trk_onlast(t);
+
 	dbglog(t, "closed");
+	arena_free(t);
 	ffmem_free(t);
 
 	if (g->stop_sig && g->trks.len == 0)
@@ -633,9 +1015,8 @@ static int filt_call(fm_trk *t, fmed_f *f)
 	int r;
 	fftime t1 = {}, t2;
 
-	if (core->loglev == FMED_LOG_DEBUG) {
+	if (g->filter_stats)
 		ffclk_get(&t1);
-	}
 
 	ffint_bitmask(&t->props.flags, FMED_FFWD, f->newdata);
 	f->newdata = 0;
@@ -669,13 +1050,16 @@ static int filt_call(fm_trk *t, fmed_f *f)
 		f->opened = 1;
 	}
 
+	size_t inlen = f->d.datalen;
 	r = f->filt->process(f->ctx, &t->props);
 	f->d.data = t->props.data,  f->d.datalen = t->props.datalen;
 
-	if (core->loglev == FMED_LOG_DEBUG) {
+	if (g->filter_stats) {
 		ffclk_get(&t2);
 		ffclk_diff(&t1, &t2);
-		fftime_add(&f->clk, &t2);
+		// 'outlen' is valid only if the filter has returned output data
+		size_t outlen = (r == FMED_ROK || r == FMED_RDATA || r == FMED_RDONE) ? t->props.outlen : 0;
+		filt_stat_update(&f->st, fftime_mcs(&t2), inlen - f->d.datalen, outlen);
 	}
 
 #ifdef _DEBUG
@@ -685,6 +1069,59 @@ static int filt_call(fm_trk *t, fmed_f *f)
 	return r;
 }
 
+/** Filter's asynchronous operation is complete.
+The handler is called within the thread of the kqueue the filter was attached to,
+ but the track may have been moved to another worker since then. */
+static void trk_onasync(void *udata)
+{
+	fm_trk *t = udata;
+	if (!core_job_iscurrent(FF_READONCE(t->wid))) {
+		trk_cmd(t, FMED_TRACK_WAKE);
+		return;
+	}
+	trk_process(t);
+}
+
+/** Move a parallel track to an idle worker.
+It's safe to do it only from the track's worker between filter calls,
+ while the track isn't referenced by the current worker.
+The track stays if any of its tasks is still queued in the current worker:
+ other threads post tasks under 'wlk', so after the move they reach the new worker only.
+A track of a conversion pipeline isn't moved to the worker of its peer.
+Return 1 if the track will continue on another worker. */
+static int trk_migrate(fm_trk *t)
+{
+	if (!(t->wflags & FMED_WORKER_FPARALLEL))
+		return 0;
+
+	uint except = -1;
+	struct trk_pipe *p = t->pipe;
+	if (p != NULL) {
+		fflk_lock(&p->lk);
+		fm_trk *peer = (t == p->wtrk) ? p->rtrk : p->wtrk;
+		if (peer != NULL)
+			except = FF_READONCE(peer->wid);
+		fflk_unlock(&p->lk);
+	}
+
+	fftask *tasks[] = { &t->tsk, &t->tsk_stop };
+	fffd kq;
+	uint old = t->wid;
+	fflk_lock(&t->wlk);
+	uint wid = core_job_migrate(old, except, tasks, FFCNT(tasks), &kq);
+	if (wid != old) {
+		t->kq = kq;
+		FF_WRITEONCE(t->wid, wid);
+		core->cmd(FMED_TASK_XPOST, &t->tsk, wid);
+	}
+	fflk_unlock(&t->wlk);
+
+	if (wid == old)
+		return 0;
+	dbglog(t, "moved to worker #%u", wid);
+	return 1;
+}
+
 static void trk_process(void *udata)
 {
 	fm_trk *t = udata;
@@ -692,6 +1129,12 @@ static void trk_process(void *udata)
 	fmed_f *f;
 	int r, e;
 	size_t jobdata;
+
+	if (t->state == TRK_ST_ACTIVE
+		&& core_job_iscurrent(t->wid)
+		&& trk_migrate(t))
+		return;
+
 	core_job_enter(t->wid, &jobdata);
 
 	for (;;) {
@@ -703,7 +1146,8 @@ static void trk_process(void *udata)
 		}
 
 		if (core_job_shouldyield(t->wid, &jobdata)) {
-			trk_cmd(t, FMED_TRACK_WAKE);
+			if (!trk_migrate(t))
+				trk_cmd(t, FMED_TRACK_WAKE);
 			return;
 		}
 
@@ -856,27 +1300,52 @@ shift:
 
 fin:
 	if (t->state == TRK_ST_ERR)
-		trk_setval(t, "error", 1);
+		trk_setval_id(t, FMED_TRKV_ERROR, 1);
 
 	trk_fin(t);
 }
 
 
-static dict_ent* dict_findstr(fm_trk *t, const ffstr *name)
+/** Get ID of the value with fixed ID.
+Return enum FMED_TRKV;  -1 if not found. */
+static int trkv_find(const ffstr *name)
+{
+	size_t lo = 0, hi = FFCNT(trkv_names);
+	while (lo != hi) {
+		size_t i = (lo + hi) / 2;
+		ffstr s;
+		ffstr_setz(&s, trkv_names[i]);
+		int r = ffstr_cmp2(name, &s);
+		if (r == 0)
+			return i;
+		else if (r < 0)
+			hi = i;
+		else
+			lo = i + 1;
+	}
+	return -1;
+}
+
+static dict_ent* tree_find(ffrbtree *tree, const ffstr *name)
 {
 	dict_ent *ent;
 	uint crc = ffcrc32_get(name->ptr, name->len);
-	ffrbt_node *nod;
 
-	nod = ffrbt_find(&t->dict, crc, NULL);
-	if (nod == NULL)
-		return NULL;
-	ent = (dict_ent*)nod;
+	ent = (dict_ent*)ffrbt_find(tree, crc, NULL);
+	for (;  ent != NULL;  ent = ent->next) {
+		if (ffstr_eqz(name, ent->name))
+			return ent;
+	}
+	return NULL;
+}
 
-	if (!ffstr_eqz(name, ent->name))
-		return NULL;
+static dict_ent* dict_findstr(fm_trk *t, const ffstr *name)
+{
+	int id = trkv_find(name);
+	if (id >= 0)
+		return (t->vals[id].set) ? &t->vals[id] : NULL;
 
-	return ent;
+	return tree_find(&t->dict, name);
 }
 
 static dict_ent* dict_find(fm_trk *t, const char *name)
@@ -889,41 +1358,87 @@ static dict_ent* dict_find(fm_trk *t, const char *name)
 static dict_ent* dict_add(fm_trk *t, const char *name, uint *f)
 {
 	dict_ent *ent;
-	uint crc = ffcrc32_getz(name, 0);
+	uint crc;
 	ffrbt_node *nod, *parent;
 	ffrbtree *tree = (*f & FMED_TRK_META) ? &t->meta : &t->dict;
 
-	nod = ffrbt_find(tree, crc, &parent);
-	if (nod != NULL) {
-		ent = (dict_ent*)nod;
-		if (0 != ffsz_cmp(name, ent->name)) {
-			errlog(t, "setval: CRC collision: %u, key: %s, with key: %s"
-				, crc, name, ent->name);
-			t->state = TRK_ST_ERR;
-			return NULL;
+	if (!(*f & FMED_TRK_META)) {
+		ffstr s;
+		ffstr_setz(&s, name);
+		int id = trkv_find(&s);
+		if (id >= 0) {
+			ent = &t->vals[id];
+			*f = ent->set;
+			ent->set = 1;
+			ent->name = trkv_names[id];
+			return ent;
 		}
-		*f = 1;
+	}
 
-	} else {
-		ent = ffmem_tcalloc1(dict_ent);
-		if (ent == NULL) {
-			errlog(t, "setval: %e", FFERR_BUFALOC);
-			t->state = TRK_ST_ERR;
-			return NULL;
+	crc = ffcrc32_getz(name, 0);
+	nod = ffrbt_find(tree, crc, &parent);
+	for (ent = (dict_ent*)nod;  ent != NULL;  ent = ent->next) {
+		if (!ffsz_cmp(name, ent->name)) {
+			*f = 1;
+			return ent;
 		}
-		ent->nod.key = crc;
-		ffrbt_insert(tree, &ent->nod, parent);
-		ent->name = name;
-		*f = 0;
 	}
 
+	ent = arena_alloc(t, sizeof(dict_ent));
+	if (ent == NULL) {
+		errlog(t, "setval: %e", FFERR_BUFALOC);
+		t->state = TRK_ST_ERR;
+		return NULL;
+	}
+	ent->nod.key = crc;
+	ent->name = name;
+	*f = 0;
+
+	if (nod != NULL) {
+		// CRC collision: chain to the entry in tree
+		dict_ent *head = (dict_ent*)nod;
+		ent->next = head->next;
+		head->next = ent;
+	} else
+		ffrbt_insert(tree, &ent->nod, parent);
+
 	return ent;
 }
 
+/** Remove value and free its data. */
+static void dict_rm(fm_trk *t, dict_ent *ent)
+{
+	if (ent >= t->vals && ent < t->vals + _FMED_TRKV_END) {
+		if (ent->acq)
+			ffmem_free(ent->pval);
+		ent->acq = 0;
+		ent->set = 0;
+		return;
+	}
+
+	dict_ent *head = (dict_ent*)ffrbt_find(&t->dict, ent->nod.key, NULL);
+	if (head == ent) {
+		ffrbt_rm(&t->dict, &ent->nod);
+		if (ent->next != NULL) {
+			ffrbt_node *parent;
+			ent->next->nod.key = ent->nod.key;
+			ffrbt_find(&t->dict, ent->nod.key, &parent);
+			ffrbt_insert(&t->dict, &ent->next->nod, parent);
+		}
+	} else {
+		while (head->next != ent)
+			head = head->next;
+		head->next = ent->next;
+	}
+
+	ent->next = NULL;
+	dict_ent_free(ent);
+}
+
 static void trk_meta_set(void *trk, const ffstr *name, const ffstr *val, uint flags)
 {
 	fm_trk *t = trk;
-	void *qent = (void*)trk_getval(t, "queue_item");
+	void *qent = (void*)trk_getval_id(t, FMED_TRKV_QUEUE_ITEM);
 	if (qent == FMED_PNULL)
 		return;
 	g->qu->meta_set(qent, name->ptr, name->len, val->ptr, val->len, flags);
@@ -931,19 +1446,7 @@ static void trk_meta_set(void *trk, const ffstr *name, const ffstr *val, uint fl
 
 static dict_ent* meta_find(fm_trk *t, const ffstr *name)
 {
-	dict_ent *ent;
-	uint crc = ffcrc32_get(name->ptr, name->len);
-	ffrbt_node *nod;
-
-	nod = ffrbt_find(&t->meta, crc, NULL);
-	if (nod == NULL)
-		return NULL;
-	ent = (dict_ent*)nod;
-
-	if (!ffstr_eqz(name, ent->name))
-		return NULL;
-
-	return ent;
+	return tree_find(&t->meta, name);
 }
 
 static int trk_meta_enum(fm_trk *t, fmed_trk_meta *meta)
@@ -954,8 +1457,13 @@ static int trk_meta_enum(fm_trk *t, fmed_trk_meta *meta)
 				meta->trnod = fftree_min((void*)t->meta.root, &t->meta.sentl);
 			else
 				meta->trnod = &t->meta.sentl;
-		} else
-			meta->trnod = fftree_successor(meta->trnod, &t->meta.sentl);
+		} else if (((dict_ent*)meta->trnod)->next != NULL) {
+			meta->trnod = ((dict_ent*)meta->trnod)->next;
+		} else {
+			// continue from the tree node that holds the chain of entries with the same CRC
+			ffrbt_node *nod = ffrbt_find(&t->meta, ((ffrbt_node*)meta->trnod)->key, NULL);
+			meta->trnod = fftree_successor(nod, &t->meta.sentl);
+		}
 		if (meta->trnod != &t->meta.sentl) {
 			const dict_ent *e = (dict_ent*)meta->trnod;
 			ffstr_setz(&meta->name, e->name);
@@ -966,7 +1474,7 @@ static int trk_meta_enum(fm_trk *t, fmed_trk_meta *meta)
 
 	ffstr *val;
 	if (meta->qent == NULL
-		&& FMED_PNULL == (meta->qent = (void*)trk_getval(t, "queue_item")))
+		&& FMED_PNULL == (meta->qent = (void*)trk_getval_id(t, FMED_TRKV_QUEUE_ITEM)))
 		return 1;
 	for (;;) {
 		val = g->qu->meta(meta->qent, meta->idx++, &meta->name, meta->flags);
@@ -991,6 +1499,38 @@ static int trk_meta_copy(fm_trk *t, fm_trk *src)
 	return 0;
 }
 
+/** Copy values and meta of another track. */
+static void trk_vals_copy(fm_trk *t, fm_trk *src)
+{
+	for (uint i = 0;  i != _FMED_TRKV_END;  i++) {
+		const dict_ent *e = &src->vals[i];
+		if (!e->set || i == FMED_TRKV_ERROR || i == FMED_TRKV_STOPPED)
+			continue;
+		if (e->acq)
+			trk_setvalstr4(t, trkv_names[i], arena_strdup(t, e->pval, ffsz_len(e->pval)), 0);
+		else
+			trk_setval_id(t, i, e->val);
+	}
+
+	ffrbtree *trees[] = { &src->dict, &src->meta };
+	for (uint i = 0;  i != FFCNT(trees);  i++) {
+		ffrbtree *tree = trees[i];
+		if (tree->root == &tree->sentl)
+			continue;
+
+		for (ffrbt_node *nod = (void*)fftree_min((void*)tree->root, &tree->sentl);  nod != &tree->sentl;  nod = (void*)fftree_successor((void*)nod, &tree->sentl)) {
+			for (const dict_ent *e = (void*)nod;  e != NULL;  e = e->next) {
+				if (tree == &src->meta)
+					trk_setvalstr4(t, e->name, e->pval, FMED_TRK_META);
+				else if (e->acq)
+					trk_setvalstr4(t, e->name, arena_strdup(t, e->pval, ffsz_len(e->pval)), 0);
+				else
+					trk_setval4(t, e->name, e->val, 0);
+			}
+		}
+	}
+}
+
 /** Add filter to chain. */
 static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name)
 {
@@ -1124,8 +1664,10 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 
 	case FMED_TRACK_START:
 	case FMED_TRACK_XSTART:
-		if (0 != trk_setout(t)) {
-			trk_setval(t, "error", 1);
+		if (trk_splice_want(t))
+			trk_splice_setup(t);
+		else if (0 != trk_setout(t)) {
+			trk_setval_id(t, FMED_TRKV_ERROR, 1);
 		}
 		if (0 != trk_opened(t)) {
 			trk_free(t);
@@ -1137,9 +1679,17 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 			ffps_perf(&t->psperf, FFPS_PERF_REALTIME | FFPS_PERF_CPUTIME | FFPS_PERF_RUSAGE);
 
 		t->wflags = (cmd == FMED_TRACK_XSTART) ? FMED_WORKER_FPARALLEL : 0;
+		if (t->pipe != NULL)
+			t->wflags = FMED_WORKER_FPARALLEL; // the worker is busy with the input track
 		t->wid = core->cmd(FMED_WORKER_ASSIGN, &t->kq, t->wflags);
 
-		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
+		if (t->pipe != NULL) {
+			fm_trk *o = t->pipe->rtrk;
+			o->wflags = FMED_WORKER_FPARALLEL | FMED_WORKER_FOTHER;
+			o->wid = core->cmd(FMED_WORKER_ASSIGN, &o->kq, o->wflags, t->wid);
+		}
+
+		trk_post(t, &t->tsk);
 		break;
 
 	case FMED_TRACK_PAUSE:
@@ -1151,12 +1701,18 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		break;
 
 	case FMED_TRACK_LAST:
+		if (g->pipe_trks != 0
+			|| (core->props->parallel && g->trks.len != 0)) {
+			// wait until output tracks of conversion pipelines and all parallel tracks are finished
+			g->last_pending = 1;
+			break;
+		}
 		if (g->mon != NULL)
 			g->mon->onsig(&t->props, FMED_TRK_ONLAST);
 		break;
 
 	case FMED_TRACK_WAKE:
-		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
+		trk_post(t, &t->tsk);
 		break;
 
 	case FMED_TRACK_FILT_ADDFIRST:
@@ -1212,7 +1768,7 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 			break;
 		}
 		void *qent;
-		if (FMED_PNULL == (qent = (void*)trk_getval(t, "queue_item"))) {
+		if (FMED_PNULL == (qent = (void*)trk_getval_id(t, FMED_TRKV_QUEUE_ITEM))) {
 			r = 0;
 			break;
 		}
@@ -1240,6 +1796,14 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		r = (size_t)t->kq;
 		break;
 
+	case FMED_TRACK_PIPE:
+		r = FMED_TRK_PIPE_NONE;
+		if (t->pipe != NULL && t == t->pipe->wtrk)
+			r = FMED_TRK_PIPE_IN | ((t->pipe->started) ? FMED_TRK_PIPE_FSTARTED : 0);
+		else if (t->pipe != NULL)
+			r = FMED_TRK_PIPE_OUT;
+		break;
+
 	default:
 		errlog(t, "invalid command:%u", cmd);
 	}
@@ -1270,8 +1834,7 @@ static int64 trk_popval(void *trk, const char *name)
 	dict_ent *ent = dict_find(t, name);
 	if (ent != NULL) {
 		int64 val = ent->val;
-		ffrbt_rm(&t->dict, &ent->nod);
-		dict_ent_free(ent);
+		dict_rm(t, ent);
 		return val;
 	}
 
@@ -1311,7 +1874,7 @@ static char* trk_getvalstr3(void *trk, const void *name, uint flags)
 		ent = meta_find(t, &nm);
 		if (ent == NULL) {
 			void *qent;
-			if (FMED_PNULL == (qent = (void*)trk_getval(t, "queue_item")))
+			if (FMED_PNULL == (qent = (void*)trk_getval_id(t, FMED_TRKV_QUEUE_ITEM)))
 				return FMED_PNULL;
 			ffstr *val;
 			if (NULL == (val = g->qu->meta_find(qent, nm.ptr, nm.len)))
@@ -1328,6 +1891,33 @@ static char* trk_getvalstr3(void *trk, const void *name, uint flags)
 	return ent->pval;
 }
 
+static int64 trk_getval_id(void *trk, uint id)
+{
+	fm_trk *t = trk;
+	FF_ASSERT(id < _FMED_TRKV_END);
+	if (!t->vals[id].set)
+		return FMED_NULL;
+	return t->vals[id].val;
+}
+
+static void trk_setval_id(void *trk, uint id, int64 val)
+{
+	fm_trk *t = trk;
+	FF_ASSERT(id < _FMED_TRKV_END);
+	dict_ent *ent = &t->vals[id];
+
+	if (ent->acq) {
+		ffmem_free(ent->pval);
+		ent->acq = 0;
+	} else if (ent->set && ent->val == val) {
+		return;
+	}
+
+	ent->val = val;
+	ent->set = 1;
+	dbglog(trk, "setval: %s = %D", trkv_names[id], val);
+}
+
 static int trk_setval(void *trk, const char *name, int64 val)
 {
 	trk_setval4(trk, name, val, 0);
@@ -1366,19 +1956,28 @@ static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint f
 		if (ent == NULL)
 			return NULL;
 
-		if (ent->acq)
-			ffmem_free(ent->pval);
-
-		if (flags & FMED_TRK_VALSTR) {
-			const ffstr *sval = (void*)val;
-			ent->pval = ffsz_alcopy(sval->ptr, sval->len);
+		ffstr sval;
+		if (flags & FMED_TRK_VALSTR)
+			sval = *(ffstr*)val;
+		else
+			ffstr_setz(&sval, val);
+
+		if (st == 1) {
+			/* The value is replaced (e.g. by a decoder updating the tags periodically):
+			 keep it on the heap so that the arena doesn't grow with every update. */
+			if (ent->acq)
+				ffmem_free(ent->pval);
+			ent->pval = ffsz_alcopy(sval.ptr, sval.len);
+			ent->acq = 1;
+			t->meta_acq = 1;
 		} else
-			ent->pval = ffsz_alcopyz(val);
+			ent->pval = arena_strdup(t, sval.ptr, sval.len);
 
-		if (ent->pval == NULL)
+		if (ent->pval == NULL) {
+			ent->acq = 0;
 			return NULL;
+		}
 
-		ent->acq = 1;
 		dbglog(trk, "set meta: %s = %s", name, ent->pval);
 		return ent->pval;
 
@@ -1396,6 +1995,8 @@ static char* trk_setvalstr4(void *trk, const char *name, const char *val, uint f
 	if (ent->acq)
 		ffmem_free(ent->pval);
 	ent->acq = (flags & FMED_TRK_FACQUIRE) ? 1 : 0;
+	if (ent->acq && !(ent >= t->vals && ent < t->vals + _FMED_TRKV_END))
+		t->dict_acq = 1;
 
 	ent->pval = (void*)val;
 
@@ -1408,3 +2009,566 @@ static int trk_setvalstr(void *trk, const char *name, const char *val)
 	trk_setvalstr4(trk, name, val, 0);
 	return 0;
 }
+
+// CHAIN CACHE
+
+/** Get the key describing the shape of the output part of the chain.
+Return 0 if the chain can be cached. */
+static int chain_outkey(fm_trk *t, ffstr *key, char *buf, size_t cap)
+{
+	const fmed_trk *p = &t->props;
+	ffstr name = {}, ext = {};
+	uint f = 0;
+
+	const char *ofn = trk_getvalstr(t, "output");
+	if (ofn != FMED_PNULL) {
+		f |= 1;
+		if (NULL == ffpath_split3(ofn, ffsz_len(ofn), NULL, &name, &ext)
+			&& ffstr_eqcz(&name, "@stdout"))
+			f |= 2;
+	}
+	if (ext.len > CHAIN_EXT_MAX)
+		return 1;
+
+	f |= (p->stream_copy << 2)
+		| (p->pcm_peaks << 3)
+		| (p->use_dynanorm << 4)
+		| (((int64)p->audio.split != FMED_NULL) << 5)
+		| ((p->a_start_level != 0) << 6)
+		| ((p->a_stop_level != 0) << 7)
+		| ((p->a_prebuffer != 0) << 8)
+		| (trk_pipe_want(t) << 9);
+
+	// runtime inputs: the playback device module may be changed while fmedia is running
+	f |= (core->props->gui << 10)
+		| (core->props->tui << 11);
+
+	ffstr_set(key, buf, ffs_fmt(buf, buf + cap, "o%u.%xu.%p.%S", p->type, f, core->props->playback_module, &ext));
+	return 0;
+}
+
+static const struct chain_tmpl* chain_find(const ffstr *key)
+{
+	const struct chain_tmpl *c = NULL;
+	fflk_lock(&g->chains_lk);
+	struct chain_tmpl **it;
+	FFARR_WALKT(&g->chains, it, struct chain_tmpl*) {
+		if (ffstr_eq(key, (*it)->key, (*it)->keylen)) {
+			c = *it;
+			break;
+		}
+	}
+	fflk_unlock(&g->chains_lk);
+	return c;
+}
+
+/** Add filters to the track from the cached chain template.
+Return 0 on success;  1 if there's no template for this key. */
+static int chain_apply(fm_trk *t, const ffstr *key)
+{
+	const struct chain_tmpl *c;
+	fmed_f *f;
+
+	if (NULL == (c = chain_find(key))
+		|| t->filters.len + c->n > t->filters.cap)
+		return 1;
+
+	for (uint i = 0;  i != c->n;  i++) {
+		if (c->slots[i].filt == NULL) {
+			fm_trk *o = trk_pipe_create(t);
+			if (o != NULL)
+				t = o; // the next filters are added to the output track
+			continue;
+		}
+
+		f = ffarr_endT(&t->filters, fmed_f);
+		ffmemcpy(f, &c->slots[i], sizeof(fmed_f));
+		ffchain_add(&t->filt_chain, &f->sib);
+		t->filters.len++;
+	}
+
+	if (t->cur == ffchain_sentl(&t->filt_chain))
+		t->cur = ffchain_first(&t->filt_chain);
+
+	if (c->out) {
+		t->props.conv_gain = c->conv_gain;
+		t->props.out_seekable = c->out_seekable;
+	}
+
+	char buf[255];
+	dbglog(t, "chain from cache: %S: [%s]"
+		, key, chain_print(t, NULL, buf, sizeof(buf)));
+	return 0;
+}
+
+/** Store the filters added to the track starting at index 'off' as a template.
+If the chain was split into a conversion pipeline,
+ 'pipe-out' filter of the input track and 'pipe-in' filter of the output track are replaced with a marker. */
+static void chain_add(fm_trk *t, const ffstr *key, uint off, uint out)
+{
+	struct chain_tmpl *c = NULL;
+	fm_trk *o = (t->pipe != NULL) ? t->pipe->rtrk : NULL;
+	uint n = t->filters.len - off;
+	if (o != NULL)
+		n += o->filters.len - 1;
+
+	if (key->len > sizeof(c->key))
+		return;
+
+	fflk_lock(&g->chains_lk);
+	if (g->chains.len == CHAIN_CACHE_MAX)
+		goto end;
+
+	struct chain_tmpl **it;
+	FFARR_WALKT(&g->chains, it, struct chain_tmpl*) {
+		if (ffstr_eq(key, (*it)->key, (*it)->keylen))
+			goto end; // added by another thread
+	}
+
+	if (NULL == (c = ffmem_calloc(1, sizeof(struct chain_tmpl) + n * sizeof(fmed_f))))
+		goto end;
+	ffmemcpy(c->key, key->ptr, key->len);
+	c->keylen = key->len;
+	c->n = n;
+	c->out = out;
+
+	const fmed_f *f = (fmed_f*)t->filters.ptr + off;
+	if (o == NULL) {
+		ffmemcpy(c->slots, f, n * sizeof(fmed_f));
+	} else {
+		uint nt = t->filters.len - off - 1;
+		ffmemcpy(c->slots, f, nt * sizeof(fmed_f));
+		c->slots[nt].filt = NULL;
+		ffmemcpy(&c->slots[nt + 1], (fmed_f*)o->filters.ptr + 1, (o->filters.len - 1) * sizeof(fmed_f));
+	}
+	for (uint i = 0;  i != n;  i++) {
+		ffmem_tzero(&c->slots[i].sib);
+		ffmem_tzero(&c->slots[i].st);
+	}
+
+	const fm_trk *last = (o != NULL) ? o : t;
+	c->conv_gain = last->props.conv_gain;
+	c->out_seekable = last->props.out_seekable;
+
+	struct chain_tmpl **pc;
+	if (NULL == (pc = ffarr_pushgrowT(&g->chains, 8, struct chain_tmpl*))) {
+		ffmem_free(c);
+		goto end;
+	}
+	*pc = c;
+	dbglog(t, "chain cache: added %S (%u filters)", key, n);
+
+end:
+	fflk_unlock(&g->chains_lk);
+}
+
+static void chains_free(void)
+{
+	struct chain_tmpl **it;
+	FFARR_WALKT(&g->chains, it, struct chain_tmpl*) {
+		ffmem_free(*it);
+	}
+	ffarr_free(&g->chains);
+}
+
+
+// SPLICE
+
+/*
+Byte-identical passthrough: "@stdin.EXT" -> "@stdout.EXT" with nothing to change in the data:
+ no conversion, seeking, gain, audio filters, encoder settings or user meta.
+The track chain is replaced with #file.splice which moves the data from stdin to stdout as is,
+ instead of parsing, decoding and re-encoding it.
+*/
+
+/** Return TRUE if the track can pass the data from stdin to stdout without processing. */
+static int trk_splice_want(fm_trk *t)
+{
+	const fmed_trk *p = &t->props;
+	const char *in, *out;
+	ffstr iname, iext, oname, oext;
+
+	if (!g->stdio_splice
+		|| p->type != FMED_TRK_TYPE_PLAYBACK
+		|| FMED_PNULL == (in = trk_getvalstr(t, "input"))
+		|| FMED_PNULL == (out = trk_getvalstr(t, "output")))
+		return 0;
+
+	if (NULL != ffpath_split3(in, ffsz_len(in), NULL, &iname, &iext)
+		|| NULL != ffpath_split3(out, ffsz_len(out), NULL, &oname, &oext)
+		|| !ffstr_eqcz(&iname, "@stdin")
+		|| !ffstr_eqcz(&oname, "@stdout")
+		|| iext.len == 0
+		|| !ffstr_ieq(&iext, oext.ptr, oext.len))
+		return 0;
+
+	if ((int64)p->audio.seek != FMED_NULL
+		|| (int64)p->audio.until != FMED_NULL
+		|| (int64)p->audio.split != FMED_NULL
+		|| p->audio.gain != 0
+		|| p->audio.convfmt.format != 0
+		|| p->audio.convfmt.channels != 0
+		|| p->audio.convfmt.sample_rate != 0
+		|| p->a_start_level != 0
+		|| p->a_stop_level != 0
+		|| p->use_dynanorm
+		|| p->pcm_peaks
+		|| p->input_info
+		|| p->show_tags
+		|| core->props->gui)
+		return 0;
+
+	// encoder settings
+	fmed_trk def;
+	trk_copy_info(&def, NULL);
+	if (0 != ffmemcmp(&def._bar_start, &p->_bar_start, FFOFF(fmed_trk, _bar_end) - FFOFF(fmed_trk, _bar_start)))
+		return 0;
+
+	if (0 != trk_cmd(t, FMED_TRACK_META_HAVEUSER))
+		return 0;
+
+	return 1;
+}
+
+/** Replace the input filters with #file.splice. */
+static void trk_splice_setup(fm_trk *t)
+{
+	t->filters.len = 0;
+	ffchain_init(&t->filt_chain);
+	t->cur = ffchain_sentl(&t->filt_chain);
+	addfilter(t, "#queue.track");
+	addfilter(t, "#file.splice");
+	dbglog(t, "stdin -> stdout passthrough", 0);
+}
+
+
+// PIPE
+
+/*
+Conversion pipeline: the track is split into 2 tracks, so that they are processed by different workers.
+ input track:  #queue.track -> INPUT -> DECODER -> (#soundmod.until) -> UI -> #core.pipe-out
+ output track: #queue.track -> #core.pipe-in -> #soundmod.autoconv -> (#soundmod.conv) -> ENCODER -> OUTPUT
+PCM data is copied into a bounded ring of blocks (single writer, single reader).
+Gain value is passed along with each block.
+The writer waits (FMED_RASYNC) while the ring is full, the reader waits while it's empty.
+The other side wakes up the waiting track via FMED_TRACK_WAKE.
+The output track is started when the first data is written, after the input track has set audio format.
+The queue item is referenced by both tracks (see FMED_TRACK_PIPE).
+*/
+
+/** Return TRUE if the output part of the track should be processed by another worker. */
+static int trk_pipe_want(fm_trk *t)
+{
+	return g->conv_pipeline
+		&& t->props.type == FMED_TRK_TYPE_PLAYBACK
+		&& !t->props.stream_copy
+		&& !t->props.pcm_peaks
+		&& (int64)t->props.audio.split == FMED_NULL
+		&& FMED_PNULL != trk_getvalstr(t, "output");
+}
+
+/** Create output track for the conversion pipeline.  Thread: main.
+Return NULL on error: all filters will be added to the input track. */
+static fm_trk* trk_pipe_create(fm_trk *t)
+{
+	fm_trk *o;
+	struct trk_pipe *p;
+
+	if (NULL == (p = ffmem_new(struct trk_pipe)))
+		return NULL;
+	if (NULL == (o = trk_create(FMED_TRK_TYPE_NONE, NULL))) {
+		ffmem_free(p);
+		return NULL;
+	}
+	o->props.type = t->props.type;
+	trk_copy_info(&o->props, &t->props);
+	trk_vals_copy(o, t);
+
+	if (NULL == addfilter(o, "#queue.track")
+		|| NULL == addfilter(o, "#core.pipe-in")
+		|| NULL == addfilter(t, "#core.pipe-out")) {
+		trk_free(o);
+		ffmem_free(p);
+		return NULL;
+	}
+
+	p->ref = 2;
+	fflk_init(&p->lk);
+	p->wtrk = t;
+	p->rtrk = o;
+	t->pipe = p;
+	o->pipe = p;
+	trk_opened(o);
+	g->pipe_trks++;
+
+	if (o->props.print_time)
+		ffps_perf(&o->psperf, FFPS_PERF_REALTIME | FFPS_PERF_CPUTIME | FFPS_PERF_RUSAGE);
+
+	dbglog(t, "conversion pipeline: output track %S", &o->id);
+	return o;
+}
+
+/** Detach the track from the pipeline.  Thread: main. */
+static void trk_pipe_free(fm_trk *t)
+{
+	struct trk_pipe *p = t->pipe;
+
+	if (t == p->wtrk) {
+		fflk_lock(&p->lk);
+		p->wtrk = NULL;
+		fflk_unlock(&p->lk);
+		if (!p->started && p->rtrk != NULL) {
+			// output track didn't receive any data
+			fm_trk *o = p->rtrk;
+			o->state = (t->state == TRK_ST_ERR) ? TRK_ST_ERR : TRK_ST_STOPPED;
+			trk_fin(o);
+		}
+
+	} else {
+		fflk_lock(&p->lk);
+		p->rtrk = NULL;
+		fflk_unlock(&p->lk);
+		g->pipe_trks--;
+		pipe_rclose(p); // the writer mustn't wait for the reader which is gone
+	}
+
+	if (--p->ref == 0) {
+		for (uint i = 0;  i != PIPE_BLOCKS;  i++) {
+			ffarr_free(&p->blks[i].buf);
+		}
+		ffmem_free(p);
+	}
+}
+
+/** Wake up the peer track if it's waiting.
+The peer may be detached by main thread at the same time. */
+static void pipe_wake(struct trk_pipe *p, ffatomic *wait, fm_trk **peer)
+{
+	if (!ffatom_cmpset(wait, 1, 0))
+		return;
+	fflk_lock(&p->lk);
+	if (*peer != NULL)
+		trk_cmd(*peer, FMED_TRACK_WAKE);
+	fflk_unlock(&p->lk);
+}
+
+/** Copy values of the input track and start the output track.  Thread: writer. */
+static void pipe_start(struct trk_pipe *p)
+{
+	fm_trk *t, *src = p->wtrk;
+
+	fflk_lock(&p->lk);
+	if (NULL == (t = p->rtrk)) {
+		fflk_unlock(&p->lk);
+		return; // output track is closed
+	}
+
+	uint out_seekable = t->props.out_seekable, conv_gain = t->props.conv_gain;
+	trk_copy_info(&t->props, &src->props);
+	t->props.out_seekable = out_seekable;
+	t->props.conv_gain = conv_gain;
+	t->props.datatype = src->props.datatype;
+	// seeking is performed by the input track
+	t->props.audio.seek = FMED_NULL;
+	t->props.audio.until = FMED_NULL;
+	trk_vals_copy(t, src);
+
+	p->started = 1;
+	dbglog(src, "starting output track %S on worker #%u", &t->id, t->wid);
+	trk_post(t, &t->tsk);
+	fflk_unlock(&p->lk);
+}
+
+/** Close the writing side: the reader won't get any more data. */
+static void pipe_wclose(struct trk_pipe *p, uint state)
+{
+	if (p->wstate != PIPE_ACTIVE)
+		return;
+	ffatom_fence_rel();
+	FF_WRITEONCE(p->wstate, state);
+	if (p->started)
+		pipe_wake(p, &p->rwait, &p->rtrk);
+}
+
+static void* pipe_out_open(fmed_filt *d)
+{
+	fm_trk *t = d->trk;
+	return t->pipe;
+}
+
+static void pipe_out_close(void *ctx)
+{
+	struct trk_pipe *p = ctx;
+	ffatom_cmpset(&p->wwait, 1, 0);
+	pipe_wclose(p, PIPE_ERR);
+}
+
+static int pipe_blk_write(struct pipe_blk *b, const fmed_filt *d)
+{
+	if (b->buf.cap < d->datalen) {
+		ffarr_free(&b->buf);
+		if (NULL == ffarr_alloc(&b->buf, d->datalen))
+			return -1;
+	}
+
+	if (d->audio.fmt.ileaved) {
+		ffmemcpy(b->buf.ptr, d->data, d->datalen);
+
+	} else {
+		uint nch = d->audio.fmt.channels & FFPCM_CHMASK;
+		size_t chlen = d->datalen / nch;
+		for (uint i = 0;  i != nch;  i++) {
+			b->ni[i] = b->buf.ptr + i * chlen;
+			ffmemcpy(b->ni[i], d->datani[i], chlen);
+		}
+	}
+
+	b->len = d->datalen;
+	b->gain = d->audio.gain;
+	return 0;
+}
+
+static int pipe_out_process(void *ctx, fmed_filt *d)
+{
+	struct trk_pipe *p = ctx;
+
+	if (d->flags & FMED_FSTOP) {
+		pipe_wclose(p, PIPE_STOP);
+		return FMED_RFIN;
+	}
+
+	if (FF_READONCE(p->rclosed))
+		return FMED_RFIN; // output track is closed
+
+	if (!p->started)
+		pipe_start(p);
+
+	if (d->datalen != 0) {
+		size_t n = ffatom_get(&p->nwritten);
+
+		if (n - ffatom_get(&p->nread) == PIPE_BLOCKS) {
+			ffatom_cmpset(&p->wwait, 0, 1);
+			if (n - ffatom_get(&p->nread) == PIPE_BLOCKS && !FF_READONCE(p->rclosed))
+				return FMED_RASYNC;
+			if (!ffatom_cmpset(&p->wwait, 1, 0))
+				return FMED_RASYNC; // the reader is waking us up
+			if (FF_READONCE(p->rclosed))
+				return FMED_RFIN;
+		}
+
+		if (0 != pipe_blk_write(&p->blks[n % PIPE_BLOCKS], d)) {
+			errlog(d->trk, "%e", FFERR_BUFALOC);
+			return FMED_RERR;
+		}
+		ffatom_fence_rel();
+		ffatom_inc(&p->nwritten);
+		pipe_wake(p, &p->rwait, &p->rtrk);
+		d->datalen = 0;
+	}
+
+	if (d->flags & FMED_FLAST) {
+		pipe_wclose(p, PIPE_EOF);
+		return FMED_RDONE;
+	}
+	return FMED_RMORE;
+}
+
+const fmed_filter trk_pipe_out = {
+	&pipe_out_open, &pipe_out_process, &pipe_out_close
+};
+
+/** Close the reading side. */
+static void pipe_rclose(struct trk_pipe *p)
+{
+	if (p->rclosed)
+		return;
+	FF_WRITEONCE(p->rclosed, 1);
+	ffatom_fence_rel();
+	pipe_wake(p, &p->wwait, &p->wtrk);
+}
+
+static void* pipe_in_open(fmed_filt *d)
+{
+	fm_trk *t = d->trk;
+	return t->pipe;
+}
+
+static void pipe_in_close(void *ctx)
+{
+	struct trk_pipe *p = ctx;
+	ffatom_cmpset(&p->rwait, 1, 0);
+	pipe_rclose(p);
+}
+
+/** The writer won't write any more data. */
+static int pipe_in_end(struct trk_pipe *p, fmed_filt *d, uint state)
+{
+	d->outlen = 0;
+
+	switch (state) {
+	case PIPE_STOP:
+		trk_setval_id(d->trk, FMED_TRKV_STOPPED, 1);
+		d->flags |= FMED_FSTOP;
+		break;
+
+	case PIPE_ERR:
+		errlog(d->trk, "input track is closed", 0);
+		return FMED_RERR;
+	}
+
+	return FMED_RDONE;
+}
+
+static int pipe_in_process(void *ctx, fmed_filt *d)
+{
+	struct trk_pipe *p = ctx;
+	size_t n;
+
+	if (p->rhold) {
+		// the next filters have processed the current block
+		p->rhold = 0;
+		ffatom_fence_rel();
+		ffatom_inc(&p->nread);
+		pipe_wake(p, &p->wwait, &p->wtrk);
+	}
+
+	if (d->flags & FMED_FSTOP) {
+		pipe_rclose(p);
+		d->outlen = 0;
+		return FMED_RDONE;
+	}
+
+	for (;;) {
+		n = ffatom_get(&p->nread);
+		if (n != ffatom_get(&p->nwritten))
+			break;
+
+		uint st = FF_READONCE(p->wstate);
+		ffatom_fence_acq();
+		if (n != ffatom_get(&p->nwritten))
+			break;
+		if (st != PIPE_ACTIVE)
+			return pipe_in_end(p, d, st);
+
+		ffatom_cmpset(&p->rwait, 0, 1);
+		if (n == ffatom_get(&p->nwritten) && FF_READONCE(p->wstate) == PIPE_ACTIVE)
+			return FMED_RASYNC;
+		if (!ffatom_cmpset(&p->rwait, 1, 0))
+			return FMED_RASYNC; // the writer is waking us up
+	}
+
+	ffatom_fence_acq();
+	const struct pipe_blk *b = &p->blks[n % PIPE_BLOCKS];
+	if (d->audio.fmt.ileaved)
+		d->out = b->buf.ptr;
+	else
+		d->outni = (void**)b->ni;
+	d->outlen = b->len;
+	d->audio.gain = b->gain; // pass gain changes at runtime
+	p->rhold = 1;
+	return FMED_RDATA;
+}
+
+const fmed_filter trk_pipe_in = {
+	&pipe_in_open, &pipe_in_process, &pipe_in_close
+};
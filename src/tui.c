@@ -245,7 +245,7 @@ static int tui_config(ffpars_ctx *conf)
 
 static void* tui_open(fmed_filt *d)
 {
-	tui *t = ffmem_tcalloc1(tui);
+	tui *t = fmed_trk_allocT(d, tui);
 	if (t == NULL)
 		return NULL;
 	t->lastpos = (uint)-1;
@@ -298,7 +298,6 @@ static void tui_close(void *ctx)
 	if (t == gt->curtrk_rec)
 		gt->curtrk_rec = NULL;
 	ffarr_free(&t->buf);
-	ffmem_free(t);
 }
 
 static void tui_addtags(tui *t, fmed_que_entry *qent, ffarr *buf)
@@ -337,7 +336,7 @@ static void tui_info(tui *t, fmed_filt *d)
 	if (FMED_PNULL != (tstr = (void*)d->track->getvalstr3(d->trk, "title", FMED_TRK_META | FMED_TRK_VALSTR)))
 		title = *tstr;
 
-	fmed_que_entry *qtrk = (void*)d->track->getval(d->trk, "queue_item");
+	fmed_que_entry *qtrk = (void*)d->track->getval_id(d->trk, FMED_TRKV_QUEUE_ITEM);
 	size_t trkid = (qtrk != FMED_PNULL) ? gt->qu->cmdv(FMED_QUE_ID, qtrk) + 1 : 1;
 
 	t->buf.len = 0;
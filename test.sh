@@ -127,6 +127,11 @@ if test "$1" = "convert" ; then
 	OPTS="-y --parallel"
 	$BIN rec.wav enc48.flac enc48mono.mp3 -o 'parallel-$filename.m4a' $OPTS
 	$BIN parallel-*.m4a --pcm-peaks
+
+	# segment-parallel conversion
+	$BIN rec.wav -o segs.wav -y --parallel-segments=4
+	$BIN enc48.flac -o segs48.wav -y --parallel-segments=4
+	$BIN segs*.wav --pcm-peaks
 fi
 
 if test "$1" = "convert-sc" ; then